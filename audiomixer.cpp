@@ -0,0 +1,242 @@
+#include "audiomixer.h"
+#include "avhandles.h"
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef struct MixerCommand {
+    int input;
+    float gain;
+    bool muted;
+} MixerCommand;
+
+struct AudioMixer {
+    AVFilterGraph* filterGraph;
+    std::vector<AVFilterContext*> volumeCtxs;
+    const char* modeName;
+
+    // Written by any thread, read by the graph thread
+    std::mutex commandMutex;
+    std::vector<MixerCommand> pendingCommands;
+
+    // Only touched under commandMutex, the state the next command starts from
+    std::vector<float> gains;
+    std::vector<bool> muted;
+};
+
+static bool sameLayouts(const AudioMixerInput* inputs, int count) {
+    for (int i = 1; i < count; i++) {
+        if (av_channel_layout_compare(&inputs[i].chLayout, &inputs[0].chLayout) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Output channel k takes channel k of every input, wrapping around for inputs with
+// fewer channels (so mono inputs land on all of them)
+static std::string defaultPanExpression(const AudioMixerInput* inputs, int count, const AVChannelLayout* outChLayout) {
+    char layoutName[64];
+    av_channel_layout_describe(outChLayout, layoutName, sizeof(layoutName));
+
+    std::string expression = layoutName;
+    for (int outChannel = 0; outChannel < outChLayout->nb_channels; outChannel++) {
+        expression += "|c" + std::to_string(outChannel) + "=";
+
+        int firstChannel = 0;
+        for (int i = 0; i < count; i++) {
+            const int channels = inputs[i].chLayout.nb_channels;
+            expression += (i == 0 ? "c" : "+c") + std::to_string(firstChannel + outChannel % channels);
+            firstChannel += channels;
+        }
+    }
+
+    return expression;
+}
+
+static float effectiveVolume(float gain, bool muted) {
+    return muted ? 0.0f : gain;
+}
+
+static AVFilterGraph* createMixerGraph(AudioMixer* mixer, const AudioMixerInput* inputs, int count, const AVChannelLayout* outChLayout,
+                                       const char* pan, AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx) {
+    FilterGraphPtr filterGraph(avfilter_graph_alloc());
+
+    const AVFilter *bufferSrcFilter = avfilter_get_by_name("abuffer");
+    const AVFilter *volumeFilter = avfilter_get_by_name("volume");
+    const AVFilter *bufferSinkFilter = avfilter_get_by_name("abuffersink");
+
+    char filterName[64];
+    char filterArgs[512];
+    char layoutName[64];
+
+    for (int i = 0; i < count; i++) {
+        AVFilterContext *volumeCtx;
+        av_channel_layout_describe(&inputs[i].chLayout, layoutName, sizeof(layoutName));
+
+        snprintf(filterArgs, sizeof(filterArgs),
+            "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+            inputs[i].timeBase.num,
+            inputs[i].timeBase.den,
+            inputs[i].sampleRate,
+            av_get_sample_fmt_name(inputs[i].sampleFormat),
+            layoutName);
+        snprintf(filterName, sizeof(filterName), "a-in%d", i + 1);
+        if (avfilter_graph_create_filter(&bufferSrcCtxs[i], bufferSrcFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        // volume passes frames through untouched at 1.0, so idle gain costs nothing
+        snprintf(filterArgs, sizeof(filterArgs), "volume=%f:precision=float",
+            effectiveVolume(inputs[i].gain, inputs[i].muted));
+        snprintf(filterName, sizeof(filterName), "a-volume%d", i + 1);
+        if (avfilter_graph_create_filter(&volumeCtx, volumeFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        if (avfilter_link(bufferSrcCtxs[i], 0, volumeCtx, 0) < 0) {
+            return nullptr;
+        }
+        mixer->volumeCtxs.push_back(volumeCtx);
+    }
+
+    const bool hasPan = pan != nullptr && pan[0] != '\0';
+    const bool useAmix = !hasPan && sameLayouts(inputs, count);
+    AVFilterContext *mixCtx = nullptr;
+
+    if (count > 1) {
+        // normalize=0 sums like the pan expressions do, instead of scaling each input by 1/N
+        snprintf(filterArgs, sizeof(filterArgs), useAmix ? "inputs=%d:duration=longest:normalize=0" : "inputs=%d", count);
+        if (avfilter_graph_create_filter(&mixCtx, avfilter_get_by_name(useAmix ? "amix" : "amerge"),
+                                         useAmix ? "a-amix" : "a-amerge", filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (avfilter_link(mixer->volumeCtxs[i], 0, mixCtx, i) < 0) {
+                return nullptr;
+            }
+        }
+        mixer->modeName = useAmix ? "amix" : "amerge";
+    } else {
+        mixCtx = mixer->volumeCtxs[0];
+        mixer->modeName = "passthrough";
+    }
+
+    AVFilterContext *lastCtx = mixCtx;
+
+    // amix keeps the shared layout, amerged channels need mapping onto the output
+    if (!useAmix) {
+        AVFilterContext *panCtx;
+        const std::string panExpression = hasPan ? pan : defaultPanExpression(inputs, count, outChLayout);
+
+        if (avfilter_graph_create_filter(&panCtx, avfilter_get_by_name("pan"), "a-pan", panExpression.c_str(), nullptr, filterGraph.get()) < 0) {
+            std::cout << "Bad pan expression: " << panExpression << "\n";
+            return nullptr;
+        }
+
+        if (avfilter_link(lastCtx, 0, panCtx, 0) < 0) {
+            return nullptr;
+        }
+        lastCtx = panCtx;
+    }
+
+    if (avfilter_graph_create_filter(bufferSinkCtx, bufferSinkFilter, "a-out", nullptr, nullptr, filterGraph.get()) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_link(lastCtx, 0, *bufferSinkCtx, 0) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_graph_config(filterGraph.get(), nullptr) < 0) {
+        return nullptr;
+    }
+
+    return filterGraph.release();
+}
+
+AudioMixer* audioMixerAlloc(const AudioMixerInput* inputs, int count, const AVChannelLayout* outChLayout, const char* pan,
+                            AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx) {
+    if (count < 1) {
+        return nullptr;
+    }
+
+    AudioMixer* mixer = new AudioMixer();
+    mixer->filterGraph = createMixerGraph(mixer, inputs, count, outChLayout, pan, bufferSrcCtxs, bufferSinkCtx);
+    if (mixer->filterGraph == nullptr) {
+        delete mixer;
+        return nullptr;
+    }
+
+    for (int i = 0; i < count; i++) {
+        mixer->gains.push_back(inputs[i].gain);
+        mixer->muted.push_back(inputs[i].muted);
+    }
+
+    return mixer;
+}
+
+void audioMixerFree(AudioMixer** mixer) {
+    if (mixer == nullptr || *mixer == nullptr) {
+        return;
+    }
+
+    avfilter_graph_free(&(*mixer)->filterGraph);
+    delete *mixer;
+    *mixer = nullptr;
+}
+
+const char* audioMixerModeName(AudioMixer* mixer) {
+    return mixer->modeName;
+}
+
+int audioMixerInputCount(AudioMixer* mixer) {
+    return (int) mixer->volumeCtxs.size();
+}
+
+bool audioMixerSetGain(AudioMixer* mixer, int input, float gain) {
+    if (input < 0 || input >= audioMixerInputCount(mixer) || gain < 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mixer->commandMutex);
+    mixer->gains[input] = gain;
+    mixer->pendingCommands.push_back({ input, gain, mixer->muted[input] });
+    return true;
+}
+
+bool audioMixerSetMute(AudioMixer* mixer, int input, bool muted) {
+    if (input < 0 || input >= audioMixerInputCount(mixer)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mixer->commandMutex);
+    mixer->muted[input] = muted;
+    mixer->pendingCommands.push_back({ input, mixer->gains[input], muted });
+    return true;
+}
+
+int audioMixerApplyCommands(AudioMixer* mixer) {
+    std::vector<MixerCommand> commands;
+    {
+        std::lock_guard<std::mutex> lock(mixer->commandMutex);
+        if (mixer->pendingCommands.empty()) {
+            return 0;
+        }
+        commands.swap(mixer->pendingCommands);
+    }
+
+    char volume[32];
+    for (const MixerCommand& command : commands) {
+        snprintf(volume, sizeof(volume), "%f", effectiveVolume(command.gain, command.muted));
+        if (avfilter_process_command(mixer->volumeCtxs[command.input], "volume", volume, nullptr, 0, 0) < 0) {
+            std::cout << "Failed to set volume of audio input " << command.input + 1 << "\n";
+        }
+    }
+
+    return (int) commands.size();
+}
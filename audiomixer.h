@@ -0,0 +1,51 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/rational.h>
+#include <libavutil/samplefmt.h>
+}
+
+// Mixes N audio inputs into one stream. Every input gets abuffer -> volume, then:
+//   amix          - every input has the same channel layout and no pan was given,
+//                   inputs are summed channel by channel
+//   amerge + pan  - layouts differ or a pan expression was given. The pan expression
+//                   addresses the merged channels (c0.. of input 1, then input 2, ...);
+//                   without one, output channel k sums channel k of every input
+// A single input skips both. Whatever layout comes out, the stream resampler after the
+// sink converts it to the encoder's.
+//
+// Gain and mute go to the volume filters as commands, so they change without
+// rebuilding the graph (and without resetting amix/amerge buffering).
+typedef struct AudioMixer AudioMixer;
+
+typedef struct AudioMixerInput {
+    AVRational timeBase;
+    int sampleRate;
+    AVSampleFormat sampleFormat;
+    AVChannelLayout chLayout;
+    float gain;             // linear, 1 leaves the input untouched
+    bool muted;
+} AudioMixerInput;
+
+// pan may be nullptr for the automatic choice. bufferSrcCtxs receives one abuffer per
+// input, in order. The mixer owns the filter graph.
+AudioMixer* audioMixerAlloc(const AudioMixerInput* inputs, int count, const AVChannelLayout* outChLayout, const char* pan,
+                            AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx);
+void audioMixerFree(AudioMixer** mixer);
+
+// "amix", "amerge" or "passthrough"
+const char* audioMixerModeName(AudioMixer* mixer);
+int audioMixerInputCount(AudioMixer* mixer);
+
+// Thread-safe. The change is queued until audioMixerApplyCommands() runs on the
+// thread that feeds the graph. input counts from 0; false when out of range.
+bool audioMixerSetGain(AudioMixer* mixer, int input, float gain);
+bool audioMixerSetMute(AudioMixer* mixer, int input, bool muted);
+
+// Applies queued gain/mute changes, returns how many were applied
+int audioMixerApplyCommands(AudioMixer* mixer);
+
+#endif
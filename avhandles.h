@@ -0,0 +1,75 @@
+#ifndef AVHANDLES_H
+#define AVHANDLES_H
+
+#include <memory>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+// Move-only owners of the FFmpeg contexts: each frees its context with the matching
+// FFmpeg call when it goes out of scope, so a setup that fails halfway returns without
+// freeing by hand. get() hands the raw pointer to FFmpeg, release() gives up ownership.
+//
+//   CodecContextPtr codecCtx(avcodec_alloc_context3(codec));
+//   if (avcodec_open2(codecCtx.get(), codec, nullptr) < 0) {
+//       return false;          // codecCtx is freed here
+//   }
+//
+// A writer opened on an output context must be closed before the context is freed:
+// declare the OutputFormatPtr first, members and locals are destroyed in reverse order.
+
+struct InputFormatDeleter {
+    void operator()(AVFormatContext* formatCtx) const { avformat_close_input(&formatCtx); }
+};
+
+struct OutputFormatDeleter {
+    void operator()(AVFormatContext* formatCtx) const { avformat_free_context(formatCtx); }
+};
+
+struct CodecContextDeleter {
+    void operator()(AVCodecContext* codecCtx) const { avcodec_free_context(&codecCtx); }
+};
+
+struct FrameDeleter {
+    void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+};
+
+struct PacketDeleter {
+    void operator()(AVPacket* packet) const { av_packet_free(&packet); }
+};
+
+struct SwsContextDeleter {
+    void operator()(SwsContext* swsCtx) const { sws_freeContext(swsCtx); }
+};
+
+struct SwrContextDeleter {
+    void operator()(SwrContext* swrCtx) const { swr_free(&swrCtx); }
+};
+
+struct FilterGraphDeleter {
+    void operator()(AVFilterGraph* filterGraph) const { avfilter_graph_free(&filterGraph); }
+};
+
+typedef std::unique_ptr<AVFormatContext, InputFormatDeleter> InputFormatPtr;      // avformat_open_input()
+typedef std::unique_ptr<AVFormatContext, OutputFormatDeleter> OutputFormatPtr;    // avformat_alloc_output_context2()
+typedef std::unique_ptr<AVCodecContext, CodecContextDeleter> CodecContextPtr;
+typedef std::unique_ptr<AVFrame, FrameDeleter> FramePtr;
+typedef std::unique_ptr<AVPacket, PacketDeleter> PacketPtr;
+typedef std::unique_ptr<SwsContext, SwsContextDeleter> SwsContextPtr;
+typedef std::unique_ptr<SwrContext, SwrContextDeleter> SwrContextPtr;
+typedef std::unique_ptr<AVFilterGraph, FilterGraphDeleter> FilterGraphPtr;
+
+static inline FramePtr allocFrame() {
+    return FramePtr(av_frame_alloc());
+}
+
+static inline PacketPtr allocPacket() {
+    return PacketPtr(av_packet_alloc());
+}
+
+#endif
@@ -0,0 +1,239 @@
+#include "batch.h"
+#include "jobconfig.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// How often the pool looks for finished jobs and a raised stop
+#define batchPollMs 50
+
+typedef struct BatchJob {
+    std::string path;
+    std::string name;
+    std::string output;
+    int threads;            // --threads passed on, 0 for none
+    pid_t pid;
+    std::chrono::steady_clock::time_point start;
+    double wallSeconds;
+    double cpuSeconds;
+    bool succeeded;
+} BatchJob;
+
+static std::vector<std::string> listJobFiles(const char* directory) {
+    std::vector<std::string> paths;
+    DIR* dir = opendir(directory);
+    if (dir == nullptr) {
+        return paths;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const size_t length = strlen(entry->d_name);
+        if (length > 4 && strcmp(entry->d_name + length - 4, ".ini") == 0) {
+            paths.push_back(std::string(directory) + "/" + entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+double childCpuSeconds(const struct rusage* usage) {
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+pid_t spawnEngine(const char* program, const std::vector<std::string>& args, const std::string& logPath) {
+    std::vector<const char*> argv = { program };
+    for (const std::string& arg : args) {
+        argv.push_back(arg.c_str());
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    const int logFd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const int nullFd = open("/dev/null", O_RDONLY);
+    if (logFd < 0 || nullFd < 0) {
+        _exit(127);
+    }
+    dup2(nullFd, STDIN_FILENO);
+    dup2(logFd, STDOUT_FILENO);
+    dup2(logFd, STDERR_FILENO);
+
+    execvp(program, const_cast<char* const*>(argv.data()));
+    _exit(127);
+}
+
+static pid_t launchJob(const char* program, const BatchJob* job) {
+    std::vector<std::string> args = { "--job", job->path };
+    if (job->threads > 0) {
+        args.push_back("--threads");
+        args.push_back(std::to_string(job->threads));
+    }
+    return spawnEngine(program, args, job->path + ".log");
+}
+
+// Duration and video frame count of a finished output, false when it can't be read back
+// (e.g. a segment pattern)
+static bool probeOutput(const std::string& path, double* seconds, int64_t* frames) {
+    AVFormatContext* formatCtx = nullptr;
+    if (avformat_open_input(&formatCtx, path.c_str(), nullptr, nullptr) < 0) {
+        return false;
+    }
+
+    *seconds = formatCtx->duration > 0 ? formatCtx->duration / (double) AV_TIME_BASE : 0;
+    *frames = 0;
+    const int videoIndex = av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoIndex >= 0) {
+        *frames = formatCtx->streams[videoIndex]->nb_frames;
+    }
+
+    avformat_close_input(&formatCtx);
+    return *seconds > 0;
+}
+
+static void logJob(const BatchJob* job, double* mediaSeconds) {
+    std::cout << "job " << job->name << ": " << (job->succeeded ? "ok" : "failed")
+        << ", " << job->wallSeconds << " s wall, " << job->cpuSeconds << " s cpu ("
+        << (job->wallSeconds > 0 ? job->cpuSeconds / job->wallSeconds : 0) << " cores)";
+
+    double seconds;
+    int64_t frames;
+    if (job->succeeded && probeOutput(job->output, &seconds, &frames)) {
+        std::cout << ", " << seconds << " s of output at " << seconds / job->wallSeconds << "x";
+        if (frames > 0) {
+            std::cout << ", " << frames / job->wallSeconds << " fps";
+        }
+        *mediaSeconds += seconds;
+    }
+    std::cout << " -> " << job->output << "\n";
+}
+
+int runBatch(const char* program, const char* directory, int workers, const std::atomic<bool>* stop) {
+    const std::vector<std::string> paths = listJobFiles(directory);
+    if (paths.empty()) {
+        std::cout << "No *.ini jobs in " << directory << "\n";
+        return 1;
+    }
+
+    const int cores = std::max(1, (int) std::thread::hardware_concurrency());
+    if (workers <= 0) {
+        workers = cores;
+    }
+    workers = std::min(workers, (int) paths.size());
+    const int threadsPerJob = std::max(1, cores / workers);
+
+    // Load every job up front: a bad file fails here, and two jobs must not write the same output
+    std::vector<BatchJob> jobs;
+    int failed = 0;
+    for (const std::string& path : paths) {
+        JobConfig config;
+        jobConfigInit(&config);
+        if (!jobConfigLoadFile(&config, path.c_str())) {
+            std::cout << "Skipping " << path << "\n";
+            failed++;
+            continue;
+        }
+
+        const bool duplicate = std::any_of(jobs.begin(), jobs.end(), [&](const BatchJob& job) { return job.output == config.output; });
+        if (duplicate) {
+            std::cout << "Skipping " << path << ", another job writes " << config.output << "\n";
+            failed++;
+            continue;
+        }
+
+        BatchJob job = {};
+        job.path = path;
+        job.name = path.substr(path.find_last_of('/') + 1);
+        job.output = config.output;
+        job.threads = config.videoEncoder.threadCount == 0 ? threadsPerJob : 0;
+        jobs.push_back(job);
+    }
+
+    std::cout << "batch: " << jobs.size() << " jobs, " << workers << " at once, "
+        << threadsPerJob << " encoder threads per job\n";
+
+    const auto batchStart = std::chrono::steady_clock::now();
+    size_t nextJob = 0;
+    int running = 0;
+    bool stopping = false;
+    double totalCpuSeconds = 0;
+    double totalMediaSeconds = 0;
+
+    while (running > 0 || (nextJob < jobs.size() && !stopping)) {
+        while (running < workers && nextJob < jobs.size() && !stopping) {
+            BatchJob* job = &jobs[nextJob++];
+            job->start = std::chrono::steady_clock::now();
+            job->pid = launchJob(program, job);
+            if (job->pid < 0) {
+                std::cout << "Failed to start " << job->name << "\n";
+                failed++;
+                continue;
+            }
+            running++;
+        }
+
+        // Jobs started from a terminal get its SIGINT too, jobs of a signaled parent get it from here
+        if (!stopping && stop->load()) {
+            stopping = true;
+            for (BatchJob& job : jobs) {
+                if (job.pid > 0) {
+                    kill(job.pid, SIGINT);
+                }
+            }
+        }
+
+        int status;
+        struct rusage usage;
+        const pid_t pid = wait4(-1, &status, WNOHANG, &usage);
+        if (pid <= 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(batchPollMs));
+            continue;
+        }
+
+        for (BatchJob& job : jobs) {
+            if (job.pid != pid) {
+                continue;
+            }
+            job.pid = 0;
+            job.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start).count();
+            job.cpuSeconds = childCpuSeconds(&usage);
+            job.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (!job.succeeded) {
+                failed++;
+            }
+            totalCpuSeconds += job.cpuSeconds;
+            logJob(&job, &totalMediaSeconds);
+            running--;
+        }
+    }
+
+    const double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+    std::cout << "batch: " << nextJob << "/" << jobs.size() << " jobs run, " << failed << " failed, "
+        << batchSeconds << " s wall, " << totalCpuSeconds << " s cpu ("
+        << (batchSeconds > 0 ? totalCpuSeconds / batchSeconds : 0) << " cores)";
+    if (totalMediaSeconds > 0) {
+        std::cout << ", " << totalMediaSeconds << " s of output at " << totalMediaSeconds / batchSeconds << "x";
+    }
+    std::cout << "\n";
+
+    return failed;
+}
@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// Offline batch mode: every *.ini job file of a directory (see jobconfig.h) is run by an
+// engine process of its own, "program --job <file>", at most workers at once. The
+// inputs are files or lavfi sources, read as fast as the pipeline takes them. Each job
+// writes its log to <file>.log beside the job file.
+//
+// Jobs that leave the encoder threads at 0 get cores / workers threads each, so a full
+// pool runs about one thread per core instead of every job sizing itself to the machine.
+//
+// Every finished job prints its wall and CPU time and its throughput: seconds of output
+// per second of wall time and output frames per second. The totals come last.
+
+// workers 0 runs one job per core. Raising stop lets the running jobs finish and starts
+// no more. Returns the number of jobs that failed.
+int runBatch(const char* program, const char* directory, int workers, const std::atomic<bool>* stop);
+
+// Starts "program args..." with stdout and stderr in logPath and nothing on stdin (the
+// engine reads mixer commands there). Returns the child's pid, -1 if fork failed.
+pid_t spawnEngine(const char* program, const std::vector<std::string>& args, const std::string& logPath);
+
+// User plus system time of a child reaped with wait4()
+double childCpuSeconds(const struct rusage* usage);
+
+#endif
@@ -0,0 +1,71 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+// Counts heap allocations of the process it is preloaded into and prints
+// "allocations: N" on stdout when the process exits, the line bench/pipelinebench
+// reads. Counts malloc and friends, which covers operator new and av_malloc; realloc
+// counts too, it may move the block. glibc only (LD_PRELOAD), elsewhere the library
+// is empty and no line is printed.
+//
+// Usage: LD_PRELOAD=bench/alloccount.so ./crop ...
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+static std::atomic<uint64_t> allocations(0);
+
+static inline void countAllocation() {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void* malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    countAllocation();
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer != nullptr ? 0 : ENOMEM;
+}
+
+// Runs after main returned; write() since stdio may already be torn down
+__attribute__((destructor)) static void reportAllocations() {
+    char line[64];
+    const int length = snprintf(line, sizeof(line), "allocations: %llu\n", (unsigned long long) allocations.load());
+    if (length > 0 && write(STDOUT_FILENO, line, length) < 0) {
+        return;
+    }
+}
+
+#endif
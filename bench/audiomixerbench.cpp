@@ -0,0 +1,120 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+}
+
+#include "audiomixer.h"
+
+// Mixes 16 synthetic 48kHz fltp inputs (1024 sample frames) through AudioMixer on this
+// thread as fast as possible and reports how many times faster than real time it ran:
+//   amix   - every input stereo
+//   amerge - odd inputs mono, so the layouts differ and the default pan is used
+// Halfway through, every input's gain is changed and one input muted via commands,
+// the way engine's stdin control does, without rebuilding the graph.
+//
+// Usage: audiomixerbench [seconds of audio, default 600] [inputs, default 16]
+
+#define mixSampleRate 48000
+#define mixFrameSize 1024
+
+static AVFrame* createSineFrame(const AVChannelLayout* chLayout, double frequency) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_SAMPLE_FMT_FLTP;
+    frame->sample_rate = mixSampleRate;
+    frame->nb_samples = mixFrameSize;
+    av_channel_layout_copy(&frame->ch_layout, chLayout);
+    av_frame_get_buffer(frame, 0);
+
+    for (int channel = 0; channel < chLayout->nb_channels; channel++) {
+        float* samples = (float*) frame->data[channel];
+        for (int i = 0; i < mixFrameSize; i++) {
+            samples[i] = (float) (0.05 * sin(2 * M_PI * frequency * i / mixSampleRate));
+        }
+    }
+
+    return frame;
+}
+
+static double benchMixer(int count, bool mixedLayouts, int seconds) {
+    const AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+    const AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+
+    std::vector<AudioMixerInput> inputs(count);
+    std::vector<AVFrame*> sourceFrames(count);
+    for (int i = 0; i < count; i++) {
+        inputs[i].timeBase = { 1, mixSampleRate };
+        inputs[i].sampleRate = mixSampleRate;
+        inputs[i].sampleFormat = AV_SAMPLE_FMT_FLTP;
+        inputs[i].chLayout = mixedLayouts && i % 2 == 1 ? mono : stereo;
+        inputs[i].gain = 1.0f;
+        inputs[i].muted = false;
+        sourceFrames[i] = createSineFrame(&inputs[i].chLayout, 220.0 * (i + 1));
+    }
+
+    std::vector<AVFilterContext*> bufferSrcCtxs(count);
+    AVFilterContext* bufferSinkCtx;
+    AudioMixer* mixer = audioMixerAlloc(inputs.data(), count, &stereo, nullptr, bufferSrcCtxs.data(), &bufferSinkCtx);
+    if (mixer == nullptr) {
+        std::cout << "Failed to create the mixer\n";
+        return -1;
+    }
+
+    const int64_t frames = (int64_t) seconds * mixSampleRate / mixFrameSize;
+    AVFrame* mixedFrame = av_frame_alloc();
+    int64_t mixedSamples = 0;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    for (int64_t frame = 0; frame < frames; frame++) {
+        if (frame == frames / 2) {
+            for (int i = 0; i < count; i++) {
+                audioMixerSetGain(mixer, i, 0.5f);
+            }
+            audioMixerSetMute(mixer, 0, true);
+        }
+        audioMixerApplyCommands(mixer);
+
+        for (int i = 0; i < count; i++) {
+            sourceFrames[i]->pts = frame * mixFrameSize;
+            av_buffersrc_add_frame_flags(bufferSrcCtxs[i], sourceFrames[i], AV_BUFFERSRC_FLAG_KEEP_REF);
+        }
+
+        while (av_buffersink_get_frame(bufferSinkCtx, mixedFrame) >= 0) {
+            mixedSamples += mixedFrame->nb_samples;
+            av_frame_unref(mixedFrame);
+        }
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << audioMixerModeName(mixer) << ": " << count << " inputs, " << mixedSamples / mixSampleRate << "s mixed in "
+        << elapsed << "s, " << (double) mixedSamples / mixSampleRate / elapsed << "x real time\n";
+
+    av_frame_free(&mixedFrame);
+    for (AVFrame* sourceFrame : sourceFrames) {
+        av_frame_free(&sourceFrame);
+    }
+    audioMixerFree(&mixer);
+
+    return elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    const int seconds = argc > 1 ? atoi(argv[1]) : 600;
+    const int count = argc > 2 ? atoi(argv[2]) : 16;
+
+    if (benchMixer(count, false, seconds) < 0 || benchMixer(count, true, seconds) < 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+}
+
+#include "compositor.h"
+
+// Compares the cost of compositing N 1080p yuv420p inputs into a grid:
+//   overlay - the old way, pad the first input to the canvas, then one overlay per other input
+//   stack   - compositorCreateGraph, a single hstack/xstack for all inputs
+//
+// Every input gets the same frame, so the numbers are compositing alone without decode.
+//
+// Usage: compositorbench [frames, default 100] [input width height, default 1920 1080]
+
+#define warmupFrames 5
+
+static AVFilterGraph* createOverlayGraph(const CompositorTile* tiles, int count, int canvasWidth, int canvasHeight,
+                                         AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx) {
+    AVFilterGraph* filterGraph = avfilter_graph_alloc();
+
+    char filterName[64];
+    char filterArgs[512];
+
+    for (int i = 0; i < count; i++) {
+        snprintf(filterArgs, sizeof(filterArgs),
+            "video_size=%dx%d:pix_fmt=%d:time_base=1/30:pixel_aspect=1/1", tiles[i].width, tiles[i].height, AV_PIX_FMT_YUV420P);
+        snprintf(filterName, sizeof(filterName), "in%d", i + 1);
+        if (avfilter_graph_create_filter(&bufferSrcCtxs[i], avfilter_get_by_name("buffer"), filterName, filterArgs, nullptr, filterGraph) < 0) {
+            return nullptr;
+        }
+    }
+
+    AVFilterContext* lastCtx;
+    snprintf(filterArgs, sizeof(filterArgs), "%d:%d:%d:%d", canvasWidth, canvasHeight, tiles[0].x, tiles[0].y);
+    if (avfilter_graph_create_filter(&lastCtx, avfilter_get_by_name("pad"), "pad", filterArgs, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+    if (avfilter_link(bufferSrcCtxs[0], 0, lastCtx, 0) < 0) {
+        return nullptr;
+    }
+
+    for (int i = 1; i < count; i++) {
+        AVFilterContext* overlayCtx;
+        snprintf(filterArgs, sizeof(filterArgs), "%d:%d", tiles[i].x, tiles[i].y);
+        snprintf(filterName, sizeof(filterName), "overlay%d", i);
+        if (avfilter_graph_create_filter(&overlayCtx, avfilter_get_by_name("overlay"), filterName, filterArgs, nullptr, filterGraph) < 0) {
+            return nullptr;
+        }
+        if (avfilter_link(lastCtx, 0, overlayCtx, 0) < 0 || avfilter_link(bufferSrcCtxs[i], 0, overlayCtx, 1) < 0) {
+            return nullptr;
+        }
+        lastCtx = overlayCtx;
+    }
+
+    if (avfilter_graph_create_filter(bufferSinkCtx, avfilter_get_by_name("buffersink"), "out", nullptr, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+    if (avfilter_link(lastCtx, 0, *bufferSinkCtx, 0) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_graph_config(filterGraph, nullptr) < 0) {
+        return nullptr;
+    }
+
+    return filterGraph;
+}
+
+static AVFrame* createSourceFrame(int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 0);
+
+    for (int plane = 0; plane < 3; plane++) {
+        const int shift = plane == 0 ? 0 : 1;
+        for (int y = 0; y < height >> shift; y++) {
+            uint8_t* line = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < width >> shift; x++) {
+                line[x] = (uint8_t) (x * 7 + y * 3 + plane * 64);
+            }
+        }
+    }
+
+    return frame;
+}
+
+// Pushes the source frame into every input and pulls one canvas per frame, returns ms per canvas
+static double runGraph(AVFilterGraph* filterGraph, std::vector<AVFilterContext*>& bufferSrcCtxs, AVFilterContext* bufferSinkCtx,
+                       AVFrame* sourceFrame, int frames) {
+    if (filterGraph == nullptr) {
+        return -1;
+    }
+
+    AVFrame* filteredFrame = av_frame_alloc();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int i = -warmupFrames; i < frames; i++) {
+        if (i == 0) {
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        sourceFrame->pts = i + warmupFrames;
+        for (AVFilterContext* bufferSrcCtx : bufferSrcCtxs) {
+            av_buffersrc_add_frame_flags(bufferSrcCtx, sourceFrame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        }
+
+        while (av_buffersink_get_frame(bufferSinkCtx, filteredFrame) >= 0) {
+            av_frame_unref(filteredFrame);
+        }
+    }
+
+    const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    av_frame_free(&filteredFrame);
+    avfilter_graph_free(&filterGraph);
+
+    return elapsed / frames;
+}
+
+int main(int argc, char* argv[]) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 100;
+    const int width = argc > 3 ? atoi(argv[2]) : 1920;
+    const int height = argc > 3 ? atoi(argv[3]) : 1080;
+
+    AVFrame* sourceFrame = createSourceFrame(width, height);
+
+    for (int count : { 2, 4, 8, 16 }) {
+        std::vector<CompositorTile> tiles(count);
+        for (CompositorTile& tile : tiles) {
+            tile = {};
+            tile.width = width;
+            tile.height = height;
+            tile.pixelFormat = AV_PIX_FMT_YUV420P;
+            tile.timeBase = { 1, 30 };
+            tile.sampleAspectRatio = { 1, 1 };
+        }
+
+        int canvasWidth;
+        int canvasHeight;
+        compositorGridLayout(tiles.data(), count, 0, &canvasWidth, &canvasHeight);
+
+        std::vector<AVFilterContext*> bufferSrcCtxs(count);
+        AVFilterContext* bufferSinkCtx;
+
+        std::cout << count << " x " << width << "x" << height << " -> " << canvasWidth << "x" << canvasHeight
+            << ", " << frames << " frames\n";
+
+        AVFilterGraph* overlayGraph = createOverlayGraph(tiles.data(), count, canvasWidth, canvasHeight,
+            bufferSrcCtxs.data(), &bufferSinkCtx);
+        const double overlayMs = runGraph(overlayGraph, bufferSrcCtxs, bufferSinkCtx, sourceFrame, frames);
+        std::cout << "  overlay: " << overlayMs << " ms/frame, " << 1000 / overlayMs << " fps\n";
+
+        AVFilterGraph* stackGraph = compositorCreateGraph(tiles.data(), count, canvasWidth, canvasHeight,
+            AV_PIX_FMT_YUV420P, bufferSrcCtxs.data(), &bufferSinkCtx);
+        const double stackMs = runGraph(stackGraph, bufferSrcCtxs, bufferSinkCtx, sourceFrame, frames);
+        std::cout << "  stack:   " << stackMs << " ms/frame, " << 1000 / stackMs << " fps\n";
+    }
+
+    av_frame_free(&sourceFrame);
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+#include <libavutil/cpu.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include "framepool.h"
+#include "uyvycrop.h"
+
+// Compares the cost of getting a 500x800 yuv420p crop out of a uyvy422 capture frame:
+//   sws    - sws_scale the whole frame to yuv420p, then crop in the filter graph
+//   graph  - crop the native frame in the graph, then convert only the crop
+//   kernel - uyvycrop converts only the crop, once per implementation this CPU has
+//
+// Before timing, every kernel implementation is checked to be bit-exact against
+// sws_scale + crop on random content; the run fails if any pixel differs.
+//
+// Usage: convertbench [frames, default 200] [source width height, default 3840 2160]
+
+#define cropX 100
+#define cropY 0
+#define cropWidth 500
+#define cropHeight 800
+#define warmupFrames 10
+
+static AVFilterGraph* createCropGraph(int width, int height, int x, int y, AVPixelFormat srcFormat, AVPixelFormat dstFormat,
+                                      AVFilterContext** bufferSrcCtx, AVFilterContext** bufferSinkCtx) {
+    AVFilterGraph* filterGraph = avfilter_graph_alloc();
+    filterGraph->nb_threads = 1;
+
+    AVFilterContext* cropCtx;
+    AVFilterContext* formatCtx;
+
+    char filterArgs[512];
+    snprintf(filterArgs, sizeof(filterArgs),
+        "video_size=%dx%d:pix_fmt=%d:time_base=1/30:pixel_aspect=1/1", width, height, srcFormat);
+    if (avfilter_graph_create_filter(bufferSrcCtx, avfilter_get_by_name("buffer"), "in", filterArgs, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+
+    snprintf(filterArgs, sizeof(filterArgs), "%d:%d:%d:%d", cropWidth, cropHeight, x, y);
+    if (avfilter_graph_create_filter(&cropCtx, avfilter_get_by_name("crop"), "crop", filterArgs, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+
+    snprintf(filterArgs, sizeof(filterArgs), "pix_fmts=%s", av_get_pix_fmt_name(dstFormat));
+    if (avfilter_graph_create_filter(&formatCtx, avfilter_get_by_name("format"), "format", filterArgs, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_graph_create_filter(bufferSinkCtx, avfilter_get_by_name("buffersink"), "out", nullptr, nullptr, filterGraph) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_link(*bufferSrcCtx, 0, cropCtx, 0) < 0 ||
+        avfilter_link(cropCtx, 0, formatCtx, 0) < 0 ||
+        avfilter_link(formatCtx, 0, *bufferSinkCtx, 0) < 0) {
+        return nullptr;
+    }
+
+    if (avfilter_graph_config(filterGraph, nullptr) < 0) {
+        return nullptr;
+    }
+
+    return filterGraph;
+}
+
+static AVFrame* createSourceFrame(int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_UYVY422;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 0);
+
+    for (int y = 0; y < height; y++) {
+        uint8_t* line = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < width * 2; x++) {
+            line[x] = (uint8_t) (x * 7 + y * 3);
+        }
+    }
+
+    return frame;
+}
+
+// Counts pixels where the kernel's crop differs from the same rectangle of sws_scale's output
+static int64_t compareCrop(AVFrame* sourceFrame, AVFrame* swsFrame, UyvyCropImpl impl, int x, int y, int width, int height) {
+    AVFrame* cropFrame = av_frame_alloc();
+    cropFrame->format = AV_PIX_FMT_YUV420P;
+    cropFrame->width = width;
+    cropFrame->height = height;
+    av_frame_get_buffer(cropFrame, 0);
+
+    uyvyCropToYuv420pWith(impl, sourceFrame->data[0], sourceFrame->linesize[0], x, y, width, height,
+        cropFrame->data, cropFrame->linesize);
+
+    int64_t mismatches = 0;
+    for (int plane = 0; plane < 3; plane++) {
+        const int shift = plane == 0 ? 0 : 1;
+        for (int row = 0; row < height >> shift; row++) {
+            const uint8_t* expected = swsFrame->data[plane] + ((y >> shift) + row) * swsFrame->linesize[plane] + (x >> shift);
+            const uint8_t* actual = cropFrame->data[plane] + row * cropFrame->linesize[plane];
+            for (int col = 0; col < width >> shift; col++) {
+                mismatches += expected[col] != actual[col];
+            }
+        }
+    }
+
+    av_frame_free(&cropFrame);
+    return mismatches;
+}
+
+// Must run before anything else creates a SwsContext: with the cpu flags cleared,
+// swscale picks its C converter, which is the reference the kernels must match.
+static bool checkBitExact(int width, int height) {
+    AVFrame* sourceFrame = createSourceFrame(width, height);
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++) {
+        uint8_t* line = sourceFrame->data[0] + y * sourceFrame->linesize[0];
+        for (int x = 0; x < width * 2; x++) {
+            seed = seed * 1664525 + 1013904223;
+            line[x] = (uint8_t) (seed >> 24);
+        }
+    }
+
+    AVFrame* swsFrame = av_frame_alloc();
+    swsFrame->format = AV_PIX_FMT_YUV420P;
+    swsFrame->width = width;
+    swsFrame->height = height;
+    av_frame_get_buffer(swsFrame, 0);
+
+    av_force_cpu_flags(0);
+    SwsContext* swsCtx = sws_getContext(width, height, AV_PIX_FMT_UYVY422, width, height, AV_PIX_FMT_YUV420P,
+        SWS_BICUBIC, nullptr, nullptr, nullptr);
+    sws_scale(swsCtx, sourceFrame->data, sourceFrame->linesize, 0, height, swsFrame->data, swsFrame->linesize);
+    sws_freeContext(swsCtx);
+    av_force_cpu_flags(-1);
+
+    // The bench crop, the whole frame, and odd sizes that end in the scalar tail
+    const int rects[][4] = {
+        { cropX, cropY, cropWidth, cropHeight },
+        { 0, 0, width, height },
+        { 2, 2, 34, 6 },
+        { width - 66, height - 10, 66, 10 },
+    };
+    const UyvyCropImpl impls[] = { UYVY_CROP_C, UYVY_CROP_SSE2, UYVY_CROP_AVX2, UYVY_CROP_NEON };
+
+    bool exact = true;
+    for (UyvyCropImpl impl : impls) {
+        if (!uyvyCropImplAvailable(impl)) {
+            continue;
+        }
+
+        int64_t mismatches = 0;
+        for (const auto& rect : rects) {
+            mismatches += compareCrop(sourceFrame, swsFrame, impl, rect[0], rect[1], rect[2], rect[3]);
+        }
+
+        std::cout << "bit-exact " << uyvyCropImplName(impl) << ": "
+            << (mismatches == 0 ? "ok" : std::to_string(mismatches) + " pixels differ") << "\n";
+        exact = exact && mismatches == 0;
+    }
+
+    av_frame_free(&swsFrame);
+    av_frame_free(&sourceFrame);
+
+    return exact;
+}
+
+static double benchSws(AVFrame* sourceFrame, int frames, FramePool* framePool) {
+    AVFilterContext* bufferSrcCtx;
+    AVFilterContext* bufferSinkCtx;
+    AVFilterGraph* filterGraph = createCropGraph(sourceFrame->width, sourceFrame->height, cropX, cropY,
+        AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P, &bufferSrcCtx, &bufferSinkCtx);
+
+    SwsContext* swsCtx = sws_getContext(
+        sourceFrame->width, sourceFrame->height, AV_PIX_FMT_UYVY422,
+        sourceFrame->width, sourceFrame->height, AV_PIX_FMT_YUV420P,
+        SWS_BICUBIC, nullptr, nullptr, nullptr);
+
+    AVFrame* yuvFrame = av_frame_alloc();
+    AVFrame* filteredFrame = av_frame_alloc();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int i = -warmupFrames; i < frames; i++) {
+        if (i == 0) {
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        yuvFrame->format = AV_PIX_FMT_YUV420P;
+        yuvFrame->width = sourceFrame->width;
+        yuvFrame->height = sourceFrame->height;
+        framePoolGetVideoBuffer(framePool, yuvFrame);
+        sws_scale(swsCtx, sourceFrame->data, sourceFrame->linesize, 0, sourceFrame->height, yuvFrame->data, yuvFrame->linesize);
+        yuvFrame->pts = i + warmupFrames;
+
+        av_buffersrc_add_frame(bufferSrcCtx, yuvFrame);
+        while (av_buffersink_get_frame(bufferSinkCtx, filteredFrame) == 0) {
+            av_frame_unref(filteredFrame);
+        }
+    }
+
+    const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    av_frame_free(&filteredFrame);
+    av_frame_free(&yuvFrame);
+    sws_freeContext(swsCtx);
+    avfilter_graph_free(&filterGraph);
+
+    return elapsedMs / frames;
+}
+
+static double benchGraph(AVFrame* sourceFrame, int frames) {
+    AVFilterContext* bufferSrcCtx;
+    AVFilterContext* bufferSinkCtx;
+    AVFilterGraph* filterGraph = createCropGraph(sourceFrame->width, sourceFrame->height, cropX, cropY,
+        AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUV420P, &bufferSrcCtx, &bufferSinkCtx);
+
+    AVFrame* inputFrame = av_frame_alloc();
+    AVFrame* filteredFrame = av_frame_alloc();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int i = -warmupFrames; i < frames; i++) {
+        if (i == 0) {
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        av_frame_ref(inputFrame, sourceFrame);
+        inputFrame->pts = i + warmupFrames;
+
+        av_buffersrc_add_frame(bufferSrcCtx, inputFrame);
+        while (av_buffersink_get_frame(bufferSinkCtx, filteredFrame) == 0) {
+            av_frame_unref(filteredFrame);
+        }
+    }
+
+    const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    av_frame_free(&filteredFrame);
+    av_frame_free(&inputFrame);
+    avfilter_graph_free(&filterGraph);
+
+    return elapsedMs / frames;
+}
+
+// Same graph as the programs use in kernel mode: crop sized frames, crop at 0:0
+static double benchKernel(AVFrame* sourceFrame, int frames, FramePool* framePool, UyvyCropImpl impl) {
+    AVFilterContext* bufferSrcCtx;
+    AVFilterContext* bufferSinkCtx;
+    AVFilterGraph* filterGraph = createCropGraph(cropWidth, cropHeight, 0, 0,
+        AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P, &bufferSrcCtx, &bufferSinkCtx);
+
+    AVFrame* yuvFrame = av_frame_alloc();
+    AVFrame* filteredFrame = av_frame_alloc();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int i = -warmupFrames; i < frames; i++) {
+        if (i == 0) {
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        yuvFrame->format = AV_PIX_FMT_YUV420P;
+        yuvFrame->width = cropWidth;
+        yuvFrame->height = cropHeight;
+        framePoolGetVideoBuffer(framePool, yuvFrame);
+        uyvyCropToYuv420pWith(impl, sourceFrame->data[0], sourceFrame->linesize[0], cropX, cropY, cropWidth, cropHeight,
+            yuvFrame->data, yuvFrame->linesize);
+        yuvFrame->pts = i + warmupFrames;
+
+        av_buffersrc_add_frame(bufferSrcCtx, yuvFrame);
+        while (av_buffersink_get_frame(bufferSinkCtx, filteredFrame) == 0) {
+            av_frame_unref(filteredFrame);
+        }
+    }
+
+    const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    av_frame_free(&filteredFrame);
+    av_frame_free(&yuvFrame);
+    avfilter_graph_free(&filterGraph);
+
+    return elapsedMs / frames;
+}
+
+int main(int argc, char* argv[]) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 200;
+    const int width = argc > 3 ? atoi(argv[2]) : 3840;
+    const int height = argc > 3 ? atoi(argv[3]) : 2160;
+
+    if (!checkBitExact(width, height)) {
+        return 1;
+    }
+
+    FramePool* framePool = framePoolAlloc();
+    AVFrame* sourceFrame = createSourceFrame(width, height);
+
+    std::cout << "uyvy422 " << width << "x" << height << " -> yuv420p crop "
+        << cropWidth << "x" << cropHeight << "+" << cropX << "+" << cropY << ", " << frames << " frames\n";
+    std::cout << "sws:   " << benchSws(sourceFrame, frames, framePool) << " ms/frame\n";
+    std::cout << "graph: " << benchGraph(sourceFrame, frames) << " ms/frame\n";
+
+    const UyvyCropImpl impls[] = { UYVY_CROP_C, UYVY_CROP_SSE2, UYVY_CROP_AVX2, UYVY_CROP_NEON };
+    for (UyvyCropImpl impl : impls) {
+        if (uyvyCropImplAvailable(impl)) {
+            std::cout << "kernel " << uyvyCropImplName(impl) << ": " << benchKernel(sourceFrame, frames, framePool, impl) << " ms/frame\n";
+        }
+    }
+
+    av_frame_free(&sourceFrame);
+    framePoolFree(&framePool);
+
+    return 0;
+}
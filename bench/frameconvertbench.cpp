@@ -0,0 +1,193 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+extern "C" {
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include "frameconvert.h"
+#include "framepool.h"
+
+// Times every specialized conversion of frameconvert.h against swscale converting the
+// same pair: a 500x800 crop for the crop conversions, the whole frame for the others.
+//
+// Before timing, every specialization is checked to be bit-exact against sws_scale on
+// random content; the run fails if any pixel differs. swscale picks its converters for
+// the process with the first SwsContext, which the check creates with the cpu flags
+// cleared, so the swscale timings are of its C converters too.
+//
+// Usage: frameconvertbench [frames, default 200] [source width height, default 3840 2160]
+
+#define cropX 100
+#define cropY 0
+#define cropWidth 500
+#define cropHeight 800
+#define warmupFrames 10
+
+static std::string conversionName(const FrameConversion& conversion) {
+    return std::string(av_get_pix_fmt_name(conversion.srcFormat)) + " -> " + av_get_pix_fmt_name(conversion.dstFormat)
+        + (conversion.crop ? " crop" : "");
+}
+
+static AVFrame* createRandomFrame(AVPixelFormat format, int width, int height, uint32_t seed) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 0);
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+        const int rows = plane == 1 || plane == 2 ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+        for (int y = 0; y < rows; y++) {
+            uint8_t* line = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < frame->linesize[plane]; x++) {
+                seed = seed * 1664525 + 1013904223;
+                line[x] = (uint8_t) (seed >> 24);
+            }
+        }
+    }
+
+    return frame;
+}
+
+// Counts bytes where the converter's output differs from the same rectangle of sws_scale's output
+static int64_t compareRect(AVFrame* sourceFrame, AVFrame* swsFrame, const FrameConversion& conversion, const VideoCropRect& rect) {
+    FrameConverter* converter = frameConverterAllocWith(FRAME_CONVERT_SPECIALIZED, conversion.srcFormat, conversion.dstFormat,
+        sourceFrame->width, sourceFrame->height, conversion.crop ? &rect : nullptr);
+    if (converter == nullptr) {
+        return -1;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    frameConverterInitFrame(converter, frame);
+    av_frame_get_buffer(frame, 0);
+    frameConverterConvert(converter, sourceFrame, frame);
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(conversion.dstFormat);
+    int64_t mismatches = 0;
+    for (int plane = 0; plane < av_pix_fmt_count_planes(conversion.dstFormat); plane++) {
+        const int shift = plane == 1 || plane == 2 ? desc->log2_chroma_h : 0;
+        const int rowBytes = av_image_get_linesize(conversion.dstFormat, rect.width, plane);
+        const int offset = av_image_get_linesize(conversion.dstFormat, rect.x, plane);
+        for (int row = 0; row < rect.height >> shift; row++) {
+            const uint8_t* expected = swsFrame->data[plane] + ((rect.y >> shift) + row) * swsFrame->linesize[plane] + offset;
+            const uint8_t* actual = frame->data[plane] + row * frame->linesize[plane];
+            for (int col = 0; col < rowBytes; col++) {
+                mismatches += expected[col] != actual[col];
+            }
+        }
+    }
+
+    av_frame_free(&frame);
+    frameConverterFree(&converter);
+    return mismatches;
+}
+
+// Must run before anything else creates a SwsContext, see above
+static bool checkBitExact(int width, int height) {
+    av_force_cpu_flags(0);
+
+    bool exact = true;
+    for (int i = 0; i < frameConversionCount(); i++) {
+        const FrameConversion conversion = frameConversionAt(i);
+        AVFrame* sourceFrame = createRandomFrame(conversion.srcFormat, width, height, i + 1);
+
+        AVFrame* swsFrame = av_frame_alloc();
+        swsFrame->format = conversion.dstFormat;
+        swsFrame->width = width;
+        swsFrame->height = height;
+        av_frame_get_buffer(swsFrame, 0);
+
+        SwsContext* swsCtx = sws_getContext(width, height, conversion.srcFormat, width, height, conversion.dstFormat,
+            SWS_BICUBIC, nullptr, nullptr, nullptr);
+        sws_scale(swsCtx, sourceFrame->data, sourceFrame->linesize, 0, height, swsFrame->data, swsFrame->linesize);
+        sws_freeContext(swsCtx);
+
+        // The bench crop, and small ones at both corners; whole frame conversions just the frame
+        const VideoCropRect crops[] = {
+            { cropX, cropY, cropWidth, cropHeight },
+            { 2, 2, 34, 6 },
+            { width - 66, height - 10, 66, 10 },
+        };
+        const VideoCropRect wholeFrame = { 0, 0, width, height };
+
+        int64_t mismatches = 0;
+        for (int r = 0; r < (conversion.crop ? 3 : 1) && mismatches >= 0; r++) {
+            const int64_t differ = compareRect(sourceFrame, swsFrame, conversion, conversion.crop ? crops[r] : wholeFrame);
+            mismatches = differ < 0 ? differ : mismatches + differ;
+        }
+
+        std::cout << "bit-exact " << conversionName(conversion) << ": "
+            << (mismatches == 0 ? "ok" : mismatches < 0 ? "no converter" : std::to_string(mismatches) + " bytes differ") << "\n";
+        exact = exact && mismatches == 0;
+
+        av_frame_free(&swsFrame);
+        av_frame_free(&sourceFrame);
+    }
+
+    av_force_cpu_flags(-1);
+    return exact;
+}
+
+static double benchConverter(FrameConverter* converter, AVFrame* sourceFrame, int frames, FramePool* framePool) {
+    AVFrame* frame = av_frame_alloc();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int i = -warmupFrames; i < frames; i++) {
+        if (i == 0) {
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        frameConverterInitFrame(converter, frame);
+        framePoolGetVideoBuffer(framePool, frame);
+        frameConverterConvert(converter, sourceFrame, frame);
+        av_frame_unref(frame);
+    }
+
+    const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    av_frame_free(&frame);
+    return elapsedMs / frames;
+}
+
+int main(int argc, char* argv[]) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 200;
+    const int width = argc > 3 ? atoi(argv[2]) : 3840;
+    const int height = argc > 3 ? atoi(argv[3]) : 2160;
+
+    if (!checkBitExact(width, height)) {
+        return 1;
+    }
+
+    FramePool* framePool = framePoolAlloc();
+    const VideoCropRect crop = { cropX, cropY, cropWidth, cropHeight };
+
+    std::cout << width << "x" << height << " source, crop " << cropWidth << "x" << cropHeight << "+" << cropX << "+" << cropY
+        << ", " << frames << " frames\n";
+    for (int i = 0; i < frameConversionCount(); i++) {
+        const FrameConversion conversion = frameConversionAt(i);
+        AVFrame* sourceFrame = createRandomFrame(conversion.srcFormat, width, height, i + 1);
+
+        FrameConverter* specialized = frameConverterAllocWith(FRAME_CONVERT_SPECIALIZED, conversion.srcFormat, conversion.dstFormat,
+            width, height, conversion.crop ? &crop : nullptr);
+        FrameConverter* swscale = frameConverterAllocWith(FRAME_CONVERT_SWSCALE, conversion.srcFormat, conversion.dstFormat,
+            width, height, conversion.crop ? &crop : nullptr);
+
+        std::cout << conversionName(conversion) << ": specialized " << benchConverter(specialized, sourceFrame, frames, framePool)
+            << " ms/frame, swscale " << benchConverter(swscale, sourceFrame, frames, framePool) << " ms/frame\n";
+
+        frameConverterFree(&swscale);
+        frameConverterFree(&specialized);
+        av_frame_free(&sourceFrame);
+    }
+
+    framePoolFree(&framePool);
+
+    return 0;
+}
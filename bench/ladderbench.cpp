@@ -0,0 +1,262 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+}
+
+#include "boundedqueue.h"
+#include "compositor.h"
+#include "encodersettings.h"
+
+// Compares two ways of producing an ABR ladder from two 1080p sources composited side by side:
+//   one process - compositorCreateLadderGraph, the canvas is made once, split and scaled,
+//                 one encoder thread per rendition
+//   K processes - one process per rendition, each making its own canvas and scaling it,
+//                 as K separate recordings would
+//
+// Both run in child processes, so wall time and the CPU time of the children compare
+// directly. Every frame of every source is drawn anew, standing in for decode; in the
+// real pipeline capture, decode and convert are the part the ladder pays only once.
+// Packets are discarded, nothing is written.
+//
+// Usage: ladderbench [frames, default 300] [heights, default 1080,720,480] [encoder, default libx264]
+
+#define sourceWidth 1920
+#define sourceHeight 1080
+#define benchFrameRate 30
+#define benchQueueDepth 8
+
+// A frame of the source moving by a few pixels per frame, so the encoders have motion to code
+static AVFrame* drawSourceFrame(int index, int frameNumber) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = sourceWidth;
+    frame->height = sourceHeight;
+    av_frame_get_buffer(frame, 0);
+
+    const int offset = frameNumber * 4 + index * 64;
+    for (int plane = 0; plane < 3; plane++) {
+        const int shift = plane == 0 ? 0 : 1;
+        for (int y = 0; y < sourceHeight >> shift; y++) {
+            uint8_t* line = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < sourceWidth >> shift; x++) {
+                line[x] = (uint8_t) ((x + offset) * 7 + y * 3 + plane * 64);
+            }
+        }
+    }
+
+    frame->pts = frameNumber;
+    return frame;
+}
+
+static AVCodecContext* openEncoder(const char* encoderName, int width, int height, double pixelShare) {
+    const AVCodec* codec = avcodec_find_encoder_by_name(encoderName);
+    if (codec == nullptr) {
+        return nullptr;
+    }
+
+    AVCodecContext* codecCtx = avcodec_alloc_context3(codec);
+    codecCtx->width = width;
+    codecCtx->height = height;
+    codecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+    codecCtx->time_base = { 1, benchFrameRate };
+    codecCtx->framerate = { benchFrameRate, 1 };
+
+    // Same thread split as addRendition(): cores in proportion to the pixels
+    EncoderSettings settings;
+    encoderSettingsInit(&settings);
+    settings.preset = "veryfast";
+    settings.gopSize = benchFrameRate * 2;
+    settings.fixedGop = true;
+    settings.threadCount = std::max(1, (int) lround(encoderDefaultThreadCount(settings.threadType) * pixelShare));
+    encoderSettingsApply(&settings, codecCtx);
+
+    if (avcodec_open2(codecCtx, codec, nullptr) < 0) {
+        avcodec_free_context(&codecCtx);
+        return nullptr;
+    }
+    return codecCtx;
+}
+
+static void encodeLoop(AVCodecContext* codecCtx, BoundedQueue<AVFrame*>* queue) {
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame;
+
+    while (queue->pop(frame)) {
+        avcodec_send_frame(codecCtx, frame);
+        av_frame_free(&frame);
+        while (avcodec_receive_packet(codecCtx, packet) == 0) {
+            av_packet_unref(packet);
+        }
+    }
+
+    avcodec_send_frame(codecCtx, nullptr);
+    while (avcodec_receive_packet(codecCtx, packet) == 0) {
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+}
+
+// Composites the sources and encodes every output, one encoder thread per output. Encoder
+// threads are scaled by each output's pixels against mainPixels, 0 gives every encoder
+// the default. Returns the exit status.
+static int runLadder(const std::vector<CompositorOutput>& outputs, int frames, const char* encoderName, int mainPixels) {
+    CompositorTile tiles[2];
+    for (int i = 0; i < 2; i++) {
+        tiles[i] = {};
+        tiles[i].width = sourceWidth;
+        tiles[i].height = sourceHeight;
+        tiles[i].pixelFormat = AV_PIX_FMT_YUV420P;
+        tiles[i].timeBase = { 1, benchFrameRate };
+        tiles[i].sampleAspectRatio = { 1, 1 };
+        tiles[i].crop = { sourceWidth / 4, 0, sourceWidth / 2, sourceHeight };
+        tiles[i].x = i * sourceWidth / 2;
+        tiles[i].y = 0;
+    }
+
+    const int count = (int) outputs.size();
+    AVFilterContext* bufferSrcCtxs[2];
+    std::vector<AVFilterContext*> bufferSinkCtxs(count);
+    AVFilterGraph* filterGraph = compositorCreateLadderGraph(tiles, 2, sourceWidth, sourceHeight, AV_PIX_FMT_YUV420P,
+        outputs.data(), count, bufferSrcCtxs, bufferSinkCtxs.data());
+    if (filterGraph == nullptr) {
+        return 1;
+    }
+
+    std::vector<AVCodecContext*> codecCtxs;
+    std::vector<BoundedQueue<AVFrame*>*> queues;
+    std::vector<std::thread> encodeThreads;
+    for (const CompositorOutput& output : outputs) {
+        const double pixelShare = mainPixels > 0 ? (double) output.width * output.height / mainPixels : 1.0;
+        AVCodecContext* codecCtx = openEncoder(encoderName, output.width, output.height, pixelShare);
+        if (codecCtx == nullptr) {
+            return 1;
+        }
+        codecCtxs.push_back(codecCtx);
+        queues.push_back(new BoundedQueue<AVFrame*>(benchQueueDepth));
+        encodeThreads.emplace_back(encodeLoop, codecCtx, queues.back());
+    }
+
+    for (int n = 0; n <= frames; n++) {
+        for (int i = 0; i < 2; i++) {
+            if (n == frames) {
+                av_buffersrc_add_frame(bufferSrcCtxs[i], nullptr);
+                continue;
+            }
+            AVFrame* sourceFrame = drawSourceFrame(i, n);
+            av_buffersrc_add_frame(bufferSrcCtxs[i], sourceFrame);
+            av_frame_free(&sourceFrame);
+        }
+
+        for (int i = 0; i < count; i++) {
+            AVFrame* frame = av_frame_alloc();
+            while (av_buffersink_get_frame(bufferSinkCtxs[i], frame) >= 0) {
+                queues[i]->push(frame);
+                frame = av_frame_alloc();
+            }
+            av_frame_free(&frame);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        queues[i]->close();
+        encodeThreads[i].join();
+        avcodec_free_context(&codecCtxs[i]);
+        delete queues[i];
+    }
+    avfilter_graph_free(&filterGraph);
+
+    return 0;
+}
+
+static double cpuSeconds(const struct rusage* usage) {
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+// Runs every group of outputs in a child process of its own, all at once
+static bool runChildren(const std::vector<std::vector<CompositorOutput>>& groups, int frames, const char* encoderName,
+                        int mainPixels, const char* name) {
+    struct rusage before;
+    getrusage(RUSAGE_CHILDREN, &before);
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<pid_t> children;
+    for (const std::vector<CompositorOutput>& group : groups) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            _exit(runLadder(group, frames, encoderName, mainPixels));
+        }
+        if (pid < 0) {
+            perror("fork");
+            return false;
+        }
+        children.push_back(pid);
+    }
+
+    bool succeeded = true;
+    for (pid_t pid : children) {
+        int status;
+        waitpid(pid, &status, 0);
+        succeeded = succeeded && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    struct rusage after;
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    if (!succeeded) {
+        std::cout << "  " << name << ": failed\n";
+        return false;
+    }
+    std::cout << "  " << name << ": " << wallSeconds << " s wall, " << cpuSeconds(&after) - cpuSeconds(&before) << " s cpu, "
+        << frames / wallSeconds << " fps\n";
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 300;
+    const char* ladder = argc > 2 ? argv[2] : "1080,720,480";
+    const char* encoderName = argc > 3 ? argv[3] : "libx264";
+
+    int heights[maxRenditions];
+    const int count = parseLadderHeights(ladder, heights);
+    if (count < 0) {
+        std::cout << "Bad ladder " << ladder << "\n";
+        return 1;
+    }
+
+    std::vector<CompositorOutput> outputs;
+    std::vector<std::vector<CompositorOutput>> separate;
+    for (int i = 0; i < count; i++) {
+        const CompositorOutput output = { compositorLadderWidth(sourceWidth, sourceHeight, heights[i]), heights[i] };
+        outputs.push_back(output);
+        separate.push_back({ output });
+    }
+
+    std::cout << "2 x " << sourceWidth << "x" << sourceHeight << " -> " << sourceWidth << "x" << sourceHeight
+        << ", " << frames << " frames, " << encoderName << ", renditions";
+    for (const CompositorOutput& output : outputs) {
+        std::cout << " " << output.width << "x" << output.height;
+    }
+    std::cout << "\n";
+
+    // Threads split like addRendition() against the first rendition; separate processes
+    // each take the cores a recording alone would
+    runChildren({ outputs }, frames, encoderName, outputs[0].width * outputs[0].height, "one process");
+    runChildren(separate, frames, encoderName, 0, (std::to_string(count) + " processes").c_str());
+
+    return 0;
+}
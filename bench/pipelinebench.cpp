@@ -0,0 +1,354 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <climits>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// Runs hello, crop, merge and mergeaudio end to end on synthetic sources at 720p, 1080p
+// and 4K and writes what each run achieved as JSON:
+//   fps                  output frames per second of wall time
+//   stages               ms/frame of every "stage <name>: ..." line the program logged
+//                        (see stageStatsLog())
+//   cpu_percent          user + system time of the program over its wall time
+//   peak_rss_kb          maximum resident set
+//   allocations          heap allocations of the whole run, counted by bench/alloccount.so
+//                        when it is built and the platform has LD_PRELOAD, and per output frame
+//
+// Sources are lavfi testsrc2 (plus sine for mergeaudio's audio) in uyvy422, the capture
+// format, read as fast as the program takes them. --source file first encodes the same
+// sources to bench/out/source_<size>p<fps>.mp4 with the engine, so the programs pay an
+// H.264 decode like they would for a recording. merge ticks its output on the wall clock
+// and drops what its readers can't hand over in time, so its lavfi sources are paced to
+// real time and it is skipped for files; its fps is capped at the source rate, the stage
+// times and CPU are what to compare.
+//
+// Each run works in bench/out/<program>_<size>, its log is log.txt there. Run from the
+// repository root after building the programs, or through "make bench".
+//
+// Usage: pipelinebench [--seconds N, default 10] [--sizes 720p,1080p,4k] [--programs hello,crop,merge,mergeaudio]
+//                      [--source lavfi|file] [--json <path>, default bench/out/pipelinebench.json]
+
+#define benchOutDir "bench/out"
+#define allocCountLibrary "bench/alloccount.so"
+
+typedef struct BenchSize {
+    const char* name;
+    int width;
+    int height;
+} BenchSize;
+
+typedef struct BenchProgram {
+    const char* name;
+    int inputs;
+    bool audio;             // takes its audio from the sources
+    int frameRate;          // the rate it captures at
+    int minHeight;          // its crop has to fit the source
+    bool paced;             // ticks on the wall clock
+} BenchProgram;
+
+static const BenchSize sizes[] = {
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 },
+};
+
+static const BenchProgram programs[] = {
+    { "hello", 1, false, 60, 0, false },
+    { "crop", 1, false, 60, 500, false },
+    { "merge", 2, false, 30, 800, true },
+    { "mergeaudio", 2, true, 30, 800, false },
+};
+
+typedef struct BenchRun {
+    const BenchProgram* program;
+    const BenchSize* size;
+    bool succeeded;
+    double wallSeconds;
+    double cpuSeconds;
+    long peakRssKb;
+    int64_t frames;
+    int64_t allocations;    // -1 when not counted
+    std::vector<std::pair<std::string, double>> stages;
+} BenchRun;
+
+static bool listed(const std::string& list, const char* name) {
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string absolutePath(const std::string& path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) != nullptr ? resolved : path;
+}
+
+static bool fileExists(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+// "testsrc2=size=1920x1080:rate=60:duration=10,format=uyvy422", the second input of a
+// program gets a different pattern and tone
+static std::string lavfiSource(const BenchSize* size, int frameRate, int seconds, int index, bool audio, bool realtime) {
+    std::string source = std::string(index == 0 ? "testsrc2" : "testsrc") + "=size=" + std::to_string(size->width) + "x"
+        + std::to_string(size->height) + ":rate=" + std::to_string(frameRate) + ":duration=" + std::to_string(seconds)
+        + ",format=uyvy422" + (realtime ? ",realtime" : "");
+    if (audio) {
+        source = source + "[out0];sine=frequency=" + (index == 0 ? "440" : "880") + ":duration=" + std::to_string(seconds) + "[out1]";
+    }
+    return source;
+}
+
+// Runs program with args in directory, its output in log.txt there. Fills in the wall and
+// CPU time and the peak RSS, returns whether it exited with 0.
+static bool runChild(const std::string& program, const std::vector<std::string>& args, const std::string& directory,
+                     BenchRun* run) {
+    std::vector<const char*> argv = { program.c_str() };
+    for (const std::string& arg : args) {
+        argv.push_back(arg.c_str());
+    }
+    argv.push_back(nullptr);
+
+    const std::string allocCount = absolutePath(allocCountLibrary);
+    const auto startTime = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        const int logFd = open((directory + "/log.txt").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const int nullFd = open("/dev/null", O_RDONLY);
+        if (logFd < 0 || nullFd < 0 || chdir(directory.c_str()) != 0) {
+            _exit(127);
+        }
+        dup2(nullFd, STDIN_FILENO);
+        dup2(logFd, STDOUT_FILENO);
+        dup2(logFd, STDERR_FILENO);
+#ifdef __linux__
+        if (fileExists(allocCount)) {
+            setenv("LD_PRELOAD", allocCount.c_str(), 1);
+        }
+#endif
+        execv(program.c_str(), const_cast<char* const*>(argv.data()));
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    run->wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    run->cpuSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    run->peakRssKb = usage.ru_maxrss / 1024;
+#else
+    run->peakRssKb = usage.ru_maxrss;
+#endif
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Video frames of a finished output, 0 if it can't be read back
+static int64_t probeFrames(const std::string& path) {
+    AVFormatContext* formatCtx = nullptr;
+    if (avformat_open_input(&formatCtx, path.c_str(), nullptr, nullptr) < 0) {
+        return 0;
+    }
+
+    int64_t frames = 0;
+    const int videoIndex = av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoIndex >= 0) {
+        frames = formatCtx->streams[videoIndex]->nb_frames;
+    }
+    avformat_close_input(&formatCtx);
+    return frames;
+}
+
+// "stage <name>: <frames> frames, <ms> ms/frame" and "allocations: <n>" lines of the log
+static void parseLog(const std::string& path, BenchRun* run) {
+    std::ifstream log(path);
+    std::string line;
+    while (std::getline(log, line)) {
+        long long allocations;
+        if (sscanf(line.c_str(), "allocations: %lld", &allocations) == 1) {
+            run->allocations = allocations;
+            continue;
+        }
+
+        const size_t colon = line.find(": ");
+        if (line.compare(0, 6, "stage ") != 0 || colon == std::string::npos) {
+            continue;
+        }
+        long long frames;
+        double msPerFrame;
+        if (sscanf(line.c_str() + colon + 2, "%lld frames, %lf ms/frame", &frames, &msPerFrame) == 2) {
+            run->stages.push_back({ line.substr(6, colon - 6), msPerFrame });
+        }
+    }
+}
+
+// Encodes the lavfi source of a program at one size to an MP4 once, with the engine
+static std::string generateSource(const BenchSize* size, int frameRate, int seconds) {
+    const std::string path = absolutePath(benchOutDir) + "/source_" + std::to_string(size->height) + "p" + std::to_string(frameRate) + ".mp4";
+    if (fileExists(path)) {
+        return path;
+    }
+
+    std::cout << "generating " << path << "\n";
+    const std::string source = "testsrc2=size=" + std::to_string(size->width) + "x" + std::to_string(size->height)
+        + ":rate=" + std::to_string(frameRate) + ":duration=" + std::to_string(seconds) + "[out0];sine=duration=" + std::to_string(seconds) + "[out1]";
+    const std::vector<std::string> args = { "-o", path, "-i", source, "-f", "lavfi", "--input-fps", std::to_string(frameRate),
+        "--fps", std::to_string(frameRate), "--preset", "veryfast" };
+
+    BenchRun run = {};
+    if (!runChild(absolutePath("engine"), args, absolutePath(benchOutDir), &run)) {
+        std::cout << "Failed to generate " << path << ", see " << benchOutDir << "/log.txt\n";
+        unlink(path.c_str());
+        return "";
+    }
+    return path;
+}
+
+static void writeJson(std::ostream& out, const std::vector<BenchRun>& runs, const std::string& source, int seconds) {
+    out << "{\n  \"source\": \"" << source << "\",\n  \"seconds\": " << seconds << ",\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); i++) {
+        const BenchRun& run = runs[i];
+        out << (i > 0 ? "," : "") << "\n    {\"program\": \"" << run.program->name << "\", \"size\": \"" << run.size->name
+            << "\", \"width\": " << run.size->width << ", \"height\": " << run.size->height
+            << ", \"ok\": " << (run.succeeded ? "true" : "false")
+            << ", \"frames\": " << run.frames
+            << ", \"wall_s\": " << run.wallSeconds
+            << ", \"fps\": " << (run.wallSeconds > 0 ? run.frames / run.wallSeconds : 0)
+            << ", \"cpu_percent\": " << (run.wallSeconds > 0 ? 100 * run.cpuSeconds / run.wallSeconds : 0)
+            << ", \"peak_rss_kb\": " << run.peakRssKb;
+        if (run.allocations >= 0) {
+            out << ", \"allocations\": " << run.allocations
+                << ", \"allocations_per_frame\": " << (run.frames > 0 ? (double) run.allocations / run.frames : 0);
+        } else {
+            out << ", \"allocations\": null, \"allocations_per_frame\": null";
+        }
+        out << ", \"stages\": {";
+        for (size_t j = 0; j < run.stages.size(); j++) {
+            out << (j > 0 ? ", " : "") << "\"" << run.stages[j].first << "\": " << run.stages[j].second;
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = 10;
+    std::string sizeList = "720p,1080p,4k";
+    std::string programList = "hello,crop,merge,mergeaudio";
+    std::string source = "lavfi";
+    std::string jsonPath = std::string(benchOutDir) + "/pipelinebench.json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seconds") == 0) {
+            seconds = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--sizes") == 0) {
+            sizeList = argv[i + 1];
+        } else if (strcmp(argv[i], "--programs") == 0) {
+            programList = argv[i + 1];
+        } else if (strcmp(argv[i], "--source") == 0) {
+            source = argv[i + 1];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            jsonPath = argv[i + 1];
+        }
+    }
+    const bool fileSource = source == "file";
+
+    mkdir(benchOutDir, 0755);
+    std::vector<BenchRun> runs;
+    for (const BenchProgram& program : programs) {
+        if (!listed(programList, program.name)) {
+            continue;
+        }
+        const std::string programPath = absolutePath(program.name);
+        if (!fileExists(programPath)) {
+            std::cout << "Skipping " << program.name << ", not built\n";
+            continue;
+        }
+        if (fileSource && program.paced) {
+            std::cout << "Skipping " << program.name << ", it can't pace file inputs\n";
+            continue;
+        }
+
+        for (const BenchSize& size : sizes) {
+            if (!listed(sizeList, size.name)) {
+                continue;
+            }
+            if (size.height < program.minHeight) {
+                std::cout << "Skipping " << program.name << " at " << size.name << ", its crop needs " << program.minHeight << " lines\n";
+                continue;
+            }
+
+            // hello, crop and merge take "-i", mergeaudio its inputs as they are
+            std::vector<std::string> args;
+            if (!fileSource) {
+                args.insert(args.end(), { "-f", "lavfi" });
+            }
+            for (int i = 0; i < program.inputs; i++) {
+                const std::string input = fileSource ? generateSource(&size, program.frameRate, seconds)
+                    : lavfiSource(&size, program.frameRate, seconds, i, program.audio, program.paced);
+                if (input.empty()) {
+                    return 1;
+                }
+                if (strcmp(program.name, "mergeaudio") != 0) {
+                    args.push_back("-i");
+                }
+                args.push_back(input);
+            }
+
+            const std::string directory = std::string(benchOutDir) + "/" + program.name + "_" + size.name;
+            mkdir(directory.c_str(), 0755);
+
+            BenchRun run = {};
+            run.program = &program;
+            run.size = &size;
+            run.allocations = -1;
+            run.succeeded = runChild(programPath, args, directory, &run);
+            run.frames = run.succeeded ? probeFrames(directory + "/output.mp4") : 0;
+            parseLog(directory + "/log.txt", &run);
+            runs.push_back(run);
+
+            std::cout << program.name << " " << size.name << ": " << (run.succeeded ? "ok" : "failed") << ", "
+                << run.frames << " frames, " << (run.wallSeconds > 0 ? run.frames / run.wallSeconds : 0) << " fps, "
+                << (run.wallSeconds > 0 ? 100 * run.cpuSeconds / run.wallSeconds : 0) << "% cpu, "
+                << run.peakRssKb / 1024 << " MB peak";
+            for (const auto& stage : run.stages) {
+                std::cout << ", " << stage.first << " " << stage.second << " ms";
+            }
+            std::cout << "\n";
+        }
+    }
+
+    std::ofstream json(jsonPath);
+    writeJson(json, runs, source, seconds);
+    std::cout << "results: " << jsonPath << "\n";
+
+    for (const BenchRun& run : runs) {
+        if (!run.succeeded) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+}
+
+#include "resampler.h"
+#include "framepool.h"
+
+// Pushes a synthetic capture stream (44.1kHz s16 stereo, 512 sample frames) through
+// StreamResampler into 48kHz fltp 1024 sample AAC frames as fast as possible and
+// reports throughput and memory. RSS must stay flat for the whole run.
+//
+// Usage: resamplerbench [minutes of audio, default 60]
+
+#define inputSampleRate 44100
+#define inputFrameSize 512
+#define outputSampleRate 48000
+#define outputFrameSize 1024
+
+static long currentRssKb() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) {
+        return -1;
+    }
+    return (long) (info.resident_size / 1024);
+#else
+    long pages = 0;
+    long residentPages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return -1;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &residentPages) != 2) {
+        residentPages = -1;
+    }
+    fclose(statm);
+    return residentPages < 0 ? -1 : residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    const int minutes = argc > 1 ? atoi(argv[1]) : 60;
+    const int64_t totalInputSamples = (int64_t) minutes * 60 * inputSampleRate;
+
+    AVChannelLayout stereo;
+    av_channel_layout_default(&stereo, 2);
+
+    FramePool* framePool = framePoolAlloc();
+
+    StreamResamplerParams params;
+    params.inChLayout = &stereo;
+    params.inSampleFormat = AV_SAMPLE_FMT_S16;
+    params.inSampleRate = inputSampleRate;
+    params.outChLayout = &stereo;
+    params.outSampleFormat = AV_SAMPLE_FMT_FLTP;
+    params.outSampleRate = outputSampleRate;
+    params.frameSize = outputFrameSize;
+    params.maxInputSamples = inputFrameSize;
+
+    StreamResampler* resampler = streamResamplerAlloc(&params, framePool);
+    if (resampler == nullptr) {
+        std::cout << "Failed to create resampler\n";
+        return 1;
+    }
+
+    AVFrame* inputFrame = av_frame_alloc();
+    inputFrame->format = AV_SAMPLE_FMT_S16;
+    inputFrame->sample_rate = inputSampleRate;
+    inputFrame->nb_samples = inputFrameSize;
+    av_channel_layout_copy(&inputFrame->ch_layout, &stereo);
+    av_frame_get_buffer(inputFrame, 0);
+
+    AVFrame* outputFrame = av_frame_alloc();
+
+    const long startRss = currentRssKb();
+    int64_t inputSamples = 0;
+    int64_t outputSamples = 0;
+    int64_t nextReport = (int64_t) 60 * inputSampleRate;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (inputSamples < totalInputSamples) {
+        // 440Hz tone so swr does real work instead of converting silence
+        int16_t* samples = (int16_t*) inputFrame->data[0];
+        for (int i = 0; i < inputFrameSize; i++) {
+            const int16_t value = (int16_t) (8000 * sin(2 * M_PI * 440 * (double) (inputSamples + i) / inputSampleRate));
+            samples[2 * i] = value;
+            samples[2 * i + 1] = value;
+        }
+        inputSamples += inputFrameSize;
+
+        streamResamplerSendFrame(resampler, inputFrame);
+        while (streamResamplerReceiveFrame(resampler, outputFrame) == 0) {
+            outputSamples += outputFrame->nb_samples;
+            av_frame_unref(outputFrame);
+        }
+
+        if (inputSamples >= nextReport) {
+            std::cout << "minute " << nextReport / (60 * inputSampleRate)
+                << ": rss " << currentRssKb() << " kB"
+                << ", buffered " << streamResamplerBuffered(resampler) << " samples\n";
+            nextReport += (int64_t) 60 * inputSampleRate;
+        }
+    }
+
+    streamResamplerSendFrame(resampler, nullptr);
+    while (streamResamplerReceiveFrame(resampler, outputFrame) == 0) {
+        outputSamples += outputFrame->nb_samples;
+        av_frame_unref(outputFrame);
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const long endRss = currentRssKb();
+
+    std::cout << "input samples: " << inputSamples << ", output samples: " << outputSamples
+        << " (expected " << av_rescale(inputSamples, outputSampleRate, inputSampleRate) << ")\n";
+    std::cout << "throughput: " << (int64_t) (inputSamples / seconds) << " samples/sec, "
+        << (double) inputSamples / inputSampleRate / seconds << "x realtime\n";
+    std::cout << "rss: start " << startRss << " kB, end " << endRss << " kB, peak " << peakRssKb() << " kB\n";
+    framePoolLogStats(framePool);
+
+    av_frame_free(&outputFrame);
+    av_frame_free(&inputFrame);
+    streamResamplerFree(&resampler);
+    framePoolFree(&framePool);
+    av_channel_layout_uninit(&stereo);
+
+    return 0;
+}
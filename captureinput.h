@@ -0,0 +1,45 @@
+#ifndef CAPTUREINPUT_H
+#define CAPTUREINPUT_H
+
+#include <cstring>
+
+#include "jobconfig.h"
+#include "mediacontext.h"
+
+#define maxCaptureInputs 2
+
+// "-f <format>" and "-i <url>" (once per input) on the command line: files or lavfi
+// sources standing in for the capture devices, e.g.
+//   crop -f lavfi -i "testsrc2=size=1920x1080:rate=60,format=uyvy422"
+// Without -i the devices are captured with their capture options; given inputs are
+// opened as they are.
+typedef struct CaptureInputArgs {
+    const char* format;     // nullptr probes the input
+    const char* urls[maxCaptureInputs];
+    int count;
+} CaptureInputArgs;
+
+static inline void parseCaptureInputArgs(int argc, char* argv[], CaptureInputArgs* args) {
+    args->format = nullptr;
+    args->count = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            args->format = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0 && args->count < maxCaptureInputs) {
+            args->urls[args->count++] = argv[++i];
+        }
+    }
+}
+
+// Appends input number index to the job, video only at the job's frame rate: deviceUrl
+// on the capture device, or the -i input standing in for it
+static inline JobInput* addCaptureInput(JobConfig* job, const CaptureInputArgs* args, int index, const char* deviceUrl) {
+    const bool useDevice = args->count == 0;
+    JobInput* input = jobConfigAddInput(job, useDevice ? deviceUrl : args->urls[index]);
+    input->format = useDevice ? defaultInputFormat : args->format != nullptr ? args->format : "";
+    input->frameRate = job->frameRate;
+    input->audio = false;
+    return input;
+}
+
+#endif
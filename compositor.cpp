@@ -0,0 +1,295 @@
+#include "compositor.h"
+#include "avhandles.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+static int tileWidth(const CompositorTile* tile) {
+    return tile->crop.width > 0 ? tile->crop.width : tile->width;
+}
+
+static int tileHeight(const CompositorTile* tile) {
+    return tile->crop.width > 0 ? tile->crop.height : tile->height;
+}
+
+void compositorGridLayout(CompositorTile* tiles, int count, int columns, int* canvasWidth, int* canvasHeight) {
+    if (columns <= 0) {
+        columns = (int) ceil(sqrt((double) count));
+    }
+    columns = std::max(1, std::min(columns, count));
+
+    int cellWidth = 0;
+    int cellHeight = 0;
+    for (int i = 0; i < count; i++) {
+        cellWidth = std::max(cellWidth, tileWidth(&tiles[i]));
+        cellHeight = std::max(cellHeight, tileHeight(&tiles[i]));
+    }
+
+    for (int i = 0; i < count; i++) {
+        tiles[i].x = (i % columns) * cellWidth;
+        tiles[i].y = (i / columns) * cellHeight;
+    }
+
+    *canvasWidth = columns * cellWidth;
+    *canvasHeight = ((count + columns - 1) / columns) * cellHeight;
+}
+
+// Tiles that sit next to each other at y 0, in order and all the same height, are an hstack
+static bool isSingleRow(const CompositorTile* tiles, int count) {
+    int x = 0;
+    for (int i = 0; i < count; i++) {
+        if (tiles[i].x != x || tiles[i].y != 0 || tileHeight(&tiles[i]) != tileHeight(&tiles[0])) {
+            return false;
+        }
+        x += tileWidth(&tiles[i]);
+    }
+    return true;
+}
+
+int parseLadderHeights(const char* value, int* heights) {
+    int count = 0;
+    const char* cursor = value;
+    while (*cursor != '\0') {
+        char* end;
+        const long height = strtol(cursor, &end, 10);
+        // Even heights only, 4:2:0 halves them
+        if (end == cursor || height < 2 || height % 2 != 0 || count >= maxRenditions) {
+            return -1;
+        }
+        heights[count++] = (int) height;
+
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        cursor = end;
+    }
+    return count > 0 ? count : -1;
+}
+
+int compositorLadderWidth(int canvasWidth, int canvasHeight, int height) {
+    return std::max(2, (int) lround((double) canvasWidth * height / canvasHeight / 2) * 2);
+}
+
+AVFilterGraph* compositorCreateGraph(const CompositorTile* tiles, int count, int canvasWidth, int canvasHeight,
+                                     AVPixelFormat outputPixelFormat, AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx) {
+    const CompositorOutput output = { canvasWidth, canvasHeight };
+    return compositorCreateLadderGraph(tiles, count, canvasWidth, canvasHeight, outputPixelFormat, &output, 1,
+        bufferSrcCtxs, bufferSinkCtx);
+}
+
+AVFilterGraph* compositorCreateLadderGraph(const CompositorTile* tiles, int count, int canvasWidth, int canvasHeight,
+                                           AVPixelFormat outputPixelFormat, const CompositorOutput* outputs, int outputCount,
+                                           AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtxs) {
+    if (count < 1 || outputCount < 1) {
+        return nullptr;
+    }
+
+    // Freed on every early return below, released to the caller once configured
+    FilterGraphPtr filterGraph(avfilter_graph_alloc());
+
+    const AVFilter *bufferSrcFilter = avfilter_get_by_name("buffer");
+    const AVFilter *cropFilter = avfilter_get_by_name("crop");
+    const AVFilter *formatFilter = avfilter_get_by_name("format");
+    const AVFilter *padFilter = avfilter_get_by_name("pad");
+    const AVFilter *scaleFilter = avfilter_get_by_name("scale");
+    const AVFilter *bufferSinkFilter = avfilter_get_by_name("buffersink");
+
+    char filterName[64];
+    char filterArgs[512];
+
+    std::vector<AVFilterContext*> tileCtxs;
+    int stackWidth = 0;
+    int stackHeight = 0;
+    int64_t coveredArea = 0;
+
+    for (int i = 0; i < count; i++) {
+        const CompositorTile* tile = &tiles[i];
+        AVFilterContext *lastCtx;
+        AVFilterContext *formatCtx;
+
+        snprintf(filterArgs, sizeof(filterArgs),
+            "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+            tile->width,
+            tile->height,
+            tile->pixelFormat,
+            tile->timeBase.num,
+            tile->timeBase.den,
+            tile->sampleAspectRatio.num,
+            tile->sampleAspectRatio.den);
+        snprintf(filterName, sizeof(filterName), "v-in%d", i + 1);
+        if (avfilter_graph_create_filter(&bufferSrcCtxs[i], bufferSrcFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+        lastCtx = bufferSrcCtxs[i];
+
+        // Frames that already are the crop skip the filter
+        if (tileWidth(tile) != tile->width || tileHeight(tile) != tile->height) {
+            AVFilterContext *cropCtx;
+
+            snprintf(filterArgs, sizeof(filterArgs),
+                "%d:%d:%d:%d",
+                tile->crop.width,
+                tile->crop.height,
+                tile->crop.x,
+                tile->crop.y);
+            snprintf(filterName, sizeof(filterName), "v-crop%d", i + 1);
+            if (avfilter_graph_create_filter(&cropCtx, cropFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+                return nullptr;
+            }
+
+            if (avfilter_link(lastCtx, 0, cropCtx, 0) < 0) {
+                return nullptr;
+            }
+            lastCtx = cropCtx;
+        }
+
+        // A no-op for frames already in the output format, converts only the cropped region otherwise
+        snprintf(filterArgs, sizeof(filterArgs), "pix_fmts=%s", av_get_pix_fmt_name(outputPixelFormat));
+        snprintf(filterName, sizeof(filterName), "v-format%d", i + 1);
+        if (avfilter_graph_create_filter(&formatCtx, formatFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        if (avfilter_link(lastCtx, 0, formatCtx, 0) < 0) {
+            return nullptr;
+        }
+
+        tileCtxs.push_back(formatCtx);
+        stackWidth = std::max(stackWidth, tile->x + tileWidth(tile));
+        stackHeight = std::max(stackHeight, tile->y + tileHeight(tile));
+        coveredArea += (int64_t) tileWidth(tile) * tileHeight(tile);
+    }
+
+    AVFilterContext *canvasCtx = tileCtxs[0];
+
+    if (count > 1) {
+        AVFilterContext *stackCtx;
+
+        if (isSingleRow(tiles, count)) {
+            snprintf(filterArgs, sizeof(filterArgs), "inputs=%d", count);
+            if (avfilter_graph_create_filter(&stackCtx, avfilter_get_by_name("hstack"), "v-hstack", filterArgs, nullptr, filterGraph.get()) < 0) {
+                return nullptr;
+            }
+        } else {
+            std::string layout;
+            for (int i = 0; i < count; i++) {
+                layout += (i == 0 ? "" : "|") + std::to_string(tiles[i].x) + "_" + std::to_string(tiles[i].y);
+            }
+
+            // Only pay for clearing the frame when the tiles leave gaps
+            const bool hasGaps = coveredArea < (int64_t) stackWidth * stackHeight;
+            std::string xstackArgs = "inputs=" + std::to_string(count) + ":layout=" + layout;
+            if (hasGaps) {
+                xstackArgs += ":fill=black";
+            }
+
+            if (avfilter_graph_create_filter(&stackCtx, avfilter_get_by_name("xstack"), "v-xstack", xstackArgs.c_str(), nullptr, filterGraph.get()) < 0) {
+                return nullptr;
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (avfilter_link(tileCtxs[i], 0, stackCtx, i) < 0) {
+                return nullptr;
+            }
+        }
+        canvasCtx = stackCtx;
+    }
+
+    // Tiles outside the canvas would silently grow the output
+    if (stackWidth > canvasWidth || stackHeight > canvasHeight) {
+        return nullptr;
+    }
+
+    // A canvas bigger than the stack, or a single tile away from the corner, takes one pad.
+    // The stack already holds every tile at its position, a lone tile is placed by the pad.
+    if (stackWidth != canvasWidth || stackHeight != canvasHeight || (count == 1 && (tiles[0].x != 0 || tiles[0].y != 0))) {
+        AVFilterContext *padCtx;
+        const int padX = count == 1 ? tiles[0].x : 0;
+        const int padY = count == 1 ? tiles[0].y : 0;
+
+        snprintf(filterArgs, sizeof(filterArgs),
+            "%d:%d:%d:%d", // w:h:x:y
+            canvasWidth,
+            canvasHeight,
+            padX,
+            padY);
+        if (avfilter_graph_create_filter(&padCtx, padFilter, "v-pad", filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        if (avfilter_link(canvasCtx, 0, padCtx, 0) < 0) {
+            return nullptr;
+        }
+        canvasCtx = padCtx;
+    }
+
+    // One canvas for every output: split only passes references on, the scales read the same frame
+    AVFilterContext *splitCtx = nullptr;
+    if (outputCount > 1) {
+        snprintf(filterArgs, sizeof(filterArgs), "outputs=%d", outputCount);
+        if (avfilter_graph_create_filter(&splitCtx, avfilter_get_by_name("split"), "v-split", filterArgs, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        if (avfilter_link(canvasCtx, 0, splitCtx, 0) < 0) {
+            return nullptr;
+        }
+    }
+
+    for (int i = 0; i < outputCount; i++) {
+        const CompositorOutput* output = &outputs[i];
+        AVFilterContext *lastCtx = canvasCtx;
+        int lastPad = 0;
+        if (splitCtx != nullptr) {
+            lastCtx = splitCtx;
+            lastPad = i;
+        }
+
+        // Outputs of the canvas size take the canvas as is
+        if (output->width != canvasWidth || output->height != canvasHeight) {
+            AVFilterContext *scaleCtx;
+
+            snprintf(filterArgs, sizeof(filterArgs), "%d:%d:flags=bicubic", output->width, output->height);
+            snprintf(filterName, sizeof(filterName), "v-scale%d", i);
+            if (avfilter_graph_create_filter(&scaleCtx, scaleFilter, filterName, filterArgs, nullptr, filterGraph.get()) < 0) {
+                return nullptr;
+            }
+
+            if (avfilter_link(lastCtx, lastPad, scaleCtx, 0) < 0) {
+                return nullptr;
+            }
+            lastCtx = scaleCtx;
+            lastPad = 0;
+        }
+
+        // The first sink keeps the name it always had
+        if (i == 0) {
+            snprintf(filterName, sizeof(filterName), "v-out");
+        } else {
+            snprintf(filterName, sizeof(filterName), "v-out%d", i);
+        }
+        if (avfilter_graph_create_filter(&bufferSinkCtxs[i], bufferSinkFilter, filterName, nullptr, nullptr, filterGraph.get()) < 0) {
+            return nullptr;
+        }
+
+        if (avfilter_link(lastCtx, lastPad, bufferSinkCtxs[i], 0) < 0) {
+            return nullptr;
+        }
+    }
+
+    if (avfilter_graph_config(filterGraph.get(), nullptr) < 0) {
+        return nullptr;
+    }
+
+    return filterGraph.release();
+}
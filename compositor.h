@@ -0,0 +1,57 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+}
+
+#include "videoconvert.h"
+
+// Lays N video inputs out on one canvas. Every input gets buffer -> crop -> format
+// and all of them meet in a single stack filter: hstack when the tiles form one
+// contiguous row, xstack with pixel positions otherwise. Each output frame is copied
+// together once, where a pad + overlay chain copies the whole canvas per overlay.
+// Canvas areas no tile covers are filled black; tiles must not overlap.
+
+typedef struct CompositorTile {
+    int width;                      // size, format and timing of the frames fed to this tile
+    int height;
+    AVPixelFormat pixelFormat;
+    AVRational timeBase;
+    AVRational sampleAspectRatio;
+    VideoCropRect crop;             // region of the frame shown, width 0 for all of it
+    int x;                          // top left corner on the canvas
+    int y;
+} CompositorTile;
+
+// Places the tiles left to right, top to bottom in cells the size of the largest crop.
+// columns 0 picks a near square grid. Returns the canvas size that fits them.
+void compositorGridLayout(CompositorTile* tiles, int count, int columns, int* canvasWidth, int* canvasHeight);
+
+// bufferSrcCtxs receives one buffer source per tile, in order
+AVFilterGraph* compositorCreateGraph(const CompositorTile* tiles, int count, int canvasWidth, int canvasHeight,
+                                     AVPixelFormat outputPixelFormat, AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtx);
+
+// An ABR ladder: the canvas is composited once, split and scaled to every output size
+
+#define maxRenditions 4
+
+typedef struct CompositorOutput {
+    int width;
+    int height;
+} CompositorOutput;
+
+// "720,480,360" -> heights, at most maxRenditions. Returns the count, -1 if malformed.
+int parseLadderHeights(const char* value, int* heights);
+
+// Width of a rendition height keeping the canvas aspect, even for 4:2:0
+int compositorLadderWidth(int canvasWidth, int canvasHeight, int height);
+
+// bufferSinkCtxs receives one buffer sink per output, in order
+AVFilterGraph* compositorCreateLadderGraph(const CompositorTile* tiles, int count, int canvasWidth, int canvasHeight,
+                                           AVPixelFormat outputPixelFormat, const CompositorOutput* outputs, int outputCount,
+                                           AVFilterContext** bufferSrcCtxs, AVFilterContext** bufferSinkCtxs);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Wakes a consumer that polls several lock-free sources (FrameRings) instead of
+// sleeping for a fixed time. Producers ring() after making work available; the consumer
+// drains everything it can and only wait()s after a pass that found nothing.
+//
+// A ring() between that pass and wait() is not lost: wait() returns at once when the
+// bell rang since the last wait(). ring() only takes the lock while the consumer is
+// actually asleep, so busy producers pay one atomic exchange per item.
+class Doorbell {
+public:
+    Doorbell() = default;
+
+    Doorbell(const Doorbell&) = delete;
+    Doorbell& operator=(const Doorbell&) = delete;
+
+    void ring() {
+        rung.store(true);
+        if (sleeping.load()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeup.notify_one();
+        }
+    }
+
+    // Returns false when timeout passed without a ring
+    bool wait(std::chrono::microseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.store(true);
+        const bool woken = wakeup.wait_for(lock, timeout, [this] { return rung.load(); });
+        sleeping.store(false);
+        rung.store(false);
+
+        waits++;
+        if (!woken) {
+            timeouts++;
+        }
+        return woken;
+    }
+
+    // Consumer side only
+    uint64_t waitCount() const { return waits; }
+    uint64_t timeoutCount() const { return timeouts; }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> rung{false};
+    std::atomic<bool> sleeping{false};
+    uint64_t waits = 0;
+    uint64_t timeouts = 0;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "encodersettings.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+extern "C" {
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+}
+
+#define maxFrameThreads 16
+#define maxSliceThreads 8
+
+void encoderSettingsInit(EncoderSettings* settings) {
+    settings->preset.clear();
+    settings->tune.clear();
+    settings->crf = -1;
+    settings->bitRate = 0;
+    settings->gopSize = 0;
+    settings->threadType = ENCODER_THREADS_AUTO;
+    settings->threadCount = 0;
+    settings->lowLatency = false;
+    settings->fixedGop = false;
+}
+
+bool parseEncoderThreadType(const char* value, EncoderThreadType* threadType) {
+    if (strcmp(value, "auto") == 0) {
+        *threadType = ENCODER_THREADS_AUTO;
+    } else if (strcmp(value, "frame") == 0) {
+        *threadType = ENCODER_THREADS_FRAME;
+    } else if (strcmp(value, "slice") == 0) {
+        *threadType = ENCODER_THREADS_SLICE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* encoderThreadTypeName(EncoderThreadType threadType) {
+    switch (threadType) {
+    case ENCODER_THREADS_FRAME:
+        return "frame";
+    case ENCODER_THREADS_SLICE:
+        return "slice";
+    default:
+        return "auto";
+    }
+}
+
+int encoderDefaultThreadCount(EncoderThreadType threadType) {
+    // hardware_concurrency() may return 0 when it can't tell
+    const int cores = std::max(1, (int) std::thread::hardware_concurrency());
+    return std::min(cores, threadType == ENCODER_THREADS_SLICE ? maxSliceThreads : maxFrameThreads);
+}
+
+// Private options live on priv_data, AV_OPT_SEARCH_CHILDREN finds them from the context
+static bool setPrivateOption(AVCodecContext* codecCtx, const char* name, const char* value) {
+    if (av_opt_set(codecCtx, name, value, AV_OPT_SEARCH_CHILDREN) < 0) {
+        std::cout << codecCtx->codec->name << " has no " << name << " " << value << ", ignored\n";
+        return false;
+    }
+    return true;
+}
+
+void encoderSettingsApply(const EncoderSettings* settings, AVCodecContext* codecCtx) {
+    const int capabilities = codecCtx->codec->capabilities;
+    // Encoders that thread on their own (libx264, libx265) take thread_type/thread_count as a request
+    const bool frameThreads = capabilities & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_OTHER_THREADS);
+    const bool sliceThreads = capabilities & (AV_CODEC_CAP_SLICE_THREADS | AV_CODEC_CAP_OTHER_THREADS);
+
+    // Each frame thread holds one more frame in flight
+    EncoderThreadType threadType = settings->threadType;
+    if (threadType == ENCODER_THREADS_AUTO) {
+        threadType = frameThreads && !settings->lowLatency ? ENCODER_THREADS_FRAME : ENCODER_THREADS_SLICE;
+    }
+
+    if ((threadType == ENCODER_THREADS_FRAME && frameThreads) || (threadType == ENCODER_THREADS_SLICE && sliceThreads)) {
+        codecCtx->thread_type = threadType == ENCODER_THREADS_FRAME ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+        codecCtx->thread_count = settings->threadCount > 0 ? settings->threadCount : encoderDefaultThreadCount(threadType);
+    } else if (frameThreads || sliceThreads) {
+        std::cout << codecCtx->codec->name << " has no " << encoderThreadTypeName(threadType) << " threading, using its default\n";
+    }
+
+    if (settings->gopSize > 0) {
+        codecCtx->gop_size = settings->gopSize;
+    }
+    // No shorter gops and no scene cut keyframes
+    if (settings->fixedGop && codecCtx->gop_size > 0) {
+        codecCtx->keyint_min = codecCtx->gop_size;
+        setPrivateOption(codecCtx, "sc_threshold", "0");
+    }
+
+    if (!settings->preset.empty()) {
+        setPrivateOption(codecCtx, "preset", settings->preset.c_str());
+    }
+    if (!settings->tune.empty()) {
+        setPrivateOption(codecCtx, "tune", settings->tune.c_str());
+    } else if (settings->lowLatency) {
+        setPrivateOption(codecCtx, "tune", "zerolatency");
+    }
+
+    if (settings->lowLatency) {
+        codecCtx->max_b_frames = 0;
+        codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+
+    // crf wins over bitrate, encoders without crf fall back to the bitrate
+    const bool hasCrf = settings->crf >= 0 && setPrivateOption(codecCtx, "crf", std::to_string(settings->crf).c_str());
+    if (!hasCrf && settings->bitRate > 0) {
+        codecCtx->bit_rate = settings->bitRate;
+    }
+}
+
+static std::string privateOption(const AVCodecContext* codecCtx, const char* name) {
+    uint8_t* value = nullptr;
+    if (av_opt_get((void*) codecCtx, name, AV_OPT_SEARCH_CHILDREN, &value) < 0 || value == nullptr) {
+        return "-";
+    }
+
+    std::string option = (const char*) value;
+    av_free(value);
+    return option.empty() ? "-" : option;
+}
+
+void encoderSettingsLog(const AVCodecContext* codecCtx) {
+    std::cout << "encoder: " << codecCtx->codec->name
+        << ", " << (codecCtx->thread_type & FF_THREAD_SLICE ? "slice" : "frame") << " threads " << codecCtx->thread_count
+        << ", preset " << privateOption(codecCtx, "preset")
+        << ", tune " << privateOption(codecCtx, "tune")
+        << ", crf " << privateOption(codecCtx, "crf")
+        << ", bitrate " << codecCtx->bit_rate
+        << ", gop " << codecCtx->gop_size
+        << ", b-frames " << codecCtx->max_b_frames << "\n";
+}
+
+void encoderStatsInit(EncoderStats* stats) {
+    stats->frames = 0;
+    stats->busy = std::chrono::steady_clock::duration::zero();
+}
+
+void encoderStatsAdd(EncoderStats* stats, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    if (stats->frames == 0) {
+        stats->firstFrame = start;
+    }
+    stats->lastFrame = end;
+    stats->busy += end - start;
+    stats->frames++;
+}
+
+void encoderStatsLog(const EncoderStats* stats, const char* name) {
+    if (stats->frames == 0) {
+        return;
+    }
+
+    const double busySeconds = std::chrono::duration<double>(stats->busy).count();
+    const double wallSeconds = std::chrono::duration<double>(stats->lastFrame - stats->firstFrame).count();
+
+    std::cout << name << " encode: " << stats->frames << " frames, "
+        << (wallSeconds > 0 ? stats->frames / wallSeconds : 0) << " fps achieved, "
+        << (busySeconds > 0 ? stats->frames / busySeconds : 0) << " fps encoder capacity ("
+        << (wallSeconds > 0 ? 100 * busySeconds / wallSeconds : 100) << "% busy)\n";
+}
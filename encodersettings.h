@@ -0,0 +1,67 @@
+#ifndef ENCODERSETTINGS_H
+#define ENCODERSETTINGS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Video encoder knobs that are otherwise left at the encoder's defaults. Applied to an
+// allocated, not yet opened codec context; options the encoder does not have are
+// reported and skipped, so the same settings work for libx264, libx265, hardware
+// encoders and the muxer default.
+//
+// Frame threading encodes several frames at once: best throughput, but every thread
+// adds a frame of latency. Slice threading splits each frame: no added latency, lower
+// throughput and slightly worse compression. Thread count 0 sizes from the machine.
+
+typedef enum EncoderThreadType {
+    ENCODER_THREADS_AUTO,       // frame threading where the encoder supports it, else slice
+    ENCODER_THREADS_FRAME,
+    ENCODER_THREADS_SLICE,
+} EncoderThreadType;
+
+typedef struct EncoderSettings {
+    std::string preset;         // e.g. ultrafast .. veryslow, empty for the encoder default
+    std::string tune;           // e.g. film, zerolatency, empty for none
+    int crf;                    // constant quality, -1 for bitRate / the encoder default
+    int64_t bitRate;            // 0 leaves the encoder default, ignored when crf is set
+    int gopSize;                // 0 leaves the encoder default
+    EncoderThreadType threadType;
+    int threadCount;            // 0 picks from std::thread::hardware_concurrency()
+    bool lowLatency;            // every frame out as soon as it is in, see encoderSettingsApply
+    bool fixedGop;              // keyframes every gopSize frames and nowhere else, so renditions switch at the same frames
+} EncoderSettings;
+
+void encoderSettingsInit(EncoderSettings* settings);
+
+bool parseEncoderThreadType(const char* value, EncoderThreadType* threadType);
+const char* encoderThreadTypeName(EncoderThreadType threadType);
+
+// Thread count used for threadCount 0: every core for frame threads up to 16, beyond
+// which x264/x265 gain little and only add latency; every core for slices up to 8.
+int encoderDefaultThreadCount(EncoderThreadType threadType);
+
+// Sets thread_type/thread_count, gop, bitrate and the preset/tune/crf private options.
+// lowLatency turns off everything that holds frames back: B-frames, lookahead (tune
+// zerolatency unless a tune is given) and frame threading (auto picks slices).
+void encoderSettingsApply(const EncoderSettings* settings, AVCodecContext* codecCtx);
+
+void encoderSettingsLog(const AVCodecContext* codecCtx);
+
+// Achieved encode rate. busy counts only time spent inside the encoder, so
+// frames / busy is what the encoder could sustain, frames / wall what it delivered.
+typedef struct EncoderStats {
+    int64_t frames;
+    std::chrono::steady_clock::duration busy;
+    std::chrono::steady_clock::time_point firstFrame;
+    std::chrono::steady_clock::time_point lastFrame;
+} EncoderStats;
+
+void encoderStatsInit(EncoderStats* stats);
+void encoderStatsAdd(EncoderStats* stats, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+void encoderStatsLog(const EncoderStats* stats, const char* name);
+
+#endif
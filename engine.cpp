@@ -0,0 +1,77 @@
+#include <iostream>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "batch.h"
+#include "jobconfig.h"
+#include "jobrunner.h"
+#include "pipeline.h"
+#include "splitter.h"
+
+void signalHandler(int signum) {
+    if (signum == SIGINT) {
+        std::cout << "signaled\n";
+        shouldStop = true;
+    }
+}
+
+// Usage: engine [--job <file.ini>] [-o <output>] [--size WxH] [--layout rects|grid] [--columns N]
+//               [--fps N] [--convert sws|graph|kernel] [--sync] [--low-latency]
+//               [--container file|fragmented|segmented] [--segment-seconds N] [--segment-wrap N]
+//               [--sync-write] [--direct-io] [--tee <sink>]...
+//               [--vcodec <name>] [--bitrate N | --crf N] [--gop N] [--preset <name>] [--tune <name>]
+//               [--threads N] [--thread-type auto|frame|slice]
+//               [--channels N] [--sample-rate N] [--pan <expression>]
+//               [-i <url> [-f <format>] [--input-fps N] [--crop WxH+X+Y] [--pos X,Y] [--no-audio] [--gain G] [--mute]
+//                          [--max-staleness ms]]...
+//               [--video-only | --audio-only] [--start <seconds>] [--end <seconds>] [--split N]
+//               [--metrics-port N] [--metrics-file <path>]
+//        engine --batch <directory> [--jobs N]
+//
+// Runs any layout described by a job file (see jobconfig.h) and/or flags; flags override
+// the file and -i inputs replace its inputs. jobs/mergeaudio.ini reproduces mergeaudio, e.g.
+//   engine --job jobs/mergeaudio.ini
+//   engine -o grid.mp4 -i "testsrc2=size=1280x720:rate=30[out0];sine[out1]" -f lavfi --crop 640x360 \
+//                      -i "testsrc=size=1280x720:rate=30[out0];sine=frequency=880[out1]" -f lavfi --crop 640x360 --pos 640,0
+//   engine -o wall.mp4 --layout grid -i a.mp4 -i b.mp4 -i c.mp4 -i d.mp4
+//
+// --batch runs every job file of a directory, N at a time (default one per core), see batch.h
+// --split encodes N ranges of file inputs in parallel and joins them, see splitter.h
+// --metrics-port/--metrics-file export live Prometheus metrics of the recording, see metrics.h
+// --sync composites the newest frame of every input at each output tick, waiting at most
+// --max-staleness ms (default 50) for a late input, see inputsync.h
+//
+// While running, "gain 2 0.5", "mute 1" and "unmute 1" on stdin change the audio mix.
+int main(int argc, char* argv[]) {
+    std::signal(SIGINT, signalHandler);
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            int workers = 0;
+            for (int j = 1; j + 1 < argc; j++) {
+                if (strcmp(argv[j], "--jobs") == 0) {
+                    workers = atoi(argv[j + 1]);
+                }
+            }
+            return runBatch(argv[0], argv[i + 1], workers, &shouldStop) > 0 ? 1 : 0;
+        }
+    }
+
+    JobConfig job;
+    jobConfigInit(&job);
+    if (!jobConfigParseArgs(&job, argc, argv)) {
+        return 1;
+    }
+    if (job.splitParts > 1) {
+        return runSplit(argv[0], argc, argv, &job, &shouldStop) ? 0 : 1;
+    }
+
+    const int status = runJob(&job);
+    avformat_network_deinit();
+
+    return status;
+}
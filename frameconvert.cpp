@@ -0,0 +1,295 @@
+#include "frameconvert.h"
+#include "uyvycrop.h"
+
+#include <cstring>
+#include <iostream>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+// Converts width x height pixels at x, y of the source planes into the destination
+// planes. Everything even, whole frames pass 0, 0.
+typedef void (*ConvertFunc)(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                            uint8_t* const dst[4], const int dstStride[4]);
+
+struct FrameConverter {
+    ConvertFunc convert;        // nullptr converts with swsCtx
+    SwsContext* swsCtx;
+
+    AVPixelFormat srcFormat;
+    AVPixelFormat dstFormat;
+    int srcWidth;
+    int srcHeight;
+    bool crop;
+    VideoCropRect rect;         // the part of the source converted, all of it without a crop
+
+    // swscale with a crop: where the rectangle starts in each source plane
+    int planeRows[4];
+    int planeBytes[4];
+};
+
+// Byte offsets of the components in one two pixel group of packed 4:2:2
+template <int Y0, int Y1, int U, int V>
+struct Packed422Layout {
+    static constexpr int y0 = Y0;
+    static constexpr int y1 = Y1;
+    static constexpr int u = U;
+    static constexpr int v = V;
+};
+
+typedef Packed422Layout<0, 2, 1, 3> YuyvLayout;
+
+// Luma copied, the chroma of each line pair averaged with truncation, as swscale's
+// yuyvtoyuv420 C path does
+template <typename Layout, bool Crop>
+static void packed422ToYuv420p(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                               uint8_t* const dst[4], const int dstStride[4]) {
+    // Whole frames start at the origin, the offsets below fold away
+    if (!Crop) {
+        x = 0;
+        y = 0;
+    }
+    const uint8_t* line = src[0] + (ptrdiff_t) y * srcStride[0] + 2 * x;
+
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t* line0 = line + (ptrdiff_t) row * srcStride[0];
+        const uint8_t* line1 = line0 + srcStride[0];
+        uint8_t* y0 = dst[0] + (ptrdiff_t) row * dstStride[0];
+        uint8_t* y1 = y0 + dstStride[0];
+        uint8_t* u = dst[1] + (ptrdiff_t) (row / 2) * dstStride[1];
+        uint8_t* v = dst[2] + (ptrdiff_t) (row / 2) * dstStride[2];
+
+        for (int i = 0; i < width; i += 2) {
+            const uint8_t* a = line0 + 2 * i;
+            const uint8_t* b = line1 + 2 * i;
+            y0[i] = a[Layout::y0];
+            y0[i + 1] = a[Layout::y1];
+            y1[i] = b[Layout::y0];
+            y1[i + 1] = b[Layout::y1];
+            u[i / 2] = (a[Layout::u] + b[Layout::u]) >> 1;
+            v[i / 2] = (a[Layout::v] + b[Layout::v]) >> 1;
+        }
+    }
+}
+
+// Luma copied, the interleaved chroma split into its planes
+template <bool Crop>
+static void nv12ToYuv420p(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                          uint8_t* const dst[4], const int dstStride[4]) {
+    if (!Crop) {
+        x = 0;
+        y = 0;
+    }
+
+    // A whole frame with matching strides is one copy
+    if (!Crop && srcStride[0] == dstStride[0]) {
+        memcpy(dst[0], src[0], (size_t) srcStride[0] * (height - 1) + width);
+    } else {
+        for (int row = 0; row < height; row++) {
+            memcpy(dst[0] + (ptrdiff_t) row * dstStride[0], src[0] + (ptrdiff_t) (y + row) * srcStride[0] + x, width);
+        }
+    }
+
+    for (int row = 0; row < height / 2; row++) {
+        const uint8_t* uv = src[1] + (ptrdiff_t) (y / 2 + row) * srcStride[1] + x;
+        uint8_t* u = dst[1] + (ptrdiff_t) row * dstStride[1];
+        uint8_t* v = dst[2] + (ptrdiff_t) row * dstStride[2];
+        for (int i = 0; i < width / 2; i++) {
+            u[i] = uv[2 * i];
+            v[i] = uv[2 * i + 1];
+        }
+    }
+}
+
+// The specialized conversions, one per supported (source, destination) pair. A pair
+// without a specialization doesn't compile into the registry below.
+template <AVPixelFormat Src, AVPixelFormat Dst, bool Crop>
+struct Conversion;
+
+template <bool Crop>
+struct Conversion<AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUV420P, Crop> {
+    // The uyvycrop kernels, the fastest this CPU has
+    static void convert(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                        uint8_t* const dst[4], const int dstStride[4]) {
+        uyvyCropToYuv420p(src[0], srcStride[0], Crop ? x : 0, Crop ? y : 0, width, height, dst, dstStride);
+    }
+};
+
+template <bool Crop>
+struct Conversion<AV_PIX_FMT_YUYV422, AV_PIX_FMT_YUV420P, Crop> {
+    static void convert(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                        uint8_t* const dst[4], const int dstStride[4]) {
+        packed422ToYuv420p<YuyvLayout, Crop>(src, srcStride, x, y, width, height, dst, dstStride);
+    }
+};
+
+template <bool Crop>
+struct Conversion<AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, Crop> {
+    static void convert(const uint8_t* const src[4], const int srcStride[4], int x, int y, int width, int height,
+                        uint8_t* const dst[4], const int dstStride[4]) {
+        nv12ToYuv420p<Crop>(src, srcStride, x, y, width, height, dst, dstStride);
+    }
+};
+
+typedef struct ConversionEntry {
+    FrameConversion conversion;
+    ConvertFunc convert;
+} ConversionEntry;
+
+template <AVPixelFormat Src, AVPixelFormat Dst, bool Crop>
+static constexpr ConversionEntry conversionEntry() {
+    return { { Src, Dst, Crop }, Conversion<Src, Dst, Crop>::convert };
+}
+
+static const ConversionEntry conversions[] = {
+    conversionEntry<AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUV420P, true>(),
+    conversionEntry<AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUV420P, false>(),
+    conversionEntry<AV_PIX_FMT_YUYV422, AV_PIX_FMT_YUV420P, true>(),
+    conversionEntry<AV_PIX_FMT_YUYV422, AV_PIX_FMT_YUV420P, false>(),
+    conversionEntry<AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, true>(),
+    conversionEntry<AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, false>(),
+};
+
+#define conversionCount ((int) (sizeof(conversions) / sizeof(conversions[0])))
+
+static const ConversionEntry* findConversion(AVPixelFormat srcFormat, AVPixelFormat dstFormat, bool crop) {
+    for (const ConversionEntry& entry : conversions) {
+        if (entry.conversion.srcFormat == srcFormat && entry.conversion.dstFormat == dstFormat && entry.conversion.crop == crop) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+// Offsets of the rectangle in every plane, from the first component stored in it
+static bool setCropPlaneOffsets(FrameConverter* converter) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(converter->srcFormat);
+    if (desc == nullptr || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)) {
+        return false;
+    }
+
+    // Backwards so the first component of a plane is the one that sticks: in packed
+    // uyvy422 that is luma with its two byte step, not chroma with four
+    for (int i = desc->nb_components - 1; i >= 0; i--) {
+        const AVComponentDescriptor& comp = desc->comp[i];
+        const bool chroma = comp.plane == 1 || comp.plane == 2;
+        converter->planeRows[comp.plane] = converter->rect.y >> (chroma ? desc->log2_chroma_h : 0);
+        converter->planeBytes[comp.plane] = (converter->rect.x >> (chroma ? desc->log2_chroma_w : 0)) * comp.step;
+    }
+    return true;
+}
+
+FrameConverter* frameConverterAllocWith(FrameConvertImpl impl, AVPixelFormat srcFormat, AVPixelFormat dstFormat,
+                                        int srcWidth, int srcHeight, const VideoCropRect* crop) {
+    const VideoCropRect rect = crop != nullptr ? *crop : VideoCropRect{ 0, 0, srcWidth, srcHeight };
+    if (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+        rect.x + rect.width > srcWidth || rect.y + rect.height > srcHeight ||
+        (crop != nullptr && (rect.x | rect.y | rect.width | rect.height) & 1)) {
+        return nullptr;
+    }
+
+    // The specialized loops work on pixel and line pairs, odd frames go through swscale
+    const ConversionEntry* entry = nullptr;
+    if (impl != FRAME_CONVERT_SWSCALE && ((rect.width | rect.height) & 1) == 0) {
+        entry = findConversion(srcFormat, dstFormat, crop != nullptr);
+    }
+    if (impl == FRAME_CONVERT_SPECIALIZED && entry == nullptr) {
+        return nullptr;
+    }
+
+    FrameConverter* converter = new FrameConverter();
+    converter->srcFormat = srcFormat;
+    converter->dstFormat = dstFormat;
+    converter->srcWidth = srcWidth;
+    converter->srcHeight = srcHeight;
+    converter->crop = crop != nullptr;
+    converter->rect = rect;
+
+    if (entry != nullptr) {
+        converter->convert = entry->convert;
+        return converter;
+    }
+
+    if (converter->crop && !setCropPlaneOffsets(converter)) {
+        delete converter;
+        return nullptr;
+    }
+
+    converter->swsCtx = sws_getContext(rect.width, rect.height, srcFormat, rect.width, rect.height, dstFormat,
+        SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if (converter->swsCtx == nullptr) {
+        delete converter;
+        return nullptr;
+    }
+
+    return converter;
+}
+
+FrameConverter* frameConverterAlloc(AVPixelFormat srcFormat, AVPixelFormat dstFormat, int srcWidth, int srcHeight,
+                                    const VideoCropRect* crop) {
+    return frameConverterAllocWith(FRAME_CONVERT_AUTO, srcFormat, dstFormat, srcWidth, srcHeight, crop);
+}
+
+void frameConverterFree(FrameConverter** converter) {
+    if (*converter == nullptr) {
+        return;
+    }
+
+    sws_freeContext((*converter)->swsCtx);
+    delete *converter;
+    *converter = nullptr;
+}
+
+void frameConverterInitFrame(const FrameConverter* converter, AVFrame* dst) {
+    dst->format = converter->dstFormat;
+    dst->width = converter->rect.width;
+    dst->height = converter->rect.height;
+}
+
+int frameConverterConvert(const FrameConverter* converter, const AVFrame* src, AVFrame* dst) {
+    if (src->format != converter->srcFormat || src->width != converter->srcWidth || src->height != converter->srcHeight) {
+        return AVERROR(EINVAL);
+    }
+
+    const VideoCropRect& rect = converter->rect;
+    if (converter->convert != nullptr) {
+        converter->convert(src->data, src->linesize, rect.x, rect.y, rect.width, rect.height, dst->data, dst->linesize);
+        return 0;
+    }
+
+    const uint8_t* srcData[4] = {};
+    for (int i = 0; i < 4 && src->data[i] != nullptr; i++) {
+        srcData[i] = src->data[i] + (ptrdiff_t) converter->planeRows[i] * src->linesize[i] + converter->planeBytes[i];
+    }
+    const int ret = sws_scale(converter->swsCtx, srcData, src->linesize, 0, rect.height, dst->data, dst->linesize);
+    return ret < 0 ? ret : 0;
+}
+
+bool frameConverterSpecialized(const FrameConverter* converter) {
+    return converter->convert != nullptr;
+}
+
+void frameConverterLog(const FrameConverter* converter, const char* name) {
+    const VideoCropRect& rect = converter->rect;
+    std::cout << name << " convert: " << av_get_pix_fmt_name(converter->srcFormat)
+        << " " << converter->srcWidth << "x" << converter->srcHeight;
+    if (converter->crop) {
+        std::cout << " crop " << rect.width << "x" << rect.height << "+" << rect.x << "+" << rect.y;
+    }
+    std::cout << " -> " << av_get_pix_fmt_name(converter->dstFormat)
+        << (converter->convert != nullptr ? ", specialized" : ", swscale") << "\n";
+}
+
+bool frameConversionSpecialized(AVPixelFormat srcFormat, AVPixelFormat dstFormat, bool crop) {
+    return findConversion(srcFormat, dstFormat, crop) != nullptr;
+}
+
+int frameConversionCount() {
+    return conversionCount;
+}
+
+FrameConversion frameConversionAt(int index) {
+    return conversions[index].conversion;
+}
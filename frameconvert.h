@@ -0,0 +1,64 @@
+#ifndef FRAMECONVERT_H
+#define FRAMECONVERT_H
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include "videoconvert.h"
+
+// Converts decoded video frames of one fixed (source format, destination format, crop or
+// whole frame) into the destination format. The conversion is looked up once when the
+// converter is allocated: pairs with a specialized converter get an inner loop compiled
+// for exactly that pair, every other pair goes through swscale. Specialized converters
+// match swscale's unscaled C converters bit for bit, so a pair moving between the two
+// never changes the output.
+//
+// Specialized, to yuv420p: uyvy422 (the uyvycrop kernels), yuyv422 and nv12.
+typedef struct FrameConverter FrameConverter;
+
+typedef enum FrameConvertImpl {
+    FRAME_CONVERT_AUTO,         // specialized when the pair has one, swscale otherwise
+    FRAME_CONVERT_SPECIALIZED,
+    FRAME_CONVERT_SWSCALE,
+} FrameConvertImpl;
+
+// One specialized conversion
+typedef struct FrameConversion {
+    AVPixelFormat srcFormat;
+    AVPixelFormat dstFormat;
+    bool crop;
+} FrameConversion;
+
+// Source frames are srcWidth x srcHeight srcFormat. With crop set only that rectangle is
+// converted, it must lie in the frame and be even. nullptr for an invalid crop or a size
+// swscale doesn't take.
+FrameConverter* frameConverterAlloc(AVPixelFormat srcFormat, AVPixelFormat dstFormat, int srcWidth, int srcHeight,
+                                    const VideoCropRect* crop);
+
+// Same with an explicit implementation, for benchmarking. nullptr for
+// FRAME_CONVERT_SPECIALIZED when the pair has no specialized converter.
+FrameConverter* frameConverterAllocWith(FrameConvertImpl impl, AVPixelFormat srcFormat, AVPixelFormat dstFormat,
+                                        int srcWidth, int srcHeight, const VideoCropRect* crop);
+
+void frameConverterFree(FrameConverter** converter);
+
+// Sets format, width and height of dst to the converter's output, for getting its buffers
+void frameConverterInitFrame(const FrameConverter* converter, AVFrame* dst);
+
+// dst must have buffers for the converter's output. AVERROR(EINVAL) when src is not the
+// format and size the converter was allocated for.
+int frameConverterConvert(const FrameConverter* converter, const AVFrame* src, AVFrame* dst);
+
+bool frameConverterSpecialized(const FrameConverter* converter);
+void frameConverterLog(const FrameConverter* converter, const char* name);
+
+// Whether the pair has a specialized converter
+bool frameConversionSpecialized(AVPixelFormat srcFormat, AVPixelFormat dstFormat, bool crop);
+
+// The specialized conversions, in registry order
+int frameConversionCount();
+FrameConversion frameConversionAt(int index);
+
+#endif
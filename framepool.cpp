@@ -0,0 +1,244 @@
+#include "framepool.h"
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+}
+
+#define poolAlign 64
+#define poolPadding 64
+
+typedef std::tuple<int, int, int> PoolKey;
+
+struct FramePool {
+    std::mutex mutex;
+    std::map<PoolKey, AVBufferPool*> videoPools;
+    std::map<PoolKey, AVBufferPool*> audioPools;
+    std::vector<AVFrame*> freeFrames;
+    std::vector<AVPacket*> freePackets;
+
+    std::atomic<uint64_t> bufferAllocs;
+    std::atomic<uint64_t> bufferGets;
+    std::atomic<uint64_t> frameAllocs;
+    std::atomic<uint64_t> frameGets;
+    std::atomic<uint64_t> packetAllocs;
+    std::atomic<uint64_t> packetGets;
+};
+
+static AVBufferRef* countingAlloc(void* opaque, size_t size) {
+    FramePool* pool = (FramePool*) opaque;
+    pool->bufferAllocs++;
+    return av_buffer_alloc(size);
+}
+
+static AVBufferPool* findPool(FramePool* pool, std::map<PoolKey, AVBufferPool*>& pools, const PoolKey& key, size_t size) {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+
+    auto it = pools.find(key);
+    if (it != pools.end()) {
+        return it->second;
+    }
+
+    AVBufferPool* bufferPool = av_buffer_pool_init2(size, pool, countingAlloc, nullptr);
+    if (bufferPool != nullptr) {
+        pools[key] = bufferPool;
+    }
+    return bufferPool;
+}
+
+FramePool* framePoolAlloc() {
+    FramePool* pool = new FramePool();
+    pool->bufferAllocs = 0;
+    pool->bufferGets = 0;
+    pool->frameAllocs = 0;
+    pool->frameGets = 0;
+    pool->packetAllocs = 0;
+    pool->packetGets = 0;
+    return pool;
+}
+
+void framePoolFree(FramePool** pool) {
+    if (pool == nullptr || *pool == nullptr) {
+        return;
+    }
+
+    // Buffers still referenced by frames stay valid, AVBufferPool frees them on release
+    for (auto& entry : (*pool)->videoPools) {
+        av_buffer_pool_uninit(&entry.second);
+    }
+    for (auto& entry : (*pool)->audioPools) {
+        av_buffer_pool_uninit(&entry.second);
+    }
+    for (AVFrame* frame : (*pool)->freeFrames) {
+        av_frame_free(&frame);
+    }
+    for (AVPacket* packet : (*pool)->freePackets) {
+        av_packet_free(&packet);
+    }
+
+    delete *pool;
+    *pool = nullptr;
+}
+
+int framePoolGetVideoBuffer(FramePool* pool, AVFrame* frame) {
+    const AVPixelFormat format = (AVPixelFormat) frame->format;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (desc == nullptr || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+        return av_frame_get_buffer(frame, 0);
+    }
+
+    // Same layout rules as av_frame_get_buffer: aligned linesizes, height padded to 32
+    for (int align = 1; align <= poolAlign; align *= 2) {
+        int ret = av_image_fill_linesizes(frame->linesize, format, FFALIGN(frame->width, align));
+        if (ret < 0) {
+            return ret;
+        }
+        if (frame->linesize[0] % poolAlign == 0) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < 4 && frame->linesize[i]; i++) {
+        frame->linesize[i] = FFALIGN(frame->linesize[i], poolAlign);
+    }
+
+    const int paddedHeight = FFALIGN(frame->height, 32);
+    const int size = av_image_fill_pointers(frame->data, format, paddedHeight, nullptr, frame->linesize);
+    if (size < 0) {
+        return size;
+    }
+
+    AVBufferPool* bufferPool = findPool(pool, pool->videoPools,
+        PoolKey(format, frame->width, frame->height), size + poolPadding);
+    if (bufferPool == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    frame->buf[0] = av_buffer_pool_get(bufferPool);
+    if (frame->buf[0] == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+    pool->bufferGets++;
+
+    av_image_fill_pointers(frame->data, format, paddedHeight, frame->buf[0]->data, frame->linesize);
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+int framePoolGetAudioBuffer(FramePool* pool, AVFrame* frame) {
+    const AVSampleFormat format = (AVSampleFormat) frame->format;
+    const int channels = frame->ch_layout.nb_channels;
+    const int planar = av_sample_fmt_is_planar(format);
+    const int planes = planar ? channels : 1;
+    if (channels <= 0 || planes > AV_NUM_DATA_POINTERS) {
+        return av_frame_get_buffer(frame, 0);
+    }
+
+    int linesize = 0;
+    int ret = av_samples_get_buffer_size(&linesize, channels, frame->nb_samples, format, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    AVBufferPool* bufferPool = findPool(pool, pool->audioPools,
+        PoolKey(format, channels, frame->nb_samples), linesize + poolPadding);
+    if (bufferPool == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < planes; i++) {
+        frame->buf[i] = av_buffer_pool_get(bufferPool);
+        if (frame->buf[i] == nullptr) {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        pool->bufferGets++;
+    }
+
+    frame->extended_data = frame->data;
+    frame->linesize[0] = linesize;
+
+    return 0;
+}
+
+AVFrame* framePoolAcquireFrame(FramePool* pool) {
+    pool->frameGets++;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if (!pool->freeFrames.empty()) {
+            AVFrame* frame = pool->freeFrames.back();
+            pool->freeFrames.pop_back();
+            return frame;
+        }
+    }
+
+    pool->frameAllocs++;
+    return av_frame_alloc();
+}
+
+void framePoolReleaseFrame(FramePool* pool, AVFrame** frame) {
+    if (*frame == nullptr) {
+        return;
+    }
+
+    av_frame_unref(*frame);
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->freeFrames.push_back(*frame);
+    *frame = nullptr;
+}
+
+AVPacket* framePoolAcquirePacket(FramePool* pool) {
+    pool->packetGets++;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if (!pool->freePackets.empty()) {
+            AVPacket* packet = pool->freePackets.back();
+            pool->freePackets.pop_back();
+            return packet;
+        }
+    }
+
+    pool->packetAllocs++;
+    return av_packet_alloc();
+}
+
+void framePoolReleasePacket(FramePool* pool, AVPacket** packet) {
+    if (*packet == nullptr) {
+        return;
+    }
+
+    av_packet_unref(*packet);
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->freePackets.push_back(*packet);
+    *packet = nullptr;
+}
+
+void framePoolGetStats(FramePool* pool, FramePoolStats* stats) {
+    stats->bufferAllocs = pool->bufferAllocs;
+    stats->bufferGets = pool->bufferGets;
+    stats->frameAllocs = pool->frameAllocs;
+    stats->frameGets = pool->frameGets;
+    stats->packetAllocs = pool->packetAllocs;
+    stats->packetGets = pool->packetGets;
+}
+
+void framePoolLogStats(FramePool* pool) {
+    FramePoolStats stats;
+    framePoolGetStats(pool, &stats);
+
+    std::cout << "frame pool: " << stats.bufferAllocs << " buffer allocs / " << stats.bufferGets << " gets"
+        << ", " << stats.frameAllocs << " frame allocs / " << stats.frameGets << " gets"
+        << ", " << stats.packetAllocs << " packet allocs / " << stats.packetGets << " gets\n";
+}
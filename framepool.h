@@ -0,0 +1,42 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <cstdint>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+// Recycles frame data buffers through AVBufferPool, keyed by (pix_fmt, width, height)
+// for video and (sample_fmt, channels, nb_samples) for audio, plus the AVFrame/AVPacket
+// shells that travel between threads. Once every key has been seen, steady state
+// capture does not allocate any more buffers; the counters below prove it.
+typedef struct FramePool FramePool;
+
+typedef struct FramePoolStats {
+    uint64_t bufferAllocs;  // buffers the pools had to allocate
+    uint64_t bufferGets;    // buffers handed out
+    uint64_t frameAllocs;   // AVFrame shells allocated
+    uint64_t frameGets;
+    uint64_t packetAllocs;  // AVPacket shells allocated
+    uint64_t packetGets;
+} FramePoolStats;
+
+FramePool* framePoolAlloc();
+void framePoolFree(FramePool** pool);
+
+// Drop-in replacements for av_frame_get_buffer(frame, 0). format, width/height or
+// format, ch_layout and nb_samples must be set on frame beforehand.
+int framePoolGetVideoBuffer(FramePool* pool, AVFrame* frame);
+int framePoolGetAudioBuffer(FramePool* pool, AVFrame* frame);
+
+// Thread-safe free lists of frame/packet shells. Released shells are unreferenced.
+AVFrame* framePoolAcquireFrame(FramePool* pool);
+void framePoolReleaseFrame(FramePool* pool, AVFrame** frame);
+AVPacket* framePoolAcquirePacket(FramePool* pool);
+void framePoolReleasePacket(FramePool* pool, AVPacket** packet);
+
+void framePoolGetStats(FramePool* pool, FramePoolStats* stats);
+void framePoolLogStats(FramePool* pool);
+
+#endif
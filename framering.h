@@ -0,0 +1,140 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "doorbell.h"
+#include "framepool.h"
+
+// A blocked producer also rechecks this often, in case a pop() was missed
+#define frameRingRoomWaitUs 100000
+
+typedef enum FrameRingPolicy {
+    FRAME_RING_BLOCK,       // producer sleeps until the consumer frees a slot when the ring is full
+    FRAME_RING_DROP_OLDEST, // producer releases the oldest queued frame to make room
+} FrameRingPolicy;
+
+// Lock-free single-producer single-consumer ring of AVFrame* shells from
+// framePoolAcquireFrame(). The ring owns every frame between push() and pop(); the
+// frames it drops, or still holds when destroyed, go back to pool. head is only
+// written by the producer; tail is advanced with a CAS so the producer can also drop
+// the oldest frame under FRAME_RING_DROP_OLDEST without racing the consumer. Both
+// indices grow monotonically, so a stale CAS can never succeed after wrap-around.
+// A FRAME_RING_BLOCK producer facing a full ring sleeps on a doorbell that every pop()
+// rings, it doesn't spin a core while the consumer is the bottleneck.
+class FrameRing {
+public:
+    FrameRing(size_t depth, FrameRingPolicy policy, FramePool* pool) : policy(policy), pool(pool) {
+        capacity = 1;
+        while (capacity < depth) {
+            capacity <<= 1;
+        }
+        mask = capacity - 1;
+        slots = new std::atomic<AVFrame*>[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FrameRing() {
+        AVFrame* frame;
+        while ((frame = pop()) != nullptr) {
+            framePoolReleaseFrame(pool, &frame);
+        }
+        delete[] slots;
+    }
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Producer side. Takes ownership of frame on success, returns false only when
+    // the ring was closed while waiting for room.
+    bool push(AVFrame* frame) {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        bool waited = false;
+
+        while (h - tail.load(std::memory_order_acquire) >= capacity) {
+            if (policy == FRAME_RING_DROP_OLDEST) {
+                AVFrame* oldest = pop();
+                if (oldest != nullptr) {
+                    framePoolReleaseFrame(pool, &oldest);
+                    overruns.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            }
+
+            if (closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            if (!waited) {
+                waited = true;
+                overruns.fetch_add(1, std::memory_order_relaxed);
+            }
+            roomBell.wait(std::chrono::microseconds(frameRingRoomWaitUs));
+        }
+
+        slots[h & mask].store(frame, std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side (and the producer when dropping). Returns nullptr when empty.
+    AVFrame* pop() {
+        uint64_t t = tail.load(std::memory_order_acquire);
+        while (t != head.load(std::memory_order_acquire)) {
+            AVFrame* frame = slots[t & mask].load(std::memory_order_relaxed);
+            if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                if (policy == FRAME_RING_BLOCK) {
+                    roomBell.ring();
+                }
+                return frame;
+            }
+        }
+        return nullptr;
+    }
+
+    // Called by the producer after its last push()
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    // True once the producer closed the ring and the consumer took every frame
+    bool isDrained() const {
+        return closed.load(std::memory_order_acquire) &&
+            head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t depth() const { return capacity; }
+    uint64_t pushedCount() const { return pushed.load(std::memory_order_relaxed); }
+
+    // Frames dropped (FRAME_RING_DROP_OLDEST) or pushes that had to wait (FRAME_RING_BLOCK)
+    uint64_t overrunCount() const { return overruns.load(std::memory_order_relaxed); }
+
+private:
+    const FrameRingPolicy policy;
+    FramePool* const pool;
+    size_t capacity;
+    size_t mask;
+    std::atomic<AVFrame*>* slots;
+
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) std::atomic<bool> closed{false};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> overruns{0};
+    Doorbell roomBell;      // rung by pop(), waited on by a producer facing a full ring
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "inputsync.h"
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+typedef struct SyncedInput {
+    std::deque<AVFrame*> pending;   // arrived, not yet reached by a tick
+    AVFrame* held;                  // newest frame at or before the current tick
+    bool heldShown;
+    bool closed;
+    int64_t maxStalenessUs;
+    InputSyncStats stats;
+} SyncedInput;
+
+struct InputSync {
+    std::vector<SyncedInput> inputs;
+    AVRational frameRate;
+    AVRational timeBase;
+    FramePool* framePool;
+    int64_t nextTick;               // tick index, -1 until every input has a frame
+    uint64_t ticks;
+};
+
+InputSync* inputSyncAlloc(int inputCount, AVRational frameRate, AVRational timeBase, const int64_t* maxStalenessUs, FramePool* framePool) {
+    InputSync* sync = new InputSync();
+    sync->inputs.resize(inputCount);
+    for (int i = 0; i < inputCount; i++) {
+        SyncedInput& input = sync->inputs[i];
+        input.held = nullptr;
+        input.heldShown = false;
+        input.closed = false;
+        input.maxStalenessUs = maxStalenessUs[i];
+        input.stats = {};
+    }
+    sync->frameRate = frameRate;
+    sync->timeBase = timeBase;
+    sync->framePool = framePool;
+    sync->nextTick = -1;
+    sync->ticks = 0;
+    return sync;
+}
+
+void inputSyncFree(InputSync** sync) {
+    if (*sync == nullptr) {
+        return;
+    }
+
+    for (SyncedInput& input : (*sync)->inputs) {
+        for (AVFrame* frame : input.pending) {
+            framePoolReleaseFrame((*sync)->framePool, &frame);
+        }
+        framePoolReleaseFrame((*sync)->framePool, &input.held);
+    }
+
+    delete *sync;
+    *sync = nullptr;
+}
+
+static int64_t frameTime(const InputSync* sync, const AVFrame* frame) {
+    return av_rescale_q(frame->pts, sync->timeBase, AV_TIME_BASE_Q);
+}
+
+static int64_t tickTime(const InputSync* sync, int64_t tick) {
+    return av_rescale_q(tick, av_inv_q(sync->frameRate), AV_TIME_BASE_Q);
+}
+
+// A frame for the tick at time, or proof that none is coming
+static bool inputReady(const InputSync* sync, const SyncedInput& input, int64_t time, int64_t halfTick) {
+    return input.closed || !input.pending.empty() || (input.held != nullptr && frameTime(sync, input.held) >= time - halfTick);
+}
+
+void inputSyncPush(InputSync* sync, int input, AVFrame* frame) {
+    SyncedInput& synced = sync->inputs[input];
+    synced.stats.framesIn++;
+
+    // A consumer that fell behind keeps only the newest frames
+    if (synced.pending.size() >= inputSyncQueueDepth) {
+        AVFrame* oldest = synced.pending.front();
+        synced.pending.pop_front();
+        framePoolReleaseFrame(sync->framePool, &oldest);
+        synced.stats.framesSkipped++;
+    }
+    synced.pending.push_back(frame);
+}
+
+void inputSyncClose(InputSync* sync, int input) {
+    sync->inputs[input].closed = true;
+}
+
+int inputSyncTick(InputSync* sync, int64_t now, AVFrame** frames) {
+    if (sync->nextTick < 0) {
+        // The first tick is the first one every input has a frame for
+        int64_t start = 0;
+        for (const SyncedInput& input : sync->inputs) {
+            if (input.pending.empty()) {
+                return input.closed ? AVERROR_EOF : AVERROR(EAGAIN);
+            }
+            start = std::max(start, frameTime(sync, input.pending.front()));
+        }
+        sync->nextTick = av_rescale_q_rnd(start, AV_TIME_BASE_Q, av_inv_q(sync->frameRate), AV_ROUND_UP);
+    }
+
+    const int64_t time = tickTime(sync, sync->nextTick);
+    const int64_t halfTick = (tickTime(sync, sync->nextTick + 1) - time) / 2;
+    std::vector<bool> waitedOut(sync->inputs.size(), false);
+    bool allDone = true;
+
+    for (size_t i = 0; i < sync->inputs.size(); i++) {
+        SyncedInput& input = sync->inputs[i];
+
+        // Move up to the newest frame that belongs to this tick
+        while (!input.pending.empty() && frameTime(sync, input.pending.front()) <= time + halfTick) {
+            if (input.held != nullptr && !input.heldShown) {
+                input.stats.framesSkipped++;
+            }
+            framePoolReleaseFrame(sync->framePool, &input.held);
+            input.held = input.pending.front();
+            input.heldShown = false;
+            input.pending.pop_front();
+        }
+
+        if (!inputReady(sync, input, time, halfTick)) {
+            if (now < time + input.maxStalenessUs) {
+                return AVERROR(EAGAIN);
+            }
+            waitedOut[i] = true;
+        }
+
+        allDone = allDone && input.closed && input.pending.empty() && input.heldShown;
+    }
+
+    if (allDone) {
+        return AVERROR_EOF;
+    }
+
+    const int64_t pts = av_rescale_q(sync->nextTick, av_inv_q(sync->frameRate), sync->timeBase);
+    for (size_t i = 0; i < sync->inputs.size(); i++) {
+        SyncedInput& input = sync->inputs[i];
+
+        if (waitedOut[i]) {
+            input.stats.late++;
+        } else if (input.heldShown) {
+            input.stats.repeated++;
+        }
+        if (!input.heldShown) {
+            input.stats.framesShown++;
+            input.heldShown = true;
+        }
+        input.stats.maxAgeUs = std::max(input.stats.maxAgeUs, time - frameTime(sync, input.held));
+
+        av_frame_ref(frames[i], input.held);
+        frames[i]->pts = pts;
+    }
+
+    sync->nextTick++;
+    sync->ticks++;
+    return 0;
+}
+
+int64_t inputSyncTimeout(const InputSync* sync, int64_t now) {
+    if (sync->nextTick < 0) {
+        return -1;
+    }
+
+    // The tick waits for the last of the inputs it has no frame from
+    const int64_t time = tickTime(sync, sync->nextTick);
+    const int64_t halfTick = (tickTime(sync, sync->nextTick + 1) - time) / 2;
+    int64_t deadline = now;
+    for (const SyncedInput& input : sync->inputs) {
+        if (!inputReady(sync, input, time, halfTick)) {
+            deadline = std::max(deadline, time + input.maxStalenessUs);
+        }
+    }
+    return deadline - now;
+}
+
+void inputSyncGetStats(const InputSync* sync, int input, InputSyncStats* stats) {
+    *stats = sync->inputs[input].stats;
+}
+
+void inputSyncLog(const InputSync* sync) {
+    std::cout << "input sync: " << sync->ticks << " ticks at " << av_q2d(sync->frameRate) << " fps\n";
+    for (size_t i = 0; i < sync->inputs.size(); i++) {
+        const InputSyncStats& stats = sync->inputs[i].stats;
+        std::cout << "  input" << i + 1 << ": " << stats.framesIn << " frames in, "
+            << stats.framesShown << " shown, " << stats.framesSkipped << " skipped, "
+            << stats.repeated << " repeated, " << stats.late << " late (max staleness "
+            << sync->inputs[i].maxStalenessUs / 1000 << " ms), oldest frame used "
+            << stats.maxAgeUs / 1000.0 << " ms\n";
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef INPUTSYNC_H
+#define INPUTSYNC_H
+
+#include <cstdint>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+#include "framepool.h"
+
+// Frame synchronizer ahead of a compositor. Holds the latest frame of every input
+// and emits composite ticks at the output frame rate, one frame per input per tick,
+// all carrying the tick's pts, so the compositor's own framesync never waits.
+//
+// A tick is due once every input has a frame for it, or an input is known to be past
+// it. An input that has neither is waited for only until the tick time plus its max
+// staleness; after that its held frame is repeated and the tick counts as late for
+// that input. One slow source therefore delays the merge by at most its max staleness.
+//
+// Ticks start once every input has delivered a frame. Frame pts and now are on the
+// shared timeline (see timeline.h). Not thread-safe, the consumer thread owns it.
+
+#define inputSyncQueueDepth 8
+#define defaultMaxStalenessUs 50000
+
+typedef struct InputSync InputSync;
+
+typedef struct InputSyncStats {
+    uint64_t framesIn;
+    uint64_t framesShown;       // distinct frames used by at least one tick
+    uint64_t framesSkipped;     // replaced by a newer frame before any tick used them
+    uint64_t repeated;          // ticks reusing the held frame, input slower than the output or ended
+    uint64_t late;              // ticks that waited out the input's max staleness
+    int64_t maxAgeUs;           // oldest frame any tick used, relative to the tick
+} InputSyncStats;
+
+// maxStalenessUs has one entry per input. Frame shells are returned to framePool.
+InputSync* inputSyncAlloc(int inputCount, AVRational frameRate, AVRational timeBase, const int64_t* maxStalenessUs, FramePool* framePool);
+void inputSyncFree(InputSync** sync);
+
+// Takes ownership of frame, a framePool shell with pts in timeBase
+void inputSyncPush(InputSync* sync, int input, AVFrame* frame);
+
+// The input has no more frames, its last one is repeated from now on
+void inputSyncClose(InputSync* sync, int input);
+
+// Returns 0 with frames[i] referencing the frame of input i for the next tick,
+// AVERROR(EAGAIN) when that tick is not due yet at now (timeline microseconds), or
+// AVERROR_EOF once every input has ended and all of their frames were shown.
+int inputSyncTick(InputSync* sync, int64_t now, AVFrame** frames);
+
+// Microseconds until the next tick is due even without new frames, the longest a
+// consumer should sleep; -1 before ticks have started
+int64_t inputSyncTimeout(const InputSync* sync, int64_t now);
+
+void inputSyncGetStats(const InputSync* sync, int input, InputSyncStats* stats);
+void inputSyncLog(const InputSync* sync);
+
+#endif
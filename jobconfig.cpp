@@ -0,0 +1,527 @@
+#include "jobconfig.h"
+#include "compositor.h"
+#include "inputsync.h"
+#include "outputsink.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#define defaultJobFrameRate 30
+#define defaultJobChannels 2
+#define defaultJobSampleRate 48000
+
+void jobConfigInit(JobConfig* job) {
+    job->inputs.clear();
+    job->output = "output.mp4";
+    outputOptionsInit(&job->outputOptions);
+    job->sinks.clear();
+    job->ladder.clear();
+    job->outputVideo = true;
+    job->outputAudio = true;
+    job->hasRange = false;
+    job->startSeconds = 0;
+    job->endSeconds = 0;
+    job->splitParts = 0;
+    job->metricsPort = 0;
+    job->metricsFile.clear();
+    job->width = 0;
+    job->height = 0;
+    job->gridLayout = false;
+    job->gridColumns = 0;
+    job->frameRate = defaultJobFrameRate;
+    job->convertMode = VIDEO_CONVERT_SWS;
+    job->syncInputs = false;
+    job->videoCodec.clear();
+    encoderSettingsInit(&job->videoEncoder);
+    job->audioChannels = defaultJobChannels;
+    job->audioSampleRate = defaultJobSampleRate;
+    job->pan.clear();
+}
+
+static JobInput newJobInput(const std::string& url) {
+    JobInput input;
+    input.url = url;
+    input.frameRate = defaultJobFrameRate;
+    input.crop = { 0, 0, 0, 0 };
+    input.x = 0;
+    input.y = 0;
+    input.audio = true;
+    input.gain = 1.0f;
+    input.muted = false;
+    input.maxStalenessUs = defaultMaxStalenessUs;
+    return input;
+}
+
+JobInput* jobConfigAddInput(JobConfig* job, const std::string& url) {
+    job->inputs.push_back(newJobInput(url));
+    return &job->inputs.back();
+}
+
+static std::string trim(const std::string& value) {
+    const size_t first = value.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    const size_t last = value.find_last_not_of(" \t\r");
+    return value.substr(first, last - first + 1);
+}
+
+// WxH+X+Y, or just WxH for a crop anchored at the top left corner
+static bool parseCrop(const char* value, VideoCropRect* crop) {
+    VideoCropRect parsed = { 0, 0, 0, 0 };
+    const int count = sscanf(value, "%dx%d+%d+%d", &parsed.width, &parsed.height, &parsed.x, &parsed.y);
+    if (count != 2 && count != 4) {
+        return false;
+    }
+    if (parsed.width <= 0 || parsed.height <= 0 || parsed.x < 0 || parsed.y < 0) {
+        return false;
+    }
+    *crop = parsed;
+    return true;
+}
+
+static bool parseSize(const char* value, int* width, int* height) {
+    return sscanf(value, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static bool parsePosition(const char* value, int* x, int* y) {
+    return sscanf(value, "%d,%d", x, y) == 2 && *x >= 0 && *y >= 0;
+}
+
+static bool parseBool(const char* value) {
+    return strcmp(value, "1") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "on") == 0;
+}
+
+static bool parseConvertMode(const char* value, VideoConvertMode* convertMode) {
+    if (strcmp(value, "sws") == 0) {
+        *convertMode = VIDEO_CONVERT_SWS;
+    } else if (strcmp(value, "graph") == 0) {
+        *convertMode = VIDEO_CONVERT_GRAPH;
+    } else if (strcmp(value, "kernel") == 0) {
+        *convertMode = VIDEO_CONVERT_KERNEL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Applies one key of [output], [video], [audio] or [input]; section names double as
+// the flag namespace so the file and the command line share one vocabulary
+static bool applySetting(JobConfig* job, const std::string& section, const std::string& key, const std::string& value) {
+    const char* v = value.c_str();
+
+    if (section == "input") {
+        if (job->inputs.empty()) {
+            return false;
+        }
+        JobInput& input = job->inputs.back();
+
+        if (key == "url") {
+            input.url = value;
+        } else if (key == "format") {
+            input.format = value;
+        } else if (key == "fps") {
+            input.frameRate = atoi(v);
+            return input.frameRate > 0;
+        } else if (key == "crop") {
+            return parseCrop(v, &input.crop);
+        } else if (key == "position") {
+            return parsePosition(v, &input.x, &input.y);
+        } else if (key == "audio") {
+            input.audio = parseBool(v);
+        } else if (key == "gain") {
+            input.gain = (float) atof(v);
+            return input.gain >= 0;
+        } else if (key == "mute") {
+            input.muted = parseBool(v);
+        } else if (key == "max_staleness") {
+            input.maxStalenessUs = (int64_t) (atof(v) * 1000);
+            return input.maxStalenessUs >= 0;
+        } else {
+            return false;
+        }
+    } else if (section == "output") {
+        if (key == "file") {
+            job->output = value;
+        } else if (key == "size") {
+            return parseSize(v, &job->width, &job->height);
+        } else if (key == "layout") {
+            if (value != "grid" && value != "rects") {
+                return false;
+            }
+            job->gridLayout = value == "grid";
+        } else if (key == "columns") {
+            job->gridColumns = atoi(v);
+            return job->gridColumns >= 0;
+        } else if (key == "fps") {
+            job->frameRate = atoi(v);
+            return job->frameRate > 0;
+        } else if (key == "convert") {
+            return parseConvertMode(v, &job->convertMode);
+        } else if (key == "sync") {
+            job->syncInputs = parseBool(v);
+        } else if (key == "low_latency") {
+            job->videoEncoder.lowLatency = parseBool(v);
+        } else if (key == "container") {
+            return parseOutputContainer(v, &job->outputOptions.container);
+        } else if (key == "segment_seconds") {
+            job->outputOptions.segmentSeconds = atoi(v);
+            return job->outputOptions.segmentSeconds > 0;
+        } else if (key == "segment_wrap") {
+            job->outputOptions.segmentWrap = atoi(v);
+            return job->outputOptions.segmentWrap >= 0;
+        } else if (key == "async_write") {
+            job->outputOptions.asyncWrite = parseBool(v);
+        } else if (key == "direct_io") {
+            job->outputOptions.directIo = parseBool(v);
+        } else if (key == "tee") {
+            OutputSink sink;
+            if (!parseOutputSinkSpec(v, &sink) || job->sinks.size() >= maxOutputSinks) {
+                return false;
+            }
+            job->sinks.push_back(value);
+        } else if (key == "ladder") {
+            int heights[maxRenditions];
+            const int count = parseLadderHeights(v, heights);
+            if (count < 0) {
+                return false;
+            }
+            job->ladder.assign(heights, heights + count);
+        } else if (key == "video") {
+            job->outputVideo = parseBool(v);
+        } else if (key == "audio") {
+            job->outputAudio = parseBool(v);
+        } else if (key == "start") {
+            job->hasRange = true;
+            job->startSeconds = atof(v);
+            return job->startSeconds >= 0;
+        } else if (key == "end") {
+            job->hasRange = true;
+            job->endSeconds = atof(v);
+            return job->endSeconds >= 0;
+        } else if (key == "split") {
+            job->splitParts = atoi(v);
+            return job->splitParts >= 0;
+        } else if (key == "metrics_port") {
+            job->metricsPort = atoi(v);
+            return job->metricsPort >= 0 && job->metricsPort <= 65535;
+        } else if (key == "metrics_file") {
+            job->metricsFile = value;
+        } else {
+            return false;
+        }
+    } else if (section == "video") {
+        if (key == "codec") {
+            job->videoCodec = value;
+        } else if (key == "bitrate") {
+            job->videoEncoder.bitRate = strtoll(v, nullptr, 10);
+        } else if (key == "crf") {
+            job->videoEncoder.crf = atoi(v);
+            return job->videoEncoder.crf >= 0;
+        } else if (key == "gop") {
+            job->videoEncoder.gopSize = atoi(v);
+        } else if (key == "preset") {
+            job->videoEncoder.preset = value;
+        } else if (key == "tune") {
+            job->videoEncoder.tune = value;
+        } else if (key == "threads") {
+            job->videoEncoder.threadCount = atoi(v);
+            return job->videoEncoder.threadCount >= 0;
+        } else if (key == "thread_type") {
+            return parseEncoderThreadType(v, &job->videoEncoder.threadType);
+        } else {
+            return false;
+        }
+    } else if (section == "audio") {
+        if (key == "channels") {
+            job->audioChannels = atoi(v);
+            return job->audioChannels > 0;
+        } else if (key == "sample_rate") {
+            job->audioSampleRate = atoi(v);
+            return job->audioSampleRate > 0;
+        } else if (key == "pan") {
+            job->pan = value;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// ';' and '#' start a comment at the beginning of a line or after whitespace, so
+// lavfi urls like "testsrc2[out0];sine[out1]" survive
+static std::string stripComment(const std::string& line) {
+    for (size_t i = 0; i < line.size(); i++) {
+        if ((line[i] == ';' || line[i] == '#') && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) {
+            return line.substr(0, i);
+        }
+    }
+    return line;
+}
+
+bool jobConfigLoadFile(JobConfig* job, const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Failed to open job file " << path << "\n";
+        return false;
+    }
+
+    std::string section;
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(file, line)) {
+        lineNumber++;
+
+        line = trim(stripComment(line));
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.front() == '[' && line.back() == ']') {
+            section = trim(line.substr(1, line.size() - 2));
+            if (section == "input") {
+                jobConfigAddInput(job, "");
+            }
+            continue;
+        }
+
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            std::cout << path << ":" << lineNumber << ": expected key = value\n";
+            return false;
+        }
+
+        // pan expressions contain '=' themselves, only the first one separates the key
+        const std::string key = trim(line.substr(0, equals));
+        const std::string value = trim(line.substr(equals + 1));
+        if (!applySetting(job, section, key, value)) {
+            std::cout << path << ":" << lineNumber << ": bad setting " << key << " = " << value
+                << (section.empty() ? "" : " in [" + section + "]") << "\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Flag -> (section, key). Input flags apply to the input started by the last -i.
+static bool flagSetting(const char* flag, std::string* section, std::string* key) {
+    static const struct {
+        const char* flag;
+        const char* section;
+        const char* key;
+    } flags[] = {
+        { "-o", "output", "file" },
+        { "--size", "output", "size" },
+        { "--layout", "output", "layout" },
+        { "--columns", "output", "columns" },
+        { "--fps", "output", "fps" },
+        { "--convert", "output", "convert" },
+        { "--container", "output", "container" },
+        { "--segment-seconds", "output", "segment_seconds" },
+        { "--segment-wrap", "output", "segment_wrap" },
+        { "--tee", "output", "tee" },
+        { "--ladder", "output", "ladder" },
+        { "--start", "output", "start" },
+        { "--end", "output", "end" },
+        { "--split", "output", "split" },
+        { "--metrics-port", "output", "metrics_port" },
+        { "--metrics-file", "output", "metrics_file" },
+        { "--vcodec", "video", "codec" },
+        { "--bitrate", "video", "bitrate" },
+        { "--gop", "video", "gop" },
+        { "--crf", "video", "crf" },
+        { "--preset", "video", "preset" },
+        { "--tune", "video", "tune" },
+        { "--threads", "video", "threads" },
+        { "--thread-type", "video", "thread_type" },
+        { "--channels", "audio", "channels" },
+        { "--sample-rate", "audio", "sample_rate" },
+        { "--pan", "audio", "pan" },
+        { "-f", "input", "format" },
+        { "--input-fps", "input", "fps" },
+        { "--crop", "input", "crop" },
+        { "--pos", "input", "position" },
+        { "--gain", "input", "gain" },
+        { "--max-staleness", "input", "max_staleness" },
+    };
+
+    for (const auto& entry : flags) {
+        if (strcmp(flag, entry.flag) == 0) {
+            *section = entry.section;
+            *key = entry.key;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool jobConfigParseArgs(JobConfig* job, int argc, char* argv[]) {
+    // The job file is the base, so load it before any flag is applied
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--job") == 0 && !jobConfigLoadFile(job, argv[i + 1])) {
+            return false;
+        }
+    }
+
+    bool inputsFromArgs = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string section;
+        std::string key;
+
+        if (strcmp(argv[i], "--job") == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            // Inputs on the command line replace the ones from the job file
+            if (!inputsFromArgs) {
+                job->inputs.clear();
+                inputsFromArgs = true;
+            }
+            jobConfigAddInput(job, argv[++i]);
+        } else if (strcmp(argv[i], "--low-latency") == 0) {
+            applySetting(job, "output", "low_latency", "yes");
+        } else if (strcmp(argv[i], "--sync") == 0) {
+            applySetting(job, "output", "sync", "yes");
+        } else if (strcmp(argv[i], "--sync-write") == 0) {
+            applySetting(job, "output", "async_write", "no");
+        } else if (strcmp(argv[i], "--direct-io") == 0) {
+            applySetting(job, "output", "direct_io", "yes");
+        } else if (strcmp(argv[i], "--video-only") == 0) {
+            applySetting(job, "output", "audio", "no");
+        } else if (strcmp(argv[i], "--audio-only") == 0) {
+            applySetting(job, "output", "video", "no");
+        } else if (strcmp(argv[i], "--no-audio") == 0 || strcmp(argv[i], "--mute") == 0) {
+            // Input flags set the last -i, never an input of the job file
+            const bool mute = strcmp(argv[i], "--mute") == 0;
+            if (!inputsFromArgs || !applySetting(job, "input", mute ? "mute" : "audio", mute ? "yes" : "no")) {
+                std::cout << argv[i] << " must follow -i\n";
+                return false;
+            }
+        } else if (flagSetting(argv[i], &section, &key) && i + 1 < argc) {
+            if (section == "input" && !inputsFromArgs) {
+                std::cout << argv[i] << " must follow -i\n";
+                return false;
+            }
+            if (!applySetting(job, section, key, argv[i + 1])) {
+                std::cout << "Bad value for " << argv[i] << ": " << argv[i + 1] << "\n";
+                return false;
+            }
+            i++;
+        } else {
+            std::cout << "Unknown argument " << argv[i] << "\n";
+            return false;
+        }
+    }
+
+    if (job->inputs.empty()) {
+        std::cout << "No inputs, give a job file with [input] sections or -i <url>\n";
+        return false;
+    }
+
+    for (const JobInput& input : job->inputs) {
+        if (input.url.empty()) {
+            std::cout << "Input without url\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool jobConfigResolve(JobConfig* job, const std::vector<std::pair<int, int>>& inputSizes) {
+    int canvasWidth = 0;
+    int canvasHeight = 0;
+
+    for (size_t i = 0; i < job->inputs.size(); i++) {
+        JobInput& input = job->inputs[i];
+        const int inputWidth = inputSizes[i].first;
+        const int inputHeight = inputSizes[i].second;
+
+        if (input.crop.width == 0) {
+            input.crop = { 0, 0, inputWidth, inputHeight };
+        }
+
+        if (input.crop.x + input.crop.width > inputWidth || input.crop.y + input.crop.height > inputHeight) {
+            std::cout << "Crop of " << input.url << " is outside its " << inputWidth << "x" << inputHeight << " frame\n";
+            return false;
+        }
+
+        // yuv420p needs even sizes and offsets
+        input.crop.x &= ~1;
+        input.crop.y &= ~1;
+        input.crop.width &= ~1;
+        input.crop.height &= ~1;
+
+        canvasWidth = std::max(canvasWidth, input.x + input.crop.width);
+        canvasHeight = std::max(canvasHeight, input.y + input.crop.height);
+    }
+
+    // The grid places the inputs itself, inputs without video take no space
+    for (size_t i = 0; i < job->inputs.size() && !job->gridLayout; i++) {
+        const JobInput& a = job->inputs[i];
+        for (size_t j = i + 1; j < job->inputs.size() && a.crop.width > 0; j++) {
+            const JobInput& b = job->inputs[j];
+            if (b.crop.width > 0
+                && a.x < b.x + b.crop.width && b.x < a.x + a.crop.width
+                && a.y < b.y + b.crop.height && b.y < a.y + a.crop.height) {
+                std::cout << "Inputs " << a.url << " and " << b.url << " overlap on the canvas\n";
+                return false;
+            }
+        }
+    }
+
+    if (job->width == 0) {
+        job->width = canvasWidth;
+        job->height = canvasHeight;
+    }
+
+    job->width &= ~1;
+    job->height &= ~1;
+
+    return job->width > 0 && job->height > 0;
+}
+
+void jobConfigLog(const JobConfig* job) {
+    std::cout << "job: " << job->output << " (" << outputContainerName(job->outputOptions.container) << ") " << job->width << "x" << job->height << "@" << job->frameRate
+        << ", " << job->inputs.size() << " inputs" << (job->videoEncoder.lowLatency ? ", low latency" : "") << "\n";
+
+    for (const std::string& sink : job->sinks) {
+        std::cout << "  tee " << sink << "\n";
+    }
+    for (int height : job->ladder) {
+        std::cout << "  rendition " << height << "p\n";
+    }
+    if (job->hasRange) {
+        std::cout << "  inputs from " << job->startSeconds << " s to " << (job->endSeconds > 0 ? std::to_string(job->endSeconds) + " s" : "the end") << "\n";
+    }
+    if (job->syncInputs) {
+        std::cout << "  inputs synced\n";
+    }
+    if (!job->outputVideo || !job->outputAudio) {
+        std::cout << "  " << (job->outputVideo ? "video" : "audio") << " only\n";
+    }
+    if (job->metricsPort > 0 || !job->metricsFile.empty()) {
+        std::cout << "  metrics" << (job->metricsPort > 0 ? " on port " + std::to_string(job->metricsPort) : "")
+            << (!job->metricsFile.empty() ? " to " + job->metricsFile : "") << "\n";
+    }
+    for (const JobInput& input : job->inputs) {
+        std::cout << "  " << input.url << (input.format.empty() ? "" : " (" + input.format + ")")
+            << " crop " << input.crop.width << "x" << input.crop.height << "+" << input.crop.x << "+" << input.crop.y
+            << " at " << input.x << "," << input.y
+            << (input.audio ? "" : ", no audio");
+        if (input.audio && input.gain != 1.0f) {
+            std::cout << ", gain " << input.gain;
+        }
+        std::cout << (input.audio && input.muted ? ", muted" : "")
+            << (job->syncInputs ? ", max staleness " + std::to_string(input.maxStalenessUs / 1000) + " ms" : "") << "\n";
+    }
+}
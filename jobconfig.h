@@ -0,0 +1,128 @@
+#ifndef JOBCONFIG_H
+#define JOBCONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "encodersettings.h"
+#include "outputformat.h"
+#include "videoconvert.h"
+
+// One job = any number of inputs, each cropped and placed on an output canvas, plus
+// encoder settings and the output target. Jobs come from an INI file, from command
+// line flags, or from a file with flags overriding it:
+//
+//   [output]
+//   file = output.mp4
+//   size = 1000x800          ; canvas, omit to fit the placed inputs
+//   layout = rects           ; rects: inputs at their position | grid: position ignored
+//   columns = 0              ; grid columns, 0 for a near square grid
+//   fps = 30
+//   convert = sws            ; sws | graph | kernel
+//   sync = no                ; composite every input's newest frame at each output tick, see inputsync.h
+//   low_latency = no         ; zerolatency encoding, no B-frames, packets written immediately
+//   container = file         ; file | fragmented (crash safe MP4) | segmented (rolling files)
+//   segment_seconds = 60
+//   segment_wrap = 0         ; reuse segment numbers after N segments, 0 keeps them all
+//   async_write = yes        ; mux and write on a writer thread instead of the encode threads
+//   direct_io = no           ; bypass the page cache for whole 1 MB blocks
+//   tee = [format=mpegts]udp://127.0.0.1:5000    ; one more muxer per line, see outputsink.h
+//   ladder = 720,480         ; renditions from the same composite, output_720p.mp4 ...
+//   video = yes              ; no leaves the video stream out
+//   audio = yes              ; no leaves the audio stream out
+//   start = 0                ; seconds into the (file) inputs to start from
+//   end = 0                  ; seconds into the inputs to stop at, 0 for their end
+//   split = 0                ; encode N ranges in parallel and join them, see splitter.h
+//   metrics_port = 0         ; serve Prometheus metrics on http://127.0.0.1:<port>/metrics, see metrics.h
+//   metrics_file =           ; or rewrite them to this file every second
+//
+//   [video]
+//   codec = libx264          ; omit for the muxer's default
+//   bitrate = 4000000        ; ignored when crf is set
+//   crf = 23                 ; constant quality, omit for bitrate
+//   gop = 60
+//   preset = veryfast        ; omit for the encoder default
+//   tune = film
+//   threads = 0              ; 0 sizes from the cores
+//   thread_type = auto       ; auto | frame (throughput) | slice (latency)
+//
+//   [audio]
+//   channels = 2
+//   sample_rate = 48000
+//   pan = stereo|FL=c0+c2|FR=c1+c2    ; omit to sum every input into the output layout
+//
+//   [input]                  ; one section per input, in stacking order
+//   url = 0:0
+//   format = avfoundation    ; omit to probe
+//   fps = 30                 ; capture rate requested from the device
+//   crop = 500x800+100+0     ; WxH+X+Y, omit for the whole frame
+//   position = 0,0           ; top left corner on the canvas, inputs must not overlap
+//   audio = yes
+//   gain = 1.0               ; linear audio gain
+//   mute = no
+//   max_staleness = 50       ; ms a synced tick waits for this input before repeating its last frame
+
+typedef struct JobInput {
+    std::string url;
+    std::string format;
+    int frameRate;
+    VideoCropRect crop;     // width/height 0 until the input size is known
+    int x;
+    int y;
+    bool audio;
+    float gain;             // linear audio gain, also settable at runtime
+    bool muted;
+    int64_t maxStalenessUs; // synced jobs only
+} JobInput;
+
+typedef struct JobConfig {
+    std::vector<JobInput> inputs;
+
+    std::string output;
+    OutputOptions outputOptions;
+    std::vector<std::string> sinks;     // output sink specs
+    std::vector<int> ladder;            // rendition heights, see addRendition()
+    bool outputVideo;
+    bool outputAudio;
+    bool hasRange;                      // start or end given
+    double startSeconds;                // input range, see setInputRange()
+    double endSeconds;                  // 0 for the end of the inputs
+    int splitParts;                     // > 1 runs the job through runSplit()
+    int metricsPort;                    // 0 for none
+    std::string metricsFile;            // "" for none
+    int width;
+    int height;
+    bool gridLayout;
+    int gridColumns;
+    int frameRate;
+    VideoConvertMode convertMode;
+    bool syncInputs;                    // video through an InputSync, see runPipeline()
+
+    std::string videoCodec;
+    EncoderSettings videoEncoder;
+
+    int audioChannels;
+    int audioSampleRate;
+    std::string pan;
+} JobConfig;
+
+void jobConfigInit(JobConfig* job);
+
+// Appends an input with the defaults of an [input] section
+JobInput* jobConfigAddInput(JobConfig* job, const std::string& url);
+
+// Both return false after printing what was wrong. Input flags (-f, --crop, --no-audio,
+// ...) set the -i before them and are rejected without one, -i replaces the job file's inputs.
+bool jobConfigLoadFile(JobConfig* job, const char* path);
+bool jobConfigParseArgs(JobConfig* job, int argc, char* argv[]);
+
+// Fills in crop sizes of inputs cropped to their whole frame and the canvas size
+// from the placed inputs. inputSizes holds width, height per input. Fails when a crop
+// leaves its frame or, outside the grid layout, two inputs overlap on the canvas.
+bool jobConfigResolve(JobConfig* job, const std::vector<std::pair<int, int>>& inputSizes);
+
+void jobConfigLog(const JobConfig* job);
+
+#endif
@@ -0,0 +1,355 @@
+#include "jobrunner.h"
+#include "audiomixer.h"
+#include "avhandles.h"
+#include "compositor.h"
+#include "mediacontext.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C" {
+#include <libavdevice/avdevice.h>
+}
+
+struct AudioMixerDeleter {
+    void operator()(AudioMixer* mixer) const { audioMixerFree(&mixer); }
+};
+
+struct MetricsDeleter {
+    void operator()(Metrics* metrics) const { metricsFree(&metrics); }
+};
+
+struct MetricsExporterStopper {
+    void operator()(MetricsExporter* exporter) const { metricsExporterStop(&exporter); }
+};
+
+typedef std::unique_ptr<AudioMixer, AudioMixerDeleter> AudioMixerPtr;
+typedef std::unique_ptr<Metrics, MetricsDeleter> MetricsPtr;
+typedef std::unique_ptr<MetricsExporter, MetricsExporterStopper> MetricsExporterPtr;
+
+// Moves the inputs with video into grid cells, and sizes the canvas to the grid unless the job set one
+static void layoutGrid(JobConfig* job, const std::vector<MediaContext*>& inputCtxs, bool autoSize) {
+    std::vector<CompositorTile> tiles;
+    std::vector<size_t> tileInputs;
+
+    for (size_t i = 0; i < inputCtxs.size(); i++) {
+        if (inputCtxs[i]->videoCodecCtx == nullptr) {
+            continue;
+        }
+
+        CompositorTile tile = {};
+        tile.crop = job->inputs[i].crop;
+        tiles.push_back(tile);
+        tileInputs.push_back(i);
+    }
+
+    int canvasWidth;
+    int canvasHeight;
+    compositorGridLayout(tiles.data(), (int) tiles.size(), job->gridColumns, &canvasWidth, &canvasHeight);
+
+    for (size_t i = 0; i < tiles.size(); i++) {
+        job->inputs[tileInputs[i]].x = tiles[i].x;
+        job->inputs[tileInputs[i]].y = tiles[i].y;
+    }
+
+    if (autoSize) {
+        job->width = canvasWidth & ~1;
+        job->height = canvasHeight & ~1;
+    }
+}
+
+// Every input with video becomes a compositor tile at its job position
+static AVFilterGraph* createFilterGraphForVideo(const JobConfig* job, const std::vector<MediaContext*>& inputCtxs, MediaContext* outputCtx) {
+    // In kernel mode the decode threads already cropped the frames
+    const bool preCropped = job->convertMode == VIDEO_CONVERT_KERNEL;
+
+    std::vector<CompositorTile> tiles;
+    std::vector<size_t> tileInputs;
+
+    for (size_t i = 0; i < inputCtxs.size(); i++) {
+        AVCodecContext* codecCtx = inputCtxs[i]->videoCodecCtx;
+        const JobInput& input = job->inputs[i];
+        if (codecCtx == nullptr) {
+            continue;
+        }
+
+        CompositorTile tile;
+        tile.width = preCropped ? input.crop.width : codecCtx->width;
+        tile.height = preCropped ? input.crop.height : codecCtx->height;
+        tile.pixelFormat = job->convertMode == VIDEO_CONVERT_GRAPH ? codecCtx->pix_fmt : outputCtx->videoCodecCtx->pix_fmt;
+        tile.timeBase = codecCtx->time_base;
+        tile.sampleAspectRatio = codecCtx->sample_aspect_ratio;
+        tile.crop = { preCropped ? 0 : input.crop.x, preCropped ? 0 : input.crop.y, input.crop.width, input.crop.height };
+        tile.x = input.x;
+        tile.y = input.y;
+
+        tiles.push_back(tile);
+        tileInputs.push_back(i);
+    }
+
+    if (tiles.empty()) {
+        return nullptr;
+    }
+
+    // The canvas once, then scaled for every rendition
+    std::vector<MediaContext*> outputCtxs = { outputCtx };
+    std::vector<CompositorOutput> outputs;
+    for (int i = 0; i < outputCtx->renditionCount; i++) {
+        outputCtxs.push_back(outputCtx->renditions[i]);
+    }
+    for (MediaContext* ctx : outputCtxs) {
+        outputs.push_back({ ctx->videoCodecCtx->width, ctx->videoCodecCtx->height });
+    }
+
+    std::vector<AVFilterContext*> bufferSrcCtxs(tiles.size());
+    std::vector<AVFilterContext*> bufferSinkCtxs(outputs.size());
+    AVFilterGraph* filterGraph = compositorCreateLadderGraph(tiles.data(), (int) tiles.size(), job->width, job->height,
+        outputCtx->videoCodecCtx->pix_fmt, outputs.data(), (int) outputs.size(), bufferSrcCtxs.data(), bufferSinkCtxs.data());
+    if (filterGraph == nullptr) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < outputCtxs.size(); i++) {
+        outputCtxs[i]->videoBufferFilterCtx = bufferSinkCtxs[i];
+    }
+
+    for (size_t i = 0; i < tiles.size(); i++) {
+        inputCtxs[tileInputs[i]]->videoBufferFilterCtx = bufferSrcCtxs[i];
+    }
+
+    return filterGraph;
+}
+
+// Every input with audio is one mixer input; mixerInputs receives the job input index of each
+static AudioMixer* createAudioMixer(const JobConfig* job, const std::vector<MediaContext*>& inputCtxs, MediaContext* outputCtx, std::vector<size_t>* mixerInputs) {
+    std::vector<AudioMixerInput> inputs;
+    for (size_t i = 0; i < inputCtxs.size(); i++) {
+        AVCodecContext* codecCtx = inputCtxs[i]->audioCodecCtx;
+        if (!job->inputs[i].audio || codecCtx == nullptr) {
+            continue;
+        }
+
+        AudioMixerInput input;
+        input.timeBase = codecCtx->time_base;
+        input.sampleRate = codecCtx->sample_rate;
+        input.sampleFormat = codecCtx->sample_fmt;
+        input.chLayout = codecCtx->ch_layout;
+        input.gain = job->inputs[i].gain;
+        input.muted = job->inputs[i].muted;
+        inputs.push_back(input);
+        mixerInputs->push_back(i);
+    }
+
+    std::vector<AVFilterContext*> bufferSrcCtxs(inputs.size());
+    AudioMixer* mixer = audioMixerAlloc(inputs.data(), (int) inputs.size(), &outputCtx->audioCodecCtx->ch_layout,
+        job->pan.c_str(), bufferSrcCtxs.data(), &outputCtx->audioBufferFilterCtx);
+    if (mixer == nullptr) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < mixerInputs->size(); i++) {
+        inputCtxs[(*mixerInputs)[i]]->audioBufferFilterCtx = bufferSrcCtxs[i];
+    }
+
+    return mixer;
+}
+
+// The command thread outlives the mixer, runJob() clears this before freeing it
+static std::mutex commandMixerMutex;
+static AudioMixer* commandMixer = nullptr;
+
+// Reads "gain <input> <value>", "mute <input>" and "unmute <input>" lines from stdin,
+// inputs numbered from 1 in job order. Detached, since getline can't be interrupted.
+static void commandLoop(std::vector<size_t> mixerInputs) {
+    std::string line;
+    while (!shouldStop && std::getline(std::cin, line)) {
+        std::istringstream words(line);
+        std::string command;
+        size_t inputNumber = 0;
+        words >> command >> inputNumber;
+
+        const auto it = std::find(mixerInputs.begin(), mixerInputs.end(), inputNumber - 1);
+        const int input = it == mixerInputs.end() ? -1 : (int) (it - mixerInputs.begin());
+
+        std::lock_guard<std::mutex> lock(commandMixerMutex);
+        AudioMixer* mixer = commandMixer;
+        if (mixer == nullptr) {
+            break;
+        }
+
+        float gain;
+        bool applied;
+        if (command == "gain" && words >> gain) {
+            applied = audioMixerSetGain(mixer, input, gain);
+        } else if (command == "mute" || command == "unmute") {
+            applied = audioMixerSetMute(mixer, input, command == "mute");
+        } else {
+            std::cout << "Commands: gain <input> <value> | mute <input> | unmute <input>\n";
+            continue;
+        }
+
+        if (!applied) {
+            std::cout << "Ignored: " << line << "\n";
+        }
+    }
+}
+
+int runJob(JobConfig* job) {
+    avdevice_register_all();
+
+    // Destroyed in reverse: the exporter stops, then the mixer, the graph, the inputs
+    // and last the output go
+    OutputMediaPtr outputCtx;
+    std::vector<InputMediaPtr> inputOwners;
+    FilterGraphPtr videoGraph;
+    AudioMixerPtr audioMixer;
+    MetricsPtr metrics;
+    MetricsExporterPtr metricsExporter;
+
+    std::vector<MediaContext*> inputCtxs;
+    std::vector<std::pair<int, int>> inputSizes;
+    for (const JobInput& input : job->inputs) {
+        MediaContext* inputCtx = openInputMediaCtx(input.url.c_str(), input.format.empty() ? nullptr : input.format.c_str(),
+            input.frameRate);
+        if (inputCtx == nullptr) {
+            std::cout << "Failed to open input " << input.url << "\n";
+            return 1;
+        }
+        inputOwners.emplace_back(inputCtx);
+        if (job->hasRange && (isLiveInput(inputCtx) ||
+            !setInputRange(inputCtx, (int64_t) llround(job->startSeconds * AV_TIME_BASE), (int64_t) llround(job->endSeconds * AV_TIME_BASE)))) {
+            std::cout << "Can't seek in " << input.url << ", start and end need files\n";
+            return 1;
+        }
+
+        inputCtxs.push_back(inputCtx);
+        if (inputCtx->videoCodecCtx != nullptr) {
+            inputSizes.emplace_back(inputCtx->videoCodecCtx->width, inputCtx->videoCodecCtx->height);
+        } else {
+            inputSizes.emplace_back(0, 0);
+        }
+    }
+
+    const bool autoSize = job->width == 0;
+    if (!jobConfigResolve(job, inputSizes)) {
+        std::cout << "Failed to lay out the inputs\n";
+        return 1;
+    }
+    if (job->gridLayout) {
+        layoutGrid(job, inputCtxs, autoSize);
+    }
+    jobConfigLog(job);
+
+    bool hasAudio = false;
+    for (size_t i = 0; i < inputCtxs.size(); i++) {
+        hasAudio = hasAudio || (job->outputAudio && job->inputs[i].audio && inputCtxs[i]->audioCodecCtx != nullptr);
+    }
+
+    if (!job->ladder.empty()) {
+        prepareLadderSettings(&job->videoEncoder, &job->outputOptions, job->frameRate);
+    }
+
+    MediaParams videoParams = {
+        .width = job->width,
+        .height = job->height,
+        .frameRate = job->frameRate,
+        .codecName = job->videoCodec.empty() ? nullptr : job->videoCodec.c_str(),
+        .encoderSettings = &job->videoEncoder,
+    };
+    MediaParams audioParams = { .channels = job->audioChannels, .sampleRate = job->audioSampleRate };
+    outputCtx.reset(openOutputMediaCtx(job->output.c_str(), job->outputVideo ? &videoParams : nullptr,
+        hasAudio ? &audioParams : nullptr, &job->outputOptions));
+    if (outputCtx == nullptr || (job->outputVideo && outputCtx->videoCodecCtx == nullptr) || (!job->outputVideo && !hasAudio)) {
+        std::cout << "Failed to open output " << job->output << "\n";
+        return 1;
+    }
+    for (const std::string& sink : job->sinks) {
+        if (!addOutputSink(outputCtx.get(), sink.c_str())) {
+            std::cout << "Failed to open output sink " << sink << "\n";
+            return 1;
+        }
+    }
+    for (int height : job->ladder) {
+        if (!addRendition(outputCtx.get(), height, &videoParams)) {
+            return 1;
+        }
+    }
+
+    std::vector<size_t> mixerInputs;
+    if (job->outputVideo) {
+        videoGraph.reset(createFilterGraphForVideo(job, inputCtxs, outputCtx.get()));
+        if (videoGraph == nullptr) {
+            std::cout << "Failed to create video filter graph\n";
+            return 1;
+        }
+    }
+
+    if (hasAudio) {
+        audioMixer.reset(createAudioMixer(job, inputCtxs, outputCtx.get(), &mixerInputs));
+        if (audioMixer == nullptr) {
+            std::cout << "Failed to create audio mixer\n";
+            return 1;
+        }
+        outputCtx->audioMixer = audioMixer.get();
+        std::cout << "audio: " << audioMixerInputCount(audioMixer.get()) << " inputs, " << audioMixerModeName(audioMixer.get()) << "\n";
+
+        outputCtx->resampler = createAudioResampler(outputCtx.get());
+        if (outputCtx->resampler == nullptr) {
+            std::cout << "Failed to create audio resampler\n";
+            return 1;
+        }
+    }
+
+    if (job->videoEncoder.lowLatency) {
+        setLowLatencyMuxing(outputCtx.get());
+    }
+
+    // Write the headers of the output files and the sinks
+    if (writeOutputHeaders(outputCtx.get()) < 0) {
+        return 1;
+    }
+
+    if (job->metricsPort > 0 || !job->metricsFile.empty()) {
+        metrics.reset(metricsAlloc());
+        metricsExporter.reset(metricsExporterStart(metrics.get(), job->metricsPort, job->metricsFile.c_str()));
+        if (metricsExporter == nullptr) {
+            return 1;
+        }
+        outputCtx->metrics = metrics.get();
+    }
+
+    // Nothing returns early past this point, the command thread holds the mixer until
+    // it is cleared below
+    std::vector<PipelineInput> inputs;
+    for (size_t i = 0; i < inputCtxs.size(); i++) {
+        inputs.push_back({ inputCtxs[i], job->inputs[i].crop, job->inputs[i].maxStalenessUs });
+    }
+    if (audioMixer != nullptr) {
+        commandMixer = audioMixer.get();
+        std::thread(commandLoop, mixerInputs).detach();
+    }
+    const bool ran = runPipeline(inputs, outputCtx.get(), job->convertMode, job->syncInputs);
+
+    // Write the queued packets and the trailers, then flush the outputs; the exporter
+    // writes its file one last time with the final values
+    finishOutput(outputCtx.get());
+    metricsExporter.reset();
+    TRACE_WRITE();
+
+    {
+        std::lock_guard<std::mutex> lock(commandMixerMutex);
+        commandMixer = nullptr;
+    }
+    outputCtx->audioMixer = nullptr;
+
+    return ran ? 0 : 1;
+}
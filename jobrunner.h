@@ -0,0 +1,18 @@
+#ifndef JOBRUNNER_H
+#define JOBRUNNER_H
+
+#include "jobconfig.h"
+
+// Runs a job in this process: opens its inputs and outputs, composites the video of
+// every input (see compositor.h) and mixes their audio (see audiomixer.h), runs the
+// pipeline until the inputs end or shouldStop, then finishes the outputs. engine and
+// every recording program (hello, crop, merge, mergeaudio) is a JobConfig handed to it.
+//
+// While running, "gain <input> <value>", "mute <input>" and "unmute <input>" lines on
+// stdin change the audio mix, inputs numbered from 1 in job order.
+//
+// Returns the exit status of the program, 0 on success. Everything opened is freed on
+// every path, a job that fails halfway leaves nothing behind for the next one.
+int runJob(JobConfig* job);
+
+#endif
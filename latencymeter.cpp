@@ -0,0 +1,79 @@
+#include "latencymeter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// An hour of 60fps video without reallocating
+#define reservedSamples (60 * 60 * 60)
+
+int64_t latencyClockNow() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count() + 1;
+}
+
+void latencyStampFrame(AVFrame* frame, int64_t captureTime) {
+    frame->opaque = (void*) (intptr_t) captureTime;
+}
+
+int64_t latencyStampOf(const void* opaque) {
+    return (int64_t) (intptr_t) opaque;
+}
+
+void latencyMeterInit(LatencyMeter* meter) {
+    meter->samples.clear();
+    meter->samples.reserve(reservedSamples);
+}
+
+void latencyMeterAdd(LatencyMeter* meter, int64_t captureTime, int64_t now) {
+    if (captureTime > 0) {
+        meter->samples.push_back(now - captureTime);
+    }
+}
+
+static int64_t percentile(std::vector<int64_t>& sorted, int percent) {
+    const size_t index = std::min(sorted.size() - 1, sorted.size() * percent / 100);
+    return sorted[index];
+}
+
+void latencyMeterLog(LatencyMeter* meter, const char* name) {
+    if (meter->samples.empty()) {
+        std::cout << name << " latency: no stamped packets\n";
+        return;
+    }
+
+    std::vector<int64_t>& samples = meter->samples;
+    std::sort(samples.begin(), samples.end());
+
+    const size_t overBudget = samples.end() - std::upper_bound(samples.begin(), samples.end(), (int64_t) latencyBudgetUs);
+
+    std::cout << name << " latency: p50 " << percentile(samples, 50) / 1000.0
+        << " ms, p99 " << percentile(samples, 99) / 1000.0
+        << " ms, max " << samples.back() / 1000.0
+        << " ms, " << overBudget << "/" << samples.size() << " over " << latencyBudgetUs / 1000 << " ms\n";
+}
+
+void stageStatsInit(StageStats* stats) {
+    stats->frames = 0;
+    stats->busyUs = 0;
+}
+
+int64_t stageStatsAdd(StageStats* stats, int64_t startTime) {
+    const int64_t elapsed = latencyClockNow() - startTime;
+    stats->busyUs += elapsed;
+    stats->frames++;
+    return elapsed;
+}
+
+void stageStatsAddFrames(StageStats* stats, int64_t startTime, int64_t frames) {
+    stats->busyUs += latencyClockNow() - startTime;
+    stats->frames += frames;
+}
+
+void stageStatsLog(const StageStats* stats, const char* name) {
+    if (stats->frames == 0) {
+        return;
+    }
+    std::cout << "stage " << name << ": " << stats->frames << " frames, "
+        << stats->busyUs / 1000.0 / stats->frames << " ms/frame\n";
+}
@@ -0,0 +1,51 @@
+#ifndef LATENCYMETER_H
+#define LATENCYMETER_H
+
+#include <cstdint>
+#include <vector>
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Capture-to-output latency. Frames are stamped with the time their packet was read
+// from the input; the stamp rides in AVFrame.opaque (and AVPacket.opaque once the
+// encoder copies it), and the meter collects now - stamp when the packet is written.
+// Not thread-safe, one meter per recording thread.
+
+#define latencyBudgetUs 100000
+
+// Microseconds on the steady clock, never 0
+int64_t latencyClockNow();
+
+void latencyStampFrame(AVFrame* frame, int64_t captureTime);
+// 0 when the frame or packet carries no stamp
+int64_t latencyStampOf(const void* opaque);
+
+typedef struct LatencyMeter {
+    std::vector<int64_t> samples;   // microseconds
+} LatencyMeter;
+
+void latencyMeterInit(LatencyMeter* meter);
+void latencyMeterAdd(LatencyMeter* meter, int64_t captureTime, int64_t now);
+
+// p50, p99, max and how many samples went over latencyBudgetUs
+void latencyMeterLog(LatencyMeter* meter, const char* name);
+
+// Time spent inside one stage (decode, convert, filter, encode), per frame. Each stage
+// is recorded by a single thread and logged once that thread is done.
+typedef struct StageStats {
+    int64_t frames;
+    int64_t busyUs;
+} StageStats;
+
+void stageStatsInit(StageStats* stats);
+// One frame that entered the stage at startTime (latencyClockNow()) and left it now,
+// returns the microseconds it spent there
+int64_t stageStatsAdd(StageStats* stats, int64_t startTime);
+// A pass over several frames at once
+void stageStatsAddFrames(StageStats* stats, int64_t startTime, int64_t frames);
+
+// "stage <name>: <frames> frames, <ms> ms/frame", the line bench/pipelinebench reads
+void stageStatsLog(const StageStats* stats, const char* name);
+
+#endif
@@ -0,0 +1,470 @@
+#include "mediacontext.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavutil/channel_layout.h>
+}
+
+static const AVRational videoEncoderTimeBase = av_make_q(1, 1000);
+static const AVRational videoContainerTimeBase = av_make_q(1, 16000);
+
+MediaContext* openInputMediaCtx(const char* url, const char* formatName, int frameRate) {
+    MediaContext* mediaCtx = (MediaContext*) calloc(1, sizeof(MediaContext));
+
+    // Screen capture options only apply to the capture device, files and lavfi
+    // sources (e.g. "testsrc2=size=1920x1080:rate=30[out0];sine[out1]") ignore them
+    AVDictionary* options = nullptr;
+    if (formatName != nullptr && strcmp(formatName, defaultInputFormat) == 0) {
+        av_dict_set(&options, "framerate", std::to_string(frameRate).c_str(), 0);
+        av_dict_set(&options, "pixel_format", inputPixelFormat, 0);
+        av_dict_set(&options, "capture_cursor", "1", 0);
+    }
+
+    // Open screen capture input, or probe the format when none is given
+    const AVInputFormat* inputFormat = nullptr;
+    if (formatName != nullptr) {
+        inputFormat = av_find_input_format(formatName);
+    }
+
+    snprintf(mediaCtx->filename, sizeof(mediaCtx->filename), "%s", url);
+    const int ret = avformat_open_input(&mediaCtx->formatCtx, mediaCtx->filename, inputFormat, &options);
+    av_dict_free(&options);
+    if (ret < 0 || avformat_find_stream_info(mediaCtx->formatCtx, nullptr) < 0) {
+        closeInputMediaCtx(&mediaCtx);
+        return nullptr;
+    }
+
+    int videoStreamIdx = av_find_best_stream(mediaCtx->formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoStreamIdx >= 0) {
+        mediaCtx->videoIndex = videoStreamIdx;
+        mediaCtx->videoStream = mediaCtx->formatCtx->streams[videoStreamIdx];
+        mediaCtx->videoCodec = const_cast<AVCodec*>(avcodec_find_decoder(mediaCtx->videoStream->codecpar->codec_id));
+        mediaCtx->videoCodecCtx = avcodec_alloc_context3(mediaCtx->videoCodec);
+        mediaCtx->videoCodecCtx->time_base = mediaCtx->videoStream->time_base;
+        mediaCtx->frameRate = av_guess_frame_rate(mediaCtx->formatCtx, mediaCtx->videoStream, nullptr);
+
+        avcodec_parameters_to_context(mediaCtx->videoCodecCtx, mediaCtx->videoStream->codecpar);
+        if (avcodec_open2(mediaCtx->videoCodecCtx, mediaCtx->videoCodec, nullptr) < 0) {
+            closeInputMediaCtx(&mediaCtx);
+            return nullptr;
+        }
+    }
+
+    int audioStreamIdx = av_find_best_stream(mediaCtx->formatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (audioStreamIdx >= 0) {
+        mediaCtx->audioIndex = audioStreamIdx;
+        mediaCtx->audioStream = mediaCtx->formatCtx->streams[audioStreamIdx];
+        mediaCtx->audioCodec = const_cast<AVCodec*>(avcodec_find_decoder(mediaCtx->audioStream->codecpar->codec_id));
+        mediaCtx->audioCodecCtx = avcodec_alloc_context3(mediaCtx->audioCodec);
+        mediaCtx->audioCodecCtx->time_base = mediaCtx->audioStream->time_base;
+
+        avcodec_parameters_to_context(mediaCtx->audioCodecCtx, mediaCtx->audioStream->codecpar);
+        if (avcodec_open2(mediaCtx->audioCodecCtx, mediaCtx->audioCodec, nullptr) < 0) {
+            closeInputMediaCtx(&mediaCtx);
+            return nullptr;
+        }
+    }
+
+    return mediaCtx;
+}
+
+bool isLiveInput(const MediaContext* inputCtx) {
+    const AVInputFormat* inputFormat = inputCtx->formatCtx->iformat;
+    // lavfi is a device to libavdevice, but it generates frames on demand
+    if (strcmp(inputFormat->name, "lavfi") == 0) {
+        return false;
+    }
+    return inputFormat->priv_class != nullptr && AV_IS_INPUT_DEVICE(inputFormat->priv_class->category);
+}
+
+bool setInputRange(MediaContext* inputCtx, int64_t startUs, int64_t endUs) {
+    const int64_t firstTime = inputCtx->formatCtx->start_time != AV_NOPTS_VALUE ? inputCtx->formatCtx->start_time : 0;
+
+    inputCtx->hasRange = true;
+    inputCtx->rangeStart = firstTime + startUs;
+    inputCtx->rangeEnd = endUs > 0 ? firstTime + endUs : 0;
+
+    // The last keyframe at or before the start
+    if (avformat_seek_file(inputCtx->formatCtx, -1, INT64_MIN, inputCtx->rangeStart, inputCtx->rangeStart, 0) < 0) {
+        return false;
+    }
+    if (inputCtx->videoCodecCtx != nullptr) {
+        avcodec_flush_buffers(inputCtx->videoCodecCtx);
+    }
+    if (inputCtx->audioCodecCtx != nullptr) {
+        avcodec_flush_buffers(inputCtx->audioCodecCtx);
+    }
+    return true;
+}
+
+static void prepareVideoCodec(MediaContext* mediaCtx, MediaParams* params) {
+    if (params->codecName != nullptr) {
+        mediaCtx->videoCodec = const_cast<AVCodec*>(avcodec_find_encoder_by_name(params->codecName));
+    } else {
+        mediaCtx->videoCodec = const_cast<AVCodec*>(avcodec_find_encoder(outputMediaFormat(mediaCtx->formatCtx)->video_codec));
+    }
+    if (mediaCtx->videoCodec == nullptr) {
+        return;
+    }
+
+    mediaCtx->videoStream = avformat_new_stream(mediaCtx->formatCtx, mediaCtx->videoCodec);
+    if (mediaCtx->videoStream == nullptr) {
+        return;
+    }
+
+    mediaCtx->videoCodecCtx = avcodec_alloc_context3(mediaCtx->videoCodec);
+    if (mediaCtx->videoCodecCtx == nullptr) {
+        return;
+    }
+
+    mediaCtx->videoIndex = mediaCtx->videoStream->index;
+    mediaCtx->frameRate = av_make_q(params->frameRate, 1);
+    mediaCtx->videoCodecCtx->width = params->width;
+    mediaCtx->videoCodecCtx->height = params->height;
+    mediaCtx->videoCodecCtx->sample_aspect_ratio = av_make_q(0, 1);
+    mediaCtx->videoCodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+    mediaCtx->videoCodecCtx->framerate = mediaCtx->frameRate;
+    mediaCtx->videoCodecCtx->time_base = videoEncoderTimeBase;
+    mediaCtx->videoStream->time_base = videoContainerTimeBase;
+
+    if (params->bitRate > 0) {
+        mediaCtx->videoCodecCtx->bit_rate = params->bitRate;
+    }
+    if (params->encoderSettings != nullptr) {
+        encoderSettingsApply(params->encoderSettings, mediaCtx->videoCodecCtx);
+    }
+
+    // Fragments and segments only start on keyframes
+    const int keyframeInterval = outputKeyframeInterval(&mediaCtx->outputOptions, params->frameRate);
+    if (keyframeInterval > 0 && (params->encoderSettings == nullptr || params->encoderSettings->gopSize == 0)) {
+        mediaCtx->videoCodecCtx->gop_size = keyframeInterval;
+    }
+
+#ifdef AV_CODEC_FLAG_COPY_OPAQUE
+    // Packets carry the capture stamp of their frame, see latencymeter.h
+    mediaCtx->videoCodecCtx->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif
+
+    // Left without a codec context, the caller sees the stream failed
+    if (avcodec_open2(mediaCtx->videoCodecCtx, mediaCtx->videoCodec, nullptr) < 0) {
+        avcodec_free_context(&mediaCtx->videoCodecCtx);
+        return;
+    }
+    encoderSettingsLog(mediaCtx->videoCodecCtx);
+
+    avcodec_parameters_from_context(mediaCtx->videoStream->codecpar, mediaCtx->videoCodecCtx);
+}
+
+static void prepareAudioCodec(MediaContext* mediaCtx, MediaParams* params) {
+    if (params->codecName != nullptr) {
+        mediaCtx->audioCodec = const_cast<AVCodec*>(avcodec_find_encoder_by_name(params->codecName));
+    } else {
+        mediaCtx->audioCodec = const_cast<AVCodec*>(avcodec_find_encoder(outputMediaFormat(mediaCtx->formatCtx)->audio_codec));
+    }
+    if (mediaCtx->audioCodec == nullptr) {
+        return;
+    }
+
+    mediaCtx->audioStream = avformat_new_stream(mediaCtx->formatCtx, mediaCtx->audioCodec);
+    if (mediaCtx->audioStream == nullptr) {
+        return;
+    }
+
+    mediaCtx->audioCodecCtx = avcodec_alloc_context3(mediaCtx->audioCodec);
+    if (mediaCtx->audioCodecCtx == nullptr) {
+        return;
+    }
+
+    AVChannelLayout channelLayout;
+    av_channel_layout_default(&channelLayout, params->channels);
+
+    mediaCtx->audioIndex = mediaCtx->audioStream->index;
+    mediaCtx->audioCodecCtx->ch_layout = channelLayout;
+    mediaCtx->audioCodecCtx->sample_rate = params->sampleRate;
+    mediaCtx->audioCodecCtx->sample_fmt = mediaCtx->audioCodec->sample_fmts[0];
+    mediaCtx->audioCodecCtx->time_base = av_make_q(1, params->sampleRate);
+    mediaCtx->audioStream->time_base = av_make_q(1, params->sampleRate);
+
+    if (params->bitRate > 0) {
+        mediaCtx->audioCodecCtx->bit_rate = params->bitRate;
+    }
+
+    if (avcodec_open2(mediaCtx->audioCodecCtx, mediaCtx->audioCodec, nullptr) < 0) {
+        avcodec_free_context(&mediaCtx->audioCodecCtx);
+        return;
+    }
+
+    avcodec_parameters_from_context(mediaCtx->audioStream->codecpar, mediaCtx->audioCodecCtx);
+}
+
+MediaContext* openOutputMediaCtx(const char* filename, MediaParams* videoParams, MediaParams* audioParams, const OutputOptions* outputOptions) {
+    MediaContext* mediaCtx = (MediaContext*) calloc(1, sizeof(MediaContext));
+    mediaCtx->framePool = framePoolAlloc();
+    if (outputOptions != nullptr) {
+        mediaCtx->outputOptions = *outputOptions;
+    } else {
+        outputOptionsInit(&mediaCtx->outputOptions);
+    }
+
+    snprintf(mediaCtx->filename, sizeof(mediaCtx->filename), "%s", filename);
+    if (outputAllocContext(&mediaCtx->formatCtx, filename, &mediaCtx->outputOptions) < 0) {
+        closeOutputMediaCtx(&mediaCtx);
+        return nullptr;
+    }
+
+    // Opens the output file too, unless the segment muxer opens its own
+    mediaCtx->writer = outputWriterOpen(mediaCtx->formatCtx, &mediaCtx->outputOptions);
+    if (mediaCtx->writer == nullptr) {
+        closeOutputMediaCtx(&mediaCtx);
+        return nullptr;
+    }
+
+    if (videoParams != nullptr) {
+        prepareVideoCodec(mediaCtx, videoParams);
+    }
+
+    if (audioParams != nullptr) {
+        prepareAudioCodec(mediaCtx, audioParams);
+    }
+
+    return mediaCtx;
+}
+
+void closeInputMediaCtx(MediaContext** mediaCtx) {
+    if (*mediaCtx == nullptr) {
+        return;
+    }
+
+    avcodec_free_context(&(*mediaCtx)->videoCodecCtx);
+    avcodec_free_context(&(*mediaCtx)->audioCodecCtx);
+    avformat_close_input(&(*mediaCtx)->formatCtx);
+
+    free(*mediaCtx);
+    *mediaCtx = nullptr;
+}
+
+void closeOutputMediaCtx(MediaContext** mediaCtx) {
+    if (*mediaCtx == nullptr) {
+        return;
+    }
+
+    avcodec_free_context(&(*mediaCtx)->videoCodecCtx);
+    avcodec_free_context(&(*mediaCtx)->audioCodecCtx);
+    outputWriterClose(&(*mediaCtx)->writer);
+    for (int i = 0; i < (*mediaCtx)->sinkCount; i++) {
+        outputSinkClose(&(*mediaCtx)->sinks[i]);
+    }
+    for (int i = 0; i < (*mediaCtx)->renditionCount; i++) {
+        closeOutputMediaCtx(&(*mediaCtx)->renditions[i]);
+    }
+    avformat_free_context((*mediaCtx)->formatCtx);
+    streamResamplerFree(&(*mediaCtx)->resampler);
+    framePoolFree(&(*mediaCtx)->framePool);
+
+    free(*mediaCtx);
+    *mediaCtx = nullptr;
+}
+
+StreamResampler* createAudioResampler(MediaContext* outputCtx) {
+    AVChannelLayout sinkChLayout;
+    if (av_buffersink_get_ch_layout(outputCtx->audioBufferFilterCtx, &sinkChLayout) < 0) {
+        return nullptr;
+    }
+
+    StreamResamplerParams params;
+    params.inChLayout = &sinkChLayout;
+    params.inSampleFormat = (AVSampleFormat) av_buffersink_get_format(outputCtx->audioBufferFilterCtx);
+    params.inSampleRate = av_buffersink_get_sample_rate(outputCtx->audioBufferFilterCtx);
+    params.outChLayout = &outputCtx->audioCodecCtx->ch_layout;
+    params.outSampleFormat = outputCtx->audioCodecCtx->sample_fmt;
+    params.outSampleRate = outputCtx->audioCodecCtx->sample_rate;
+    params.frameSize = outputCtx->audioCodecCtx->frame_size;
+    params.maxInputSamples = 4096;
+
+    StreamResampler* resampler = streamResamplerAlloc(&params, outputCtx->framePool);
+    av_channel_layout_uninit(&sinkChLayout);
+
+    return resampler;
+}
+
+bool addOutputSink(MediaContext* outputCtx, const char* spec) {
+    if (outputCtx->sinkCount >= maxOutputSinks) {
+        std::cout << "At most " << maxOutputSinks << " output sinks\n";
+        return false;
+    }
+
+    OutputSink* sink = outputSinkOpen(spec, outputCtx->formatCtx);
+    if (sink == nullptr) {
+        return false;
+    }
+    outputCtx->sinks[outputCtx->sinkCount++] = sink;
+    return true;
+}
+
+void prepareLadderSettings(EncoderSettings* settings, const OutputOptions* outputOptions, int frameRate) {
+    if (settings->gopSize == 0) {
+        const int keyframeInterval = outputKeyframeInterval(outputOptions, frameRate);
+        settings->gopSize = keyframeInterval > 0 ? keyframeInterval : frameRate * ladderGopSeconds;
+    }
+    settings->fixedGop = true;
+}
+
+// "out.mp4" -> "out_480p.mp4"
+static std::string renditionFilename(const char* filename, int height) {
+    const std::string name = filename;
+    const size_t slash = name.find_last_of('/');
+    const size_t dot = name.find_last_of('.');
+    const size_t split = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : name.size();
+    return name.substr(0, split) + "_" + std::to_string(height) + "p" + name.substr(split);
+}
+
+bool addRendition(MediaContext* outputCtx, int height, const MediaParams* videoParams) {
+    if (outputCtx->renditionCount >= maxRenditions) {
+        std::cout << "At most " << maxRenditions << " renditions\n";
+        return false;
+    }
+    if (outputCtx->videoCodecCtx == nullptr) {
+        return false;
+    }
+
+    MediaParams params = *videoParams;
+    params.height = height;
+    params.width = compositorLadderWidth(videoParams->width, videoParams->height, height);
+    const double pixelShare = (double) params.width * params.height / ((double) videoParams->width * videoParams->height);
+
+    EncoderSettings settings;
+    if (videoParams->encoderSettings != nullptr) {
+        settings = *videoParams->encoderSettings;
+    } else {
+        encoderSettingsInit(&settings);
+    }
+    // The same bits per pixel, and cores in proportion to the work
+    params.bitRate = (int64_t) (params.bitRate * pixelShare);
+    settings.bitRate = (int64_t) (settings.bitRate * pixelShare);
+    if (settings.threadCount == 0) {
+        settings.threadCount = std::max(1, (int) lround(encoderDefaultThreadCount(settings.threadType) * pixelShare));
+    }
+    settings.gopSize = outputCtx->videoCodecCtx->gop_size;
+    settings.fixedGop = true;
+    params.encoderSettings = &settings;
+
+    const std::string filename = renditionFilename(outputCtx->filename, height);
+    MediaContext* rendition = openOutputMediaCtx(filename.c_str(), &params, nullptr, &outputCtx->outputOptions);
+    if (rendition == nullptr || rendition->videoCodecCtx == nullptr || !avcodec_is_open(rendition->videoCodecCtx)) {
+        std::cout << "Failed to open rendition " << filename << "\n";
+        closeOutputMediaCtx(&rendition);
+        return false;
+    }
+
+    // The main output's audio, packets are shared rather than encoded again
+    if (outputCtx->audioStream != nullptr) {
+        AVStream* stream = avformat_new_stream(rendition->formatCtx, nullptr);
+        if (stream == nullptr || avcodec_parameters_copy(stream->codecpar, outputCtx->audioStream->codecpar) < 0) {
+            closeOutputMediaCtx(&rendition);
+            return false;
+        }
+        stream->time_base = outputCtx->audioStream->time_base;
+        rendition->audioStream = stream;
+        rendition->audioIndex = stream->index;
+    }
+
+    std::cout << "rendition: " << filename << " " << params.width << "x" << params.height << "\n";
+    outputCtx->renditions[outputCtx->renditionCount++] = rendition;
+    return true;
+}
+
+int writeOutputHeaders(MediaContext* outputCtx) {
+    int ret = outputWriteHeader(outputCtx->formatCtx, &outputCtx->outputOptions);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (int i = 0; i < outputCtx->renditionCount; i++) {
+        ret = writeOutputHeaders(outputCtx->renditions[i]);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    for (int i = 0; i < outputCtx->sinkCount; ) {
+        OutputSink* sink = outputCtx->sinks[i];
+        if (outputWriteHeader(sink->formatCtx, &sink->options) < 0) {
+            std::cout << "Failed to write the header of " << sink->url << ", leaving it out\n";
+            outputSinkClose(&outputCtx->sinks[i]);
+            outputCtx->sinks[i] = outputCtx->sinks[--outputCtx->sinkCount];
+            continue;
+        }
+        i++;
+    }
+    return 0;
+}
+
+void finishOutput(MediaContext* outputCtx) {
+    // Renditions and sinks first, the main file's trailer may take a while
+    for (int i = 0; i < outputCtx->renditionCount; i++) {
+        finishOutput(outputCtx->renditions[i]);
+    }
+
+    for (int i = 0; i < outputCtx->sinkCount; i++) {
+        outputWriterFinish(outputCtx->sinks[i]->writer);
+    }
+    outputWriterFinish(outputCtx->writer);
+
+    outputWriterLog(outputCtx->writer);
+    for (int i = 0; i < outputCtx->sinkCount; i++) {
+        outputWriterLog(outputCtx->sinks[i]->writer);
+    }
+}
+
+static void setLowLatencyFormat(AVFormatContext* formatCtx) {
+    // Write every packet as it comes instead of waiting to interleave it with the other stream
+    formatCtx->max_interleave_delta = 1;
+    formatCtx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+    formatCtx->flush_packets = 1;
+}
+
+void setLowLatencyMuxing(MediaContext* outputCtx) {
+    setLowLatencyFormat(outputCtx->formatCtx);
+    for (int i = 0; i < outputCtx->sinkCount; i++) {
+        setLowLatencyFormat(outputCtx->sinks[i]->formatCtx);
+    }
+    for (int i = 0; i < outputCtx->renditionCount; i++) {
+        setLowLatencyMuxing(outputCtx->renditions[i]);
+    }
+}
+
+// A new reference of a main output audio packet, renumbered for the rendition
+static void writeRenditionAudio(MediaContext* rendition, const AVPacket* packet, AVRational timeBase) {
+    AVPacket* ref = av_packet_clone(packet);
+    if (ref == nullptr) {
+        return;
+    }
+
+    ref->stream_index = rendition->audioIndex;
+    av_packet_rescale_ts(ref, timeBase, rendition->audioStream->time_base);
+    outputWriterWrite(rendition->writer, ref);
+    av_packet_free(&ref);
+}
+
+void writePacket(MediaContext* outputCtx, std::mutex* muxMutex, AVPacket* packet, int streamIndex, AVCodecContext* codecCtx, AVStream* stream) {
+    packet->stream_index = streamIndex;
+    av_packet_rescale_ts(packet, codecCtx->time_base, stream->time_base);
+
+    // Only needed when the writer muxes on the calling thread
+    std::lock_guard<std::mutex> lock(*muxMutex);
+    for (int i = 0; i < outputCtx->sinkCount; i++) {
+        outputSinkWrite(outputCtx->sinks[i], packet, stream->time_base);
+    }
+    if (codecCtx == outputCtx->audioCodecCtx) {
+        for (int i = 0; i < outputCtx->renditionCount; i++) {
+            writeRenditionAudio(outputCtx->renditions[i], packet, stream->time_base);
+        }
+    }
+    outputWriterWrite(outputCtx->writer, packet);
+}
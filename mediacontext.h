@@ -0,0 +1,146 @@
+#ifndef MEDIACONTEXT_H
+#define MEDIACONTEXT_H
+
+#include <memory>
+#include <mutex>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+}
+
+#include "audiomixer.h"
+#include "compositor.h"
+#include "encodersettings.h"
+#include "framepool.h"
+#include "metrics.h"
+#include "outputformat.h"
+#include "outputsink.h"
+#include "outputwriter.h"
+#include "resampler.h"
+#include "videoconvert.h"
+
+#define inputPixelFormat "uyvy422"
+#define ladderGopSeconds 2
+#define defaultInputFormat "avfoundation"
+
+typedef struct MediaParams {
+    AVCodecID codecId;
+    AVMediaType mediaType;
+    int width;
+    int height;
+    int channels;
+    int frameRate;
+    int sampleRate;
+    const char* codecName;      // encoder by name, nullptr for the muxer's default
+    int64_t bitRate;            // 0 leaves the encoder default
+    const EncoderSettings* encoderSettings;     // video only, nullptr leaves the encoder defaults
+} MediaParams;
+
+typedef struct MediaContext {
+  char filename[512];
+  AVFormatContext *formatCtx;
+
+  int videoIndex;
+  AVCodec* videoCodec;
+  AVStream* videoStream;
+  AVCodecContext* videoCodecCtx;
+  AVFilterContext *videoBufferFilterCtx;
+  AVRational frameRate;
+  bool hasRange;                // input only, see setInputRange()
+  int64_t rangeStart;           // source microseconds
+  int64_t rangeEnd;             // 0 for the end of the input
+
+  int audioIndex;
+  AVCodec* audioCodec;
+  AVStream* audioStream;
+  AVCodecContext* audioCodecCtx;
+  AVFilterContext *audioBufferFilterCtx;
+  StreamResampler* resampler;
+  AudioMixer* audioMixer;       // not owned, its gain/mute commands are applied by the filter thread
+  Metrics* metrics;             // output only, not owned, runPipeline() publishes to it
+
+  FramePool* framePool;
+  OutputOptions outputOptions;  // output only
+  OutputWriter* writer;         // output only, muxes and writes the packets
+  OutputSink* sinks[maxOutputSinks];    // output only, more muxers fed the same packets
+  int sinkCount;
+  struct MediaContext* renditions[maxRenditions];   // output only, the ABR ladder below this output
+  int renditionCount;
+} MediaContext;
+
+// frameRate and the uyvy422 pixel format are only requested from the avfoundation
+// capture device. runPipeline() converts the decoded video (see frameconvert.h).
+MediaContext* openInputMediaCtx(const char* url, const char* formatName, int frameRate);
+
+// Capture devices run in real time and can't wait for the pipeline, files and lavfi
+// sources are read only as fast as it takes their frames
+bool isLiveInput(const MediaContext* inputCtx);
+
+// Offline inputs only: decodes [startUs, endUs) of the input, counted from its first
+// timestamp, endUs 0 for the rest of it. Seeks to the keyframe at or before startUs;
+// the pipeline drops whatever decodes outside the range, cuts audio frames straddling
+// its edges to the sample and anchors the input's timeline at startUs, so the range
+// starts at 0 in the output.
+bool setInputRange(MediaContext* inputCtx, int64_t startUs, int64_t endUs);
+
+// Either params may be nullptr to leave that stream out. outputOptions nullptr writes a
+// single file. Add sinks, then writeOutputHeaders() ... finishOutput().
+MediaContext* openOutputMediaCtx(const char* filename, MediaParams* videoParams, MediaParams* audioParams, const OutputOptions* outputOptions);
+
+// Another muxer fed from the same encoders, see outputsink.h. Call before
+// setLowLatencyMuxing() and writeOutputHeaders().
+bool addOutputSink(MediaContext* outputCtx, const char* spec);
+
+// ABR ladder. The composited canvas is split once in the filter graph and scaled to
+// every rendition (see compositorCreateLadderGraph()), so capture, decode and composite
+// are paid once however many renditions there are. Each rendition is a file of its own
+// with its own video encoder thread; its audio is the main output's, every audio packet
+// reaches it as a new reference. Renditions are named after the main file,
+// "out.mp4" -> "out_480p.mp4".
+//
+// Players switch renditions at keyframes, so all of them must have theirs at the same
+// frames: call prepareLadderSettings() on the settings of the main output before opening
+// it, addRendition() copies its gop.
+
+// A fixed gop: gopSize, or the fragment/segment keyframe interval, or ladderGopSeconds
+void prepareLadderSettings(EncoderSettings* settings, const OutputOptions* outputOptions, int frameRate);
+
+// A rendition height pixels high, keeping the aspect of videoParams, the main output's
+// params. Bitrate and encoder threads are scaled by the rendition's share of the pixels.
+// Call after the main output is open and before writeOutputHeaders().
+bool addRendition(MediaContext* outputCtx, int height, const MediaParams* videoParams);
+
+// A sink whose header fails is closed and the recording goes on without it
+int writeOutputHeaders(MediaContext* outputCtx);
+
+// Writes the queued packets and the trailers, flushes the files and logs the writers
+void finishOutput(MediaContext* outputCtx);
+
+void closeInputMediaCtx(MediaContext** mediaCtx);
+void closeOutputMediaCtx(MediaContext** mediaCtx);
+
+// Owners for code that can return early, see avhandles.h
+struct InputMediaCloser {
+    void operator()(MediaContext* mediaCtx) const { closeInputMediaCtx(&mediaCtx); }
+};
+
+struct OutputMediaCloser {
+    void operator()(MediaContext* mediaCtx) const { closeOutputMediaCtx(&mediaCtx); }
+};
+
+typedef std::unique_ptr<MediaContext, InputMediaCloser> InputMediaPtr;
+typedef std::unique_ptr<MediaContext, OutputMediaCloser> OutputMediaPtr;
+
+// Converts the mixed audio coming out of the filter graph into encoder sized frames
+StreamResampler* createAudioResampler(MediaContext* outputCtx);
+
+// Packets go to the output as soon as they are written, see EncoderSettings.lowLatency
+// for the encoder side. Call before avformat_write_header().
+void setLowLatencyMuxing(MediaContext* outputCtx);
+
+// Hands the packet to outputCtx->writer, which takes its reference, and a reference of
+// it to every sink; audio packets also to every rendition
+void writePacket(MediaContext* outputCtx, std::mutex* muxMutex, AVPacket* packet, int streamIndex, AVCodecContext* codecCtx, AVStream* stream);
+
+#endif
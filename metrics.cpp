@@ -0,0 +1,348 @@
+#include "metrics.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// How late the listener notices metricsExporterStop(), and how long a client may take
+// to send its request
+#define metricsPollTimeoutMs 200
+#define metricsRequestTimeoutMs 1000
+
+struct Metric {
+    MetricType type;
+    std::string name;
+    std::string labels;
+    std::string help;
+    double scale;
+    std::atomic<int64_t> value;     // the sum of a summary
+    std::atomic<int64_t> count;     // summaries only
+};
+
+// A deque, so registering never moves the metrics the pipeline points at
+struct Metrics {
+    std::mutex mutex;
+    std::deque<Metric> series;
+    int64_t startTime;
+};
+
+static int64_t metricsClockNow() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+Metrics* metricsAlloc() {
+    Metrics* metrics = new Metrics();
+    metrics->startTime = metricsClockNow();
+    return metrics;
+}
+
+void metricsFree(Metrics** metrics) {
+    delete *metrics;
+    *metrics = nullptr;
+}
+
+Metric* metricsAdd(Metrics* metrics, MetricType type, const char* name, const char* labels, const char* help, double scale) {
+    std::lock_guard<std::mutex> lock(metrics->mutex);
+    metrics->series.emplace_back();
+    Metric* metric = &metrics->series.back();
+    metric->type = type;
+    metric->name = name;
+    metric->labels = labels != nullptr ? labels : "";
+    metric->help = help;
+    metric->scale = scale > 0 ? scale : 1;
+    metric->value.store(0, std::memory_order_relaxed);
+    metric->count.store(0, std::memory_order_relaxed);
+    return metric;
+}
+
+void metricAdd(Metric* metric, int64_t delta) {
+    if (metric != nullptr) {
+        metric->value.fetch_add(delta, std::memory_order_relaxed);
+    }
+}
+
+void metricSet(Metric* metric, int64_t value) {
+    if (metric != nullptr) {
+        metric->value.store(value, std::memory_order_relaxed);
+    }
+}
+
+void metricObserve(Metric* metric, int64_t value) {
+    if (metric != nullptr) {
+        metric->value.fetch_add(value, std::memory_order_relaxed);
+        metric->count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int64_t metricGet(const Metric* metric) {
+    return metric != nullptr ? metric->value.load(std::memory_order_relaxed) : 0;
+}
+
+std::string metricLabel(const char* name, const std::string& value) {
+    std::string label = std::string(name) + "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            label += '\\';
+            label += c;
+        } else if (c == '\n') {
+            label += "\\n";
+        } else {
+            label += c;
+        }
+    }
+    return label + "\"";
+}
+
+static const char* metricTypeName(MetricType type) {
+    switch (type) {
+    case METRIC_COUNTER: return "counter";
+    case METRIC_GAUGE: return "gauge";
+    case METRIC_SUMMARY: return "summary";
+    }
+    return "untyped";
+}
+
+static void renderSample(std::string* text, const std::string& name, const char* suffix, const std::string& labels, int64_t value, double scale) {
+    char number[32];
+    if (scale == 1) {
+        snprintf(number, sizeof(number), "%lld", (long long) value);
+    } else {
+        snprintf(number, sizeof(number), "%.6f", value / scale);
+    }
+
+    *text += name;
+    *text += suffix;
+    if (!labels.empty()) {
+        *text += "{" + labels + "}";
+    }
+    *text += " ";
+    *text += number;
+    *text += "\n";
+}
+
+void metricsRender(Metrics* metrics, std::string* text) {
+    std::lock_guard<std::mutex> lock(metrics->mutex);
+    text->clear();
+
+    // Families in the order their first series was added, each with its HELP and TYPE once
+    std::vector<bool> rendered(metrics->series.size(), false);
+    for (size_t i = 0; i < metrics->series.size(); i++) {
+        if (rendered[i]) {
+            continue;
+        }
+
+        const Metric& family = metrics->series[i];
+        *text += "# HELP " + family.name + " " + family.help + "\n";
+        *text += "# TYPE " + family.name + " " + metricTypeName(family.type) + "\n";
+        for (size_t j = i; j < metrics->series.size(); j++) {
+            const Metric& metric = metrics->series[j];
+            if (rendered[j] || metric.name != family.name) {
+                continue;
+            }
+
+            const int64_t value = metric.value.load(std::memory_order_relaxed);
+            if (metric.type == METRIC_SUMMARY) {
+                renderSample(text, metric.name, "_sum", metric.labels, value, metric.scale);
+                renderSample(text, metric.name, "_count", metric.labels, metric.count.load(std::memory_order_relaxed), 1);
+            } else {
+                renderSample(text, metric.name, "", metric.labels, value, metric.scale);
+            }
+            rendered[j] = true;
+        }
+    }
+
+    *text += "# HELP capture_uptime_seconds Time since the recording started\n";
+    *text += "# TYPE capture_uptime_seconds gauge\n";
+    renderSample(text, "capture_uptime_seconds", "", "", metricsClockNow() - metrics->startTime, 1000000);
+}
+
+struct MetricsExporter {
+    Metrics* metrics;
+    int listenFd;               // -1 without a port
+    std::string path;           // "" without a file
+    std::thread serveThread;
+    std::thread fileThread;
+
+    std::mutex stopMutex;
+    std::condition_variable stopChanged;
+    std::atomic<bool> stopping;
+};
+
+static void writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+// One request per connection, then the connection is closed
+static void serveRequest(Metrics* metrics, int fd) {
+    const struct timeval timeout = { metricsRequestTimeoutMs / 1000, (metricsRequestTimeoutMs % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[metricsMaxRequestBytes + 1];
+    size_t size = 0;
+    while (size < metricsMaxRequestBytes) {
+        const ssize_t received = read(fd, request + size, metricsMaxRequestBytes - size);
+        if (received <= 0) {
+            break;
+        }
+        size += received;
+        request[size] = '\0';
+        if (strstr(request, "\r\n\r\n") != nullptr) {
+            break;
+        }
+    }
+    request[size] = '\0';
+
+    std::string body;
+    const char* status = "200 OK";
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        metricsRender(metrics, &body);
+    } else {
+        status = "404 Not Found";
+        body = "Only GET /metrics is served\n";
+    }
+
+    const std::string response = std::string("HTTP/1.1 ") + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    writeAll(fd, response.data(), response.size());
+}
+
+static void serveLoop(MetricsExporter* exporter) {
+    while (!exporter->stopping) {
+        struct pollfd listening = { exporter->listenFd, POLLIN, 0 };
+        if (poll(&listening, 1, metricsPollTimeoutMs) <= 0) {
+            continue;
+        }
+
+        const int fd = accept(exporter->listenFd, nullptr, nullptr);
+        if (fd >= 0) {
+            serveRequest(exporter->metrics, fd);
+            close(fd);
+        }
+    }
+}
+
+static bool writeMetricsFile(Metrics* metrics, const std::string& path) {
+    std::string text;
+    metricsRender(metrics, &text);
+
+    const std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::trunc);
+    out << text;
+    out.close();
+    return !out.fail() && rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+static void fileLoop(MetricsExporter* exporter) {
+    bool failed = false;
+    std::unique_lock<std::mutex> lock(exporter->stopMutex);
+    while (!exporter->stopping) {
+        lock.unlock();
+        const bool written = writeMetricsFile(exporter->metrics, exporter->path);
+        if (!written && !failed) {
+            std::cout << "Failed to write metrics to " << exporter->path << "\n";
+        }
+        failed = !written;
+        lock.lock();
+
+        exporter->stopChanged.wait_for(lock, std::chrono::milliseconds(metricsFileIntervalMs),
+            [exporter] { return exporter->stopping.load(); });
+    }
+}
+
+static int listenLocal(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    const int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t) port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+MetricsExporter* metricsExporterStart(Metrics* metrics, int port, const char* path) {
+    MetricsExporter* exporter = new MetricsExporter();
+    exporter->metrics = metrics;
+    exporter->listenFd = -1;
+    exporter->path = path != nullptr ? path : "";
+    exporter->stopping = false;
+
+    if (port > 0) {
+        exporter->listenFd = listenLocal(port);
+        if (exporter->listenFd < 0) {
+            std::cout << "Failed to serve metrics on 127.0.0.1:" << port << ": " << strerror(errno) << "\n";
+            delete exporter;
+            return nullptr;
+        }
+
+        // A scraper that hangs up mid response must fail the write, not kill the recording
+        std::signal(SIGPIPE, SIG_IGN);
+        exporter->serveThread = std::thread(serveLoop, exporter);
+        std::cout << "metrics: http://127.0.0.1:" << port << "/metrics\n";
+    }
+    if (!exporter->path.empty()) {
+        exporter->fileThread = std::thread(fileLoop, exporter);
+        std::cout << "metrics: " << exporter->path << ", every " << metricsFileIntervalMs << " ms\n";
+    }
+    return exporter;
+}
+
+void metricsExporterStop(MetricsExporter** exporter) {
+    MetricsExporter* stopped = *exporter;
+    if (stopped == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stopped->stopMutex);
+        stopped->stopping = true;
+    }
+    stopped->stopChanged.notify_all();
+
+    if (stopped->serveThread.joinable()) {
+        stopped->serveThread.join();
+        close(stopped->listenFd);
+    }
+    if (stopped->fileThread.joinable()) {
+        stopped->fileThread.join();
+        writeMetricsFile(stopped->metrics, stopped->path);
+    }
+
+    delete stopped;
+    *exporter = nullptr;
+}
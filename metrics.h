@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <string>
+
+// Live numbers of a running recording in the Prometheus text format, for alerting on a
+// capture that degrades hours in. The pipeline registers its series up front (see
+// runPipeline()) and updates them from its threads with relaxed atomics; an exporter
+// renders a snapshot whenever it is asked:
+//
+//   http://127.0.0.1:<port>/metrics    a listener thread on localhost, for Prometheus to scrape
+//   <path>                             rewritten every metricsFileIntervalMs, through a
+//                                      temporary file and a rename so a reader never sees
+//                                      half of it (node_exporter's textfile collector)
+//
+// Values are integers; a series' scale divides them on export, so microseconds are
+// kept as they are measured and exported as seconds. Every update function takes
+// nullptr and does nothing, callers keep a Metric* that is nullptr without metrics.
+
+#define metricsFileIntervalMs 1000
+#define metricsMaxRequestBytes 4096
+
+typedef enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_SUMMARY,         // <name>_sum and <name>_count, e.g. seconds per frame
+} MetricType;
+
+typedef struct Metrics Metrics;
+typedef struct Metric Metric;
+
+Metrics* metricsAlloc();
+void metricsFree(Metrics** metrics);
+
+// name is the family ("capture_video_frames_total"), labels what goes inside the braces
+// ("input=\"1\""), nullptr for none. Series of one family share the type and help of
+// its first series, later ones may pass "".
+// Safe while an exporter is rendering; the metric lives as long as metrics.
+Metric* metricsAdd(Metrics* metrics, MetricType type, const char* name, const char* labels, const char* help, double scale);
+
+void metricAdd(Metric* metric, int64_t delta);
+void metricSet(Metric* metric, int64_t value);
+// One sample of a summary
+void metricObserve(Metric* metric, int64_t value);
+// The stored value (a summary's sum), 0 for nullptr
+int64_t metricGet(const Metric* metric);
+
+// name="value" with the value escaped, for the labels of metricsAdd()
+std::string metricLabel(const char* name, const std::string& value);
+
+// Every family, plus capture_uptime_seconds since metricsAlloc()
+void metricsRender(Metrics* metrics, std::string* text);
+
+typedef struct MetricsExporter MetricsExporter;
+
+// port > 0 serves the metrics on localhost, a non-empty path rewrites that file; either
+// or both. nullptr, after printing why, when the port can't be bound.
+MetricsExporter* metricsExporterStart(Metrics* metrics, int port, const char* path);
+
+// Stops serving and writes the file one last time, with the final values
+void metricsExporterStop(MetricsExporter** exporter);
+
+#endif
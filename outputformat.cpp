@@ -0,0 +1,183 @@
+#include "outputformat.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+extern "C" {
+#include <libavutil/dict.h>
+}
+
+// Empty moov up front, a moof per keyframe, fragment offsets relative to their moof
+#define fragmentMovFlags "frag_keyframe+empty_moov+default_base_moof"
+
+void outputOptionsInit(OutputOptions* options) {
+    options->formatName[0] = '\0';
+    options->container = OUTPUT_SINGLE_FILE;
+    options->segmentSeconds = defaultSegmentSeconds;
+    options->segmentWrap = 0;
+    options->asyncWrite = true;
+    options->directIo = false;
+    options->backpressure = OUTPUT_BACKPRESSURE_BLOCK;
+}
+
+bool parseOutputContainer(const char* value, OutputContainer* container) {
+    if (strcmp(value, "file") == 0) {
+        *container = OUTPUT_SINGLE_FILE;
+    } else if (strcmp(value, "fragmented") == 0) {
+        *container = OUTPUT_FRAGMENTED;
+    } else if (strcmp(value, "segmented") == 0) {
+        *container = OUTPUT_SEGMENTED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* outputContainerName(OutputContainer container) {
+    switch (container) {
+    case OUTPUT_FRAGMENTED:
+        return "fragmented";
+    case OUTPUT_SEGMENTED:
+        return "segmented";
+    default:
+        return "file";
+    }
+}
+
+bool parseOutputBackpressure(const char* value, OutputBackpressure* backpressure) {
+    if (strcmp(value, "block") == 0) {
+        *backpressure = OUTPUT_BACKPRESSURE_BLOCK;
+    } else if (strcmp(value, "drop") == 0) {
+        *backpressure = OUTPUT_BACKPRESSURE_DROP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int parseOutputArg(int argc, char* argv[], int i, OutputOptions* options) {
+    if (strcmp(argv[i], "--fragmented") == 0) {
+        options->container = OUTPUT_FRAGMENTED;
+        return 1;
+    }
+    if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+        options->container = OUTPUT_SEGMENTED;
+        options->segmentSeconds = atoi(argv[i + 1]);
+        return 2;
+    }
+    if (strcmp(argv[i], "--segment-wrap") == 0 && i + 1 < argc) {
+        options->segmentWrap = atoi(argv[i + 1]);
+        return 2;
+    }
+    if (strcmp(argv[i], "--sync-write") == 0) {
+        options->asyncWrite = false;
+        return 1;
+    }
+    if (strcmp(argv[i], "--direct-io") == 0) {
+        options->directIo = true;
+        return 1;
+    }
+    return 0;
+}
+
+void parseOutputArgs(int argc, char* argv[], OutputOptions* options) {
+    for (int i = 1; i < argc; i++) {
+        const int consumed = parseOutputArg(argc, argv, i, options);
+        if (consumed > 1) {
+            i += consumed - 1;
+        }
+    }
+}
+
+// "out.mp4" -> "out_%05d.mp4"
+static std::string segmentPattern(const char* filename) {
+    std::string pattern = filename;
+    if (pattern.find('%') != std::string::npos) {
+        return pattern;
+    }
+
+    const size_t slash = pattern.find_last_of('/');
+    const size_t dot = pattern.find_last_of('.');
+    const size_t split = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : pattern.size();
+    return pattern.substr(0, split) + "_%05d" + pattern.substr(split);
+}
+
+// The muxers that understand movflags
+static bool isMovFamily(const AVOutputFormat* format) {
+    static const char* names[] = { "mp4", "mov", "ipod", "ismv", "3gp", "3g2", "psp", "f4v" };
+    for (const char* name : names) {
+        if (strcmp(format->name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int outputAllocContext(AVFormatContext** formatCtx, const char* filename, const OutputOptions* options) {
+    const bool segmented = options->container == OUTPUT_SEGMENTED;
+    const std::string target = segmented ? segmentPattern(filename) : filename;
+
+    const char* formatName = segmented ? "segment" : options->formatName[0] != '\0' ? options->formatName : nullptr;
+    return avformat_alloc_output_context2(formatCtx, nullptr, formatName, target.c_str());
+}
+
+const AVOutputFormat* outputMediaFormat(const AVFormatContext* formatCtx) {
+    if (strcmp(formatCtx->oformat->name, "segment") == 0) {
+        const AVOutputFormat* segmentFormat = av_guess_format(nullptr, formatCtx->url, nullptr);
+        if (segmentFormat != nullptr) {
+            return segmentFormat;
+        }
+    }
+    return formatCtx->oformat;
+}
+
+int outputKeyframeInterval(const OutputOptions* options, int frameRate) {
+    return options->container == OUTPUT_SINGLE_FILE ? 0 : frameRate * fragmentSeconds;
+}
+
+int outputWriteHeader(AVFormatContext* formatCtx, const OutputOptions* options) {
+    const AVOutputFormat* mediaFormat = outputMediaFormat(formatCtx);
+    const bool fragmentable = isMovFamily(mediaFormat);
+    AVDictionary* headerOptions = nullptr;
+
+    if (options->container != OUTPUT_SINGLE_FILE && !fragmentable) {
+        std::cout << mediaFormat->name << " can't be fragmented, writing it unfragmented\n";
+    }
+
+    if (options->container == OUTPUT_FRAGMENTED && fragmentable) {
+        av_dict_set(&headerOptions, "movflags", fragmentMovFlags, 0);
+    } else if (options->container == OUTPUT_SEGMENTED) {
+        av_dict_set(&headerOptions, "segment_format", mediaFormat->name, 0);
+        av_dict_set_int(&headerOptions, "segment_time", options->segmentSeconds, 0);
+        // Every segment plays on its own from 0
+        av_dict_set(&headerOptions, "reset_timestamps", "1", 0);
+        if (options->segmentWrap > 0) {
+            av_dict_set_int(&headerOptions, "segment_wrap", options->segmentWrap, 0);
+        }
+        if (fragmentable) {
+            av_dict_set(&headerOptions, "segment_format_options", "movflags=" fragmentMovFlags, 0);
+        }
+    }
+
+    const int ret = avformat_write_header(formatCtx, &headerOptions);
+
+    // Whatever is left was not recognised by the muxer
+    const AVDictionaryEntry* entry = nullptr;
+    while ((entry = av_dict_get(headerOptions, "", entry, AV_DICT_IGNORE_SUFFIX)) != nullptr) {
+        std::cout << "Output ignored " << entry->key << "=" << entry->value << "\n";
+    }
+    av_dict_free(&headerOptions);
+
+    if (ret >= 0) {
+        std::cout << "output: " << outputContainerName(options->container) << " " << mediaFormat->name;
+        if (options->container == OUTPUT_SEGMENTED) {
+            std::cout << ", " << options->segmentSeconds << " s segments " << formatCtx->url;
+            if (options->segmentWrap > 0) {
+                std::cout << ", wrapping after " << options->segmentWrap;
+            }
+        }
+        std::cout << "\n";
+    }
+    return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef OUTPUTFORMAT_H
+#define OUTPUTFORMAT_H
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// How the output is laid out on disk. A plain MP4 keeps its whole index in memory and
+// writes the moov atom in av_write_trailer(): a crash loses the recording and a
+// multi-hour capture grows the muxer without bound. Fragmented MP4 writes an empty moov
+// up front and a self-contained moof+mdat per fragment, so memory stays flat and a
+// killed recording plays up to its last fragment. Segmented output rolls over to a new
+// fragmented file every segmentSeconds through the segment muxer.
+//
+// Fragments and segments start on keyframes, so the encoder's gop bounds their length;
+// outputKeyframeInterval() picks one when the gop is left at the encoder default.
+
+typedef enum OutputContainer {
+    OUTPUT_SINGLE_FILE,
+    OUTPUT_FRAGMENTED,
+    OUTPUT_SEGMENTED,
+} OutputContainer;
+
+// What a writer does when its queue is full: wait, stalling whoever writes the packet,
+// or drop it and skip that stream's packets until its next keyframe
+typedef enum OutputBackpressure {
+    OUTPUT_BACKPRESSURE_BLOCK,
+    OUTPUT_BACKPRESSURE_DROP,
+} OutputBackpressure;
+
+#define defaultSegmentSeconds 60
+#define fragmentSeconds 1
+
+typedef struct OutputOptions {
+    char formatName[32];    // muxer by name, "" guesses it from the filename
+    OutputContainer container;
+    int segmentSeconds;
+    int segmentWrap;        // reuse segment numbers after this many, 0 keeps every segment
+    bool asyncWrite;        // mux and write on a writer thread, see outputwriter.h
+    bool directIo;          // bypass the page cache for whole blocks
+    OutputBackpressure backpressure;
+} OutputOptions;
+
+void outputOptionsInit(OutputOptions* options);
+
+bool parseOutputContainer(const char* value, OutputContainer* container);
+const char* outputContainerName(OutputContainer container);
+bool parseOutputBackpressure(const char* value, OutputBackpressure* backpressure);
+
+// "--fragmented", "--segment <seconds>", "--segment-wrap <N>", "--sync-write" and
+// "--direct-io" at argv[i]. Returns how many arguments were consumed, 0 when argv[i] is
+// not an output flag.
+int parseOutputArg(int argc, char* argv[], int i, OutputOptions* options);
+
+// Scans the whole command line for output flags
+void parseOutputArgs(int argc, char* argv[], OutputOptions* options);
+
+// Allocates the output context, outputWriterOpen() then opens its file. Segmented output
+// goes through the segment muxer, which opens its own files named after filename with a
+// segment number ("out.mp4" -> "out_00000.mp4", a filename that has a %d pattern is
+// used as is).
+int outputAllocContext(AVFormatContext** formatCtx, const char* filename, const OutputOptions* options);
+
+// The format the media is finally written in, the one to take default codecs from
+const AVOutputFormat* outputMediaFormat(const AVFormatContext* formatCtx);
+
+// Frames between keyframes for gop 0: one fragment's worth when fragmenting, 0 (the
+// encoder default) for a single file
+int outputKeyframeInterval(const OutputOptions* options, int frameRate);
+
+// avformat_write_header() with the fragmenting/segmenting options
+int outputWriteHeader(AVFormatContext* formatCtx, const OutputOptions* options);
+
+#endif
@@ -0,0 +1,131 @@
+#include "outputsink.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+extern "C" {
+#include <libavutil/error.h>
+}
+
+static bool applySinkOption(OutputSink* sink, const std::string& option) {
+    const size_t equals = option.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+
+    const std::string key = option.substr(0, equals);
+    const std::string value = option.substr(equals + 1);
+    if (key == "format") {
+        if (value.empty() || value.size() >= sizeof(sink->options.formatName)) {
+            return false;
+        }
+        snprintf(sink->options.formatName, sizeof(sink->options.formatName), "%s", value.c_str());
+    } else if (key == "container") {
+        return parseOutputContainer(value.c_str(), &sink->options.container);
+    } else if (key == "segment") {
+        sink->options.container = OUTPUT_SEGMENTED;
+        sink->options.segmentSeconds = atoi(value.c_str());
+        return sink->options.segmentSeconds > 0;
+    } else if (key == "policy") {
+        return parseOutputBackpressure(value.c_str(), &sink->options.backpressure);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseOutputSinkSpec(const char* spec, OutputSink* sink) {
+    outputOptionsInit(&sink->options);
+    sink->options.backpressure = OUTPUT_BACKPRESSURE_DROP;
+
+    const char* url = spec;
+    if (spec[0] == '[') {
+        const char* end = strchr(spec, ']');
+        if (end == nullptr) {
+            return false;
+        }
+
+        const std::string options(spec + 1, end - spec - 1);
+        size_t start = 0;
+        while (start < options.size()) {
+            size_t comma = options.find(',', start);
+            if (comma == std::string::npos) {
+                comma = options.size();
+            }
+            if (!applySinkOption(sink, options.substr(start, comma - start))) {
+                return false;
+            }
+            start = comma + 1;
+        }
+        url = end + 1;
+    }
+
+    if (url[0] == '\0' || strlen(url) >= sizeof(sink->url)) {
+        return false;
+    }
+    snprintf(sink->url, sizeof(sink->url), "%s", url);
+    return true;
+}
+
+OutputSink* outputSinkOpen(const char* spec, const AVFormatContext* mainCtx) {
+    OutputSink* sink = new OutputSink();
+    if (!parseOutputSinkSpec(spec, sink)) {
+        std::cout << "Bad output sink " << spec << "\n";
+        delete sink;
+        return nullptr;
+    }
+
+    if (outputAllocContext(&sink->formatCtx, sink->url, &sink->options) < 0) {
+        std::cout << "Failed to create output context for " << sink->url << "\n";
+        delete sink;
+        return nullptr;
+    }
+
+    // Same streams in the same order, so packets keep their stream index
+    for (unsigned int i = 0; i < mainCtx->nb_streams; i++) {
+        const AVStream* mainStream = mainCtx->streams[i];
+        AVStream* stream = avformat_new_stream(sink->formatCtx, nullptr);
+        if (stream == nullptr || avcodec_parameters_copy(stream->codecpar, mainStream->codecpar) < 0) {
+            outputSinkClose(&sink);
+            return nullptr;
+        }
+        // The main muxer's codec tag may mean nothing to this one
+        stream->codecpar->codec_tag = 0;
+        stream->time_base = mainStream->time_base;
+    }
+
+    sink->writer = outputWriterOpen(sink->formatCtx, &sink->options);
+    if (sink->writer == nullptr) {
+        outputSinkClose(&sink);
+        return nullptr;
+    }
+    return sink;
+}
+
+int outputSinkWrite(OutputSink* sink, const AVPacket* packet, AVRational timeBase) {
+    // A new reference to the same data; the muxers only read it
+    AVPacket* ref = av_packet_clone(packet);
+    if (ref == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    // The muxer may have picked its own time base in avformat_write_header()
+    av_packet_rescale_ts(ref, timeBase, sink->formatCtx->streams[ref->stream_index]->time_base);
+    const int ret = outputWriterWrite(sink->writer, ref);
+    av_packet_free(&ref);
+    return ret;
+}
+
+void outputSinkClose(OutputSink** sink) {
+    if (*sink == nullptr) {
+        return;
+    }
+
+    outputWriterClose(&(*sink)->writer);
+    avformat_free_context((*sink)->formatCtx);
+
+    delete *sink;
+    *sink = nullptr;
+}
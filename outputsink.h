@@ -0,0 +1,49 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "outputformat.h"
+#include "outputwriter.h"
+
+// One encode, many muxers. A sink is another output fed with the packets of the main
+// one: its streams copy the main output's codec parameters and every packet reaches it
+// as a new reference to the same buffer, never a copy of the data.
+//
+// Every sink has its own writer thread and queue. Sinks drop by default, so a slow
+// receiver loses packets up to the next keyframe instead of stalling the encoders, the
+// main file or the other sinks; policy=block makes a sink as lossless as the main file.
+//
+// Spec: "[option,option...]url", options are optional:
+//   format=mpegts          muxer by name, needed when the url has no extension
+//   container=fragmented   file | fragmented | segmented, see outputformat.h
+//   segment=10             segmented, 10 s per file
+//   policy=drop            drop | block
+// e.g. "copy.mp4", "[container=fragmented]live.mp4",
+//      "[format=mpegts]udp://127.0.0.1:5000?pkt_size=1316", "[format=mpegts]pipe:3"
+// A local receiver for the udp sink: ffmpeg -i udp://127.0.0.1:5000 -c copy received.ts
+
+#define maxOutputSinks 4
+
+typedef struct OutputSink {
+    char url[512];
+    OutputOptions options;
+    AVFormatContext* formatCtx;
+    OutputWriter* writer;
+} OutputSink;
+
+bool parseOutputSinkSpec(const char* spec, OutputSink* sink);
+
+// A muxer with a stream per stream of mainCtx, whose codec parameters must be set.
+// nullptr when the spec is bad or the url can't be opened.
+OutputSink* outputSinkOpen(const char* spec, const AVFormatContext* mainCtx);
+
+// packet is in mainCtx's stream numbering and in timeBase; the sink takes a reference
+int outputSinkWrite(OutputSink* sink, const AVPacket* packet, AVRational timeBase);
+
+void outputSinkClose(OutputSink** sink);
+
+#endif
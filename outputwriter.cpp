@@ -0,0 +1,497 @@
+#include "outputwriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "boundedqueue.h"
+#include "latencymeter.h"
+#include "trace.h"
+
+// The muxer's own buffer in front of the block, it only has to cover one small write
+#define avioBufferSize (64 * 1024)
+
+// The file behind the AVIOContext: one aligned block gathering the muxer's writes
+typedef struct BlockFile {
+    int fd;
+    int directFd;               // -1 without directIo
+    uint8_t* block;
+    size_t used;
+    int64_t blockOffset;        // file offset of block[0]
+    int64_t size;
+    int error;
+} BlockFile;
+
+// stats and file are only touched by the thread running the muxer
+struct OutputWriter {
+    AVFormatContext* formatCtx;
+    BlockFile* file;            // nullptr when the muxer opens its own files
+    bool ownsAvio;              // pipes and network targets, opened with avio_open()
+    bool async;
+    OutputBackpressure backpressure;
+
+    BoundedQueue<AVPacket*>* queue;
+    std::thread thread;
+    std::atomic<int> error;
+    bool finished;
+
+    std::mutex dropMutex;
+    std::vector<bool> waitingKeyframe;  // by stream, after a drop
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> muxedBytes;   // packet data handed to the muxer, read live by outputWriterGetProgress()
+
+    LatencyMeter latencyMeter;
+    OutputWriterStats stats;
+    int64_t openTime;
+};
+
+static void addWriteTime(OutputWriterStats* stats, int64_t us) {
+    int bucket = 0;
+    while (bucket < outputWriteLatencyBuckets - 1 && us >= ((int64_t) 2 << bucket)) {
+        bucket++;
+    }
+    stats->writeLatency[bucket]++;
+    stats->writeUs += us;
+}
+
+static int writeFully(int fd, const uint8_t* data, size_t size, int64_t offset) {
+    while (size > 0) {
+        TRACE_SCOPE("pwrite");
+        const ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int flushBlock(OutputWriter* writer) {
+    BlockFile* file = writer->file;
+    if (file->used == 0) {
+        return file->error;
+    }
+
+    // Direct I/O takes whole aligned blocks at aligned offsets only
+    const bool direct = file->directFd >= 0 && file->blockOffset % outputWriteAlignment == 0 && file->used % outputWriteAlignment == 0;
+
+    const int64_t start = latencyClockNow();
+    const int ret = writeFully(direct ? file->directFd : file->fd, file->block, file->used, file->blockOffset);
+    addWriteTime(&writer->stats, latencyClockNow() - start);
+
+    writer->stats.writes++;
+    writer->stats.directWrites += direct ? 1 : 0;
+    if (ret < 0) {
+        file->error = ret;
+        return ret;
+    }
+
+    writer->stats.bytes += file->used;
+    file->blockOffset += file->used;
+    file->size = std::max(file->size, file->blockOffset);
+    file->used = 0;
+    return 0;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int writeCallback(void* opaque, const uint8_t* buf, int size) {
+#else
+static int writeCallback(void* opaque, uint8_t* buf, int size) {
+#endif
+    OutputWriter* writer = (OutputWriter*) opaque;
+    BlockFile* file = writer->file;
+
+    int remaining = size;
+    while (remaining > 0) {
+        const size_t chunk = std::min((size_t) remaining, (size_t) outputWriteBlockSize - file->used);
+        memcpy(file->block + file->used, buf, chunk);
+        file->used += chunk;
+        buf += chunk;
+        remaining -= chunk;
+
+        if (file->used == outputWriteBlockSize && flushBlock(writer) < 0) {
+            return file->error;
+        }
+    }
+    return file->error < 0 ? file->error : size;
+}
+
+static int64_t seekCallback(void* opaque, int64_t offset, int whence) {
+    OutputWriter* writer = (OutputWriter*) opaque;
+    BlockFile* file = writer->file;
+    const int64_t position = file->blockOffset + file->used;
+
+    if (whence & AVSEEK_SIZE) {
+        return std::max(file->size, position);
+    }
+
+    // The muxer patches what it wrote earlier: the block restarts at the new position
+    if (flushBlock(writer) < 0) {
+        return file->error;
+    }
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += position;
+        break;
+    case SEEK_END:
+        offset += file->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (offset < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    file->blockOffset = offset;
+    return offset;
+}
+
+static int openDirect(const char* filename) {
+#if defined(O_DIRECT)
+    return open(filename, O_WRONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+    const int fd = open(filename, O_WRONLY);
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static BlockFile* blockFileOpen(const char* filename, bool directIo) {
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "Failed to open " << filename << ": " << strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    void* block = nullptr;
+    if (posix_memalign(&block, outputWriteAlignment, outputWriteBlockSize) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    BlockFile* file = new BlockFile();
+    file->fd = fd;
+    file->directFd = -1;
+    file->block = (uint8_t*) block;
+    file->used = 0;
+    file->blockOffset = 0;
+    file->size = 0;
+    file->error = 0;
+
+    if (directIo) {
+        file->directFd = openDirect(filename);
+        if (file->directFd < 0) {
+            // tmpfs and some network filesystems refuse O_DIRECT
+            std::cout << "Direct I/O not available for " << filename << " (" << strerror(errno) << "), writing through the cache\n";
+        }
+    }
+    return file;
+}
+
+static void blockFileClose(BlockFile** file) {
+    if (*file == nullptr) {
+        return;
+    }
+
+    if ((*file)->directFd >= 0) {
+        close((*file)->directFd);
+    }
+    close((*file)->fd);
+    free((*file)->block);
+
+    delete *file;
+    *file = nullptr;
+}
+
+// Block files write at offsets, so only regular files (or ones yet to be created) qualify
+static bool isRegularFile(const char* url) {
+    const char* protocol = avio_find_protocol_name(url);
+    if (protocol == nullptr || strcmp(protocol, "file") != 0) {
+        return false;
+    }
+
+    const char* path = strncmp(url, "file:", 5) == 0 ? url + 5 : url;
+    struct stat status;
+    return stat(path, &status) != 0 || S_ISREG(status.st_mode);
+}
+
+static int muxPacket(OutputWriter* writer, AVPacket* packet) {
+    TRACE_SCOPE("mux");
+    const int64_t captureTime = latencyStampOf(packet->opaque);
+    writer->muxedBytes.fetch_add(packet->size, std::memory_order_relaxed);
+    const int ret = av_interleaved_write_frame(writer->formatCtx, packet);
+    latencyMeterAdd(&writer->latencyMeter, captureTime, latencyClockNow());
+    writer->stats.packets++;
+    return ret;
+}
+
+static void writerLoop(OutputWriter* writer) {
+    TRACE_THREAD_NAME("output writer");
+    AVPacket* packet = nullptr;
+    while (writer->queue->pop(packet)) {
+        const size_t depth = std::min(writer->queue->size() + 1, (size_t) outputWriterQueueDepth);
+        writer->stats.peakQueueDepth = std::max(writer->stats.peakQueueDepth, depth);
+        TRACE_COUNTER("writer queue", depth);
+
+        // After an error the queue is still drained so that producers never block
+        if (writer->error == 0) {
+            const int ret = muxPacket(writer, packet);
+            if (ret < 0) {
+                writer->error = ret;
+            }
+        }
+        av_packet_free(&packet);
+    }
+}
+
+OutputWriter* outputWriterOpen(AVFormatContext* formatCtx, const OutputOptions* options) {
+    OutputWriter* writer = new OutputWriter();
+    writer->formatCtx = formatCtx;
+    writer->file = nullptr;
+    writer->ownsAvio = false;
+    // Dropping needs a queue to overflow
+    writer->async = options->asyncWrite || options->backpressure == OUTPUT_BACKPRESSURE_DROP;
+    writer->backpressure = options->backpressure;
+    writer->queue = nullptr;
+    writer->error = 0;
+    writer->finished = false;
+    writer->dropped = 0;
+    writer->muxedBytes = 0;
+    latencyMeterInit(&writer->latencyMeter);
+    writer->stats = {};
+    writer->openTime = latencyClockNow();
+
+    // The segment muxer opens a file per segment itself
+    if (!(formatCtx->oformat->flags & AVFMT_NOFILE) && !isRegularFile(formatCtx->url)) {
+        // A reader that goes away must fail the writes, not kill the process
+        std::signal(SIGPIPE, SIG_IGN);
+        if (avio_open(&formatCtx->pb, formatCtx->url, AVIO_FLAG_WRITE) < 0) {
+            std::cout << "Failed to open " << formatCtx->url << "\n";
+            delete writer;
+            return nullptr;
+        }
+        writer->ownsAvio = true;
+    } else if (!(formatCtx->oformat->flags & AVFMT_NOFILE)) {
+        writer->file = blockFileOpen(formatCtx->url, options->directIo);
+        uint8_t* avioBuffer = (uint8_t*) av_malloc(avioBufferSize);
+        if (writer->file != nullptr && avioBuffer != nullptr) {
+            formatCtx->pb = avio_alloc_context(avioBuffer, avioBufferSize, 1, writer, nullptr, writeCallback, seekCallback);
+        }
+        if (formatCtx->pb == nullptr) {
+            av_free(avioBuffer);
+            blockFileClose(&writer->file);
+            delete writer;
+            return nullptr;
+        }
+    }
+
+    if (writer->async) {
+        writer->queue = new BoundedQueue<AVPacket*>(outputWriterQueueDepth);
+        writer->thread = std::thread(writerLoop, writer);
+    }
+    return writer;
+}
+
+// A dropped packet breaks the references of the ones after it until the next keyframe,
+// so those are dropped too. Audio packets are all keyframes.
+static int dropOrQueue(OutputWriter* writer, AVPacket* queued) {
+    std::lock_guard<std::mutex> lock(writer->dropMutex);
+
+    const size_t stream = queued->stream_index;
+    if (stream >= writer->waitingKeyframe.size()) {
+        writer->waitingKeyframe.resize(stream + 1, false);
+    }
+
+    const bool waiting = writer->waitingKeyframe[stream] && !(queued->flags & AV_PKT_FLAG_KEY);
+    if (waiting || !writer->queue->tryPush(queued)) {
+        writer->waitingKeyframe[stream] = true;
+        writer->dropped++;
+        av_packet_free(&queued);
+        return 0;
+    }
+
+    writer->waitingKeyframe[stream] = false;
+    return 0;
+}
+
+int outputWriterWrite(OutputWriter* writer, AVPacket* packet) {
+    if (writer->error != 0) {
+        av_packet_unref(packet);
+        return writer->error;
+    }
+
+    if (!writer->async) {
+        const int ret = muxPacket(writer, packet);
+        if (ret < 0) {
+            writer->error = ret;
+        }
+        return ret;
+    }
+
+    AVPacket* queued = av_packet_alloc();
+    if (queued == nullptr) {
+        av_packet_unref(packet);
+        return AVERROR(ENOMEM);
+    }
+    av_packet_move_ref(queued, packet);
+
+    if (writer->backpressure == OUTPUT_BACKPRESSURE_DROP) {
+        return dropOrQueue(writer, queued);
+    }
+
+    if (!writer->queue->push(queued)) {
+        av_packet_free(&queued);
+        return AVERROR_EOF;
+    }
+    return 0;
+}
+
+int outputWriterFinish(OutputWriter* writer) {
+    if (writer->finished) {
+        return writer->error;
+    }
+    writer->finished = true;
+
+    if (writer->async) {
+        writer->queue->close();
+        writer->thread.join();
+    }
+
+    // The writer thread is done with the muxer, the trailer goes out from this thread
+    int ret = av_write_trailer(writer->formatCtx);
+    if (writer->file != nullptr) {
+        avio_flush(writer->formatCtx->pb);
+        const int flushed = flushBlock(writer);
+        ret = ret < 0 ? ret : flushed;
+
+        const int64_t start = latencyClockNow();
+        if (fsync(writer->file->fd) < 0 && ret >= 0) {
+            ret = AVERROR(errno);
+        }
+        addWriteTime(&writer->stats, latencyClockNow() - start);
+    }
+    writer->stats.elapsedUs = latencyClockNow() - writer->openTime;
+
+    if (ret < 0 && writer->error == 0) {
+        writer->error = ret;
+    }
+    return writer->error;
+}
+
+void outputWriterClose(OutputWriter** writer) {
+    if (*writer == nullptr) {
+        return;
+    }
+
+    // Without outputWriterFinish() whatever is still queued is dropped
+    if ((*writer)->async && !(*writer)->finished) {
+        (*writer)->finished = true;
+        (*writer)->queue->close();
+        (*writer)->thread.join();
+    }
+    if ((*writer)->ownsAvio) {
+        avio_closep(&(*writer)->formatCtx->pb);
+    } else if ((*writer)->file != nullptr) {
+        av_freep(&(*writer)->formatCtx->pb->buffer);
+        avio_context_free(&(*writer)->formatCtx->pb);
+        blockFileClose(&(*writer)->file);
+    }
+    delete (*writer)->queue;
+
+    delete *writer;
+    *writer = nullptr;
+}
+
+void outputWriterGetStats(const OutputWriter* writer, OutputWriterStats* stats) {
+    *stats = writer->stats;
+    stats->dropped = writer->dropped;
+}
+
+void outputWriterGetProgress(const OutputWriter* writer, uint64_t* muxedBytes, uint64_t* dropped) {
+    *muxedBytes = writer->muxedBytes.load(std::memory_order_relaxed);
+    *dropped = writer->dropped.load(std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the given share of the writes
+static int64_t writeLatencyPercentile(const OutputWriterStats* stats, int percent) {
+    uint64_t total = 0;
+    for (uint64_t count : stats->writeLatency) {
+        total += count;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < outputWriteLatencyBuckets; i++) {
+        seen += stats->writeLatency[i];
+        if (seen * 100 >= total * percent) {
+            return (int64_t) 2 << i;
+        }
+    }
+    return (int64_t) 2 << (outputWriteLatencyBuckets - 1);
+}
+
+void outputWriterLog(OutputWriter* writer) {
+    const OutputWriterStats& stats = writer->stats;
+    latencyMeterLog(&writer->latencyMeter, "capture-to-write");
+
+    std::cout << "output writer " << writer->formatCtx->url << ": " << stats.packets << " packets";
+    if (writer->async) {
+        std::cout << ", writer thread, queue peak " << stats.peakQueueDepth << "/" << outputWriterQueueDepth;
+    } else {
+        std::cout << ", inline";
+    }
+    if (writer->error != 0) {
+        char message[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(message, sizeof(message), writer->error);
+        std::cout << ", failed: " << message;
+    }
+    if (writer->backpressure == OUTPUT_BACKPRESSURE_DROP) {
+        std::cout << ", " << writer->dropped << " dropped";
+    }
+    std::cout << "\n";
+    if (writer->file == nullptr) {
+        return;
+    }
+
+    const double seconds = stats.elapsedUs / 1000000.0;
+    const double busySeconds = stats.writeUs / 1000000.0;
+    std::cout << "  " << stats.bytes / 1048576.0 << " MB in " << stats.writes << " writes ("
+        << stats.directWrites << " direct), " << (seconds > 0 ? stats.bytes / 1048576.0 / seconds : 0) << " MB/s, "
+        << (busySeconds > 0 ? stats.bytes / 1048576.0 / busySeconds : 0) << " MB/s while writing\n";
+    std::cout << "  write latency: p50 < " << writeLatencyPercentile(&stats, 50) / 1000.0
+        << " ms, p99 < " << writeLatencyPercentile(&stats, 99) / 1000.0 << " ms, histogram";
+    for (int i = 0; i < outputWriteLatencyBuckets; i++) {
+        if (stats.writeLatency[i] > 0) {
+            std::cout << " <" << ((int64_t) 2 << i) << "us:" << stats.writeLatency[i];
+        }
+    }
+    std::cout << "\n";
+}
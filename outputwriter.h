@@ -0,0 +1,77 @@
+#ifndef OUTPUTWRITER_H
+#define OUTPUTWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "outputformat.h"
+
+// The muxer and the disk, off the encode threads.
+//
+// Encoded packets are queued to a writer thread that runs av_interleaved_write_frame(),
+// so a slow write or a filesystem flush stalls that thread and the queue instead of the
+// encoder. With OutputOptions.asyncWrite off the packet is muxed right away on the
+// calling thread, as before.
+//
+// The muxer writes through a custom AVIOContext that coalesces its small writes into
+// outputWriteBlockSize blocks aligned to outputWriteAlignment and issues one pwrite() per
+// block, timing each one. With OutputOptions.directIo the blocks bypass the page cache
+// (O_DIRECT, F_NOCACHE on macOS); writes that are not whole aligned blocks, like the
+// tail of the file or the muxer patching a header after a seek, go through the cache.
+// Pipes, FIFOs and network URLs are opened with avio_open() and written as the muxer
+// goes. The segment muxer opens its own files, there only the packets are moved off
+// the encode threads.
+//
+// With OUTPUT_BACKPRESSURE_DROP a full queue drops the packet, and the stream's
+// packets after it up to its next keyframe, instead of stalling the writing thread.
+// Such a writer always has a writer thread.
+//
+// Capture-to-write latency is metered here, when the muxer has taken the packet.
+
+#define outputWriterQueueDepth 256
+#define outputWriteBlockSize (1024 * 1024)
+#define outputWriteAlignment 4096
+#define outputWriteLatencyBuckets 24    // log2 microseconds, the last one takes the rest
+
+typedef struct OutputWriter OutputWriter;
+
+typedef struct OutputWriterStats {
+    uint64_t packets;
+    uint64_t bytes;                     // reached the file
+    uint64_t writes;                    // pwrite() calls
+    uint64_t directWrites;
+    int64_t writeUs;                    // spent inside pwrite() and fsync()
+    int64_t elapsedUs;                  // open to finish
+    uint64_t writeLatency[outputWriteLatencyBuckets];   // [i] counts pwrite()/fsync() calls of [2^i, 2^(i+1)) us
+    size_t peakQueueDepth;
+    uint64_t dropped;                   // OUTPUT_BACKPRESSURE_DROP only
+} OutputWriterStats;
+
+// Opens the file of formatCtx, allocated by outputAllocContext(), and starts the writer
+// thread. Call before outputWriteHeader(); nullptr if the file can't be opened.
+OutputWriter* outputWriterOpen(AVFormatContext* formatCtx, const OutputOptions* options);
+
+// Takes the packet's reference like av_interleaved_write_frame(), the packet is left
+// blank. The packet must be rescaled to its stream's time base. Several threads may
+// write with asyncWrite, without it the callers serialize. Returns the first error the
+// writer ran into.
+int outputWriterWrite(OutputWriter* writer, AVPacket* packet);
+
+// Writes every queued packet and the trailer, then flushes the file to disk
+int outputWriterFinish(OutputWriter* writer);
+
+// Closes the file and frees formatCtx->pb, call after outputWriterFinish()
+void outputWriterClose(OutputWriter** writer);
+
+void outputWriterGetStats(const OutputWriter* writer, OutputWriterStats* stats);
+void outputWriterLog(OutputWriter* writer);
+
+// Packet data handed to the muxer and packets dropped so far. Unlike the stats, safe to
+// read from any thread while the writer runs.
+void outputWriterGetProgress(const OutputWriter* writer, uint64_t* muxedBytes, uint64_t* dropped);
+
+#endif
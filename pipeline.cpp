@@ -0,0 +1,952 @@
+#include "pipeline.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <mutex>
+extern "C" {
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+#include <libavutil/error.h>
+}
+
+#include "boundedqueue.h"
+#include "doorbell.h"
+#include "frameconvert.h"
+#include "framering.h"
+#include "inputsync.h"
+#include "latencymeter.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "trace.h"
+
+// av_read_frame() retry backoff for capture devices that return EAGAIN, capped well
+// below a frame interval so it adds no visible latency
+#define minReadRetryUs 250
+#define maxReadRetryUs 2000
+
+// The filter thread sleeps until a decode thread rings; the timeout only bounds how
+// late queued mixer commands are applied while every input is quiet
+#define filterIdleTimeoutUs 100000
+
+// How often the filter thread copies ring counts, fps and writer progress into the
+// metrics; the threads that own a series update it as they go
+#define metricsPublishIntervalUs 1000000
+
+std::atomic<bool> shouldStop(false);
+
+// Average and peak fill of one queue, sampled by the filter thread whenever it wakes
+typedef struct StageDepth {
+    uint64_t samples;
+    uint64_t total;
+    size_t peak;
+} StageDepth;
+
+static void sampleDepth(StageDepth* depth, size_t size) {
+    depth->samples++;
+    depth->total += size;
+    depth->peak = std::max(depth->peak, size);
+}
+
+static void logDepth(const char* name, const StageDepth* depth, size_t capacity) {
+    std::cout << "  " << name << ": avg " << (depth->samples > 0 ? (double) depth->total / depth->samples : 0)
+        << ", peak " << depth->peak << "/" << capacity << "\n";
+}
+
+// Series of outputCtx->metrics (see metrics.h), all nullptr without metrics
+typedef struct InputMetrics {
+    Metric* videoFrames;
+    Metric* audioFrames;
+    Metric* videoOverruns;
+    Metric* convertFailures;
+    Metric* filterRejects;
+    Metric* fps;
+    Metric* decode;
+    Metric* convert;
+    Metric* videoRing;
+    Metric* audioRing;
+    uint64_t lastVideoFrames;   // at the last publish, for fps
+} InputMetrics;
+
+typedef struct BranchMetrics {
+    Metric* encode;
+    Metric* frames;
+    Metric* duplicated;
+    Metric* dropped;
+    Metric* encodeQueue;
+    Metric* position;       // main output only
+} BranchMetrics;
+
+typedef struct WriterMetrics {
+    OutputWriter* writer;
+    Metric* bytes;
+    Metric* dropped;
+} WriterMetrics;
+
+typedef struct PipelineMetrics {
+    Metrics* metrics;
+    int64_t lastPublish;
+    Metric* audioEncodeQueue;
+    Metric* audioFifo;
+    Metric* audioPosition;
+    Metric* audioSilence;
+    Metric* audioCut;
+    Metric* avDrift;
+    std::vector<WriterMetrics> writers;
+} PipelineMetrics;
+
+// The canvas at one size of the ladder: the main output, or one of its renditions
+typedef struct VideoBranch {
+    MediaContext* outputCtx;
+    BoundedQueue<AVFrame*>* encodeQueue;
+    StageDepth encodeDepth;
+    std::string name;
+    int index;              // 0 for the main output, then the renditions
+    BranchMetrics metrics;
+} VideoBranch;
+
+// Decoded frames of one input on their way to the filter thread
+typedef struct InputRings {
+    MediaContext* inputCtx;
+    std::string name;           // "input1", ... for the logs
+    FrameConverter* videoConverter;     // picked once for the input, nullptr when the filter graph converts
+    bool live;                  // video ring drops instead of blocking
+    int syncIndex;              // input of the InputSync, -1 when the video isn't synced
+    bool syncClosed;            // filter thread only
+    FrameRing* videoRing;
+    FrameRing* audioRing;
+    Doorbell* filterDoorbell;   // rung after every push so the filter thread wakes up
+    int64_t lastVideoCapture;   // stamp of the newest video frame fed to the graph, filter thread only
+    InputClock clock;           // maps source pts onto the shared timeline, decode thread only
+    StageStats decodeStats;     // video only, decode thread only
+    StageStats convertStats;
+    std::atomic<uint64_t> convertFailures;  // video frames the converter refused and were dropped
+    uint64_t filterRejects;     // frames a buffer source refused, filter thread only
+    StageDepth videoDepth;
+    StageDepth audioDepth;
+    InputMetrics metrics;
+} InputRings;
+
+// Inputs with a range (see setInputRange()): false drops the frame, audio straddling an
+// edge is cut to it. Decoders return frames in presentation order, so once a frame starts
+// at or after the end none of the stream's later frames is needed and pastEnd is set.
+static bool trimToRange(const MediaContext* inputCtx, AVFrame* frame, AVRational timeBase, bool isVideo, bool* pastEnd) {
+    const int64_t source = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    if (source == AV_NOPTS_VALUE) {
+        return true;
+    }
+
+    const int64_t start = av_rescale_q(source, timeBase, AV_TIME_BASE_Q);
+    if (inputCtx->rangeEnd > 0 && start >= inputCtx->rangeEnd) {
+        *pastEnd = true;
+        return false;
+    }
+    if (isVideo || frame->sample_rate <= 0) {
+        return start >= inputCtx->rangeStart;
+    }
+
+    const int64_t end = start + av_rescale(frame->nb_samples, AV_TIME_BASE, frame->sample_rate);
+    if (end <= inputCtx->rangeStart) {
+        return false;
+    }
+    if (start < inputCtx->rangeStart) {
+        const int skip = (int) std::min<int64_t>(av_rescale(inputCtx->rangeStart - start, frame->sample_rate, AV_TIME_BASE), frame->nb_samples);
+        audioFrameSkipSamples(frame, skip);
+        frame->pts = source + av_rescale_q(skip, av_make_q(1, frame->sample_rate), timeBase);
+    }
+    if (inputCtx->rangeEnd > 0 && end > inputCtx->rangeEnd) {
+        frame->nb_samples -= (int) std::min<int64_t>(av_rescale(end - inputCtx->rangeEnd, frame->sample_rate, AV_TIME_BASE), frame->nb_samples);
+    }
+    return frame->nb_samples > 0;
+}
+
+// Converts a decoded video frame into a buffer from framePool, with the properties of
+// decodedFrame, which is left blank. A frame the converter wasn't picked for (the input
+// changed format or size) fails with AVERROR(EINVAL), both frames blank.
+static int convertVideoFrame(AVFrame* decodedFrame, AVFrame* frame, const FrameConverter* converter, FramePool* framePool) {
+    frameConverterInitFrame(converter, frame);
+    framePoolGetVideoBuffer(framePool, frame);
+    int ret;
+    {
+        TRACE_SCOPE(frameConverterSpecialized(converter) ? "convert specialized" : "convert swscale");
+        ret = frameConverterConvert(converter, decodedFrame, frame);
+    }
+    if (ret < 0) {
+        av_frame_unref(frame);
+        av_frame_unref(decodedFrame);
+        return ret;
+    }
+
+    av_frame_copy_props(frame, decodedFrame);
+    av_frame_unref(decodedFrame);
+    return 0;
+}
+
+// Reads packets of one input, decodes them and hands the frames to the filter thread.
+// Video frames are converted here so every input pays its conversion on its own core.
+static void demuxDecodeLoop(MediaContext* inputCtx, MediaContext* outputCtx, InputRings* rings) {
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *decodedFrame = av_frame_alloc();
+    bool inputDone = false;
+    int64_t captureTime = 0;
+    int retryDelayUs = minReadRetryUs;
+    bool videoPastEnd = inputCtx->videoBufferFilterCtx == nullptr;
+    bool audioPastEnd = inputCtx->audioBufferFilterCtx == nullptr;
+    TRACE_THREAD_NAME("decode");
+
+    while (!inputDone) {
+        if (shouldStop || (inputCtx->hasRange && videoPastEnd && audioPastEnd)) {
+            // Drain whatever the decoders still hold before giving up on this input
+            inputDone = true;
+        } else {
+            int ret;
+            {
+                TRACE_SCOPE("av_read_frame");
+                ret = av_read_frame(inputCtx->formatCtx, packet);
+            }
+            if (ret == AVERROR(EAGAIN)) {
+                // Capture devices without a frame ready return at once, back off instead of spinning
+                std::this_thread::sleep_for(std::chrono::microseconds(retryDelayUs));
+                retryDelayUs = std::min(retryDelayUs * 2, maxReadRetryUs);
+                continue;
+            } else if (ret < 0) {
+                inputDone = true;
+            }
+            retryDelayUs = minReadRetryUs;
+            captureTime = latencyClockNow();
+        }
+
+        for (int i = 0; i < 2; i++) {
+            const bool isVideo = i == 0;
+            AVCodecContext* codecCtx = isVideo ? inputCtx->videoCodecCtx : inputCtx->audioCodecCtx;
+            AVFilterContext* bufferSrcCtx = isVideo ? inputCtx->videoBufferFilterCtx : inputCtx->audioBufferFilterCtx;
+            if (codecCtx == nullptr || bufferSrcCtx == nullptr) {
+                continue;
+            }
+
+            int64_t stageStart = latencyClockNow();
+            if (inputDone) {
+                avcodec_send_packet(codecCtx, nullptr);
+            } else if (packet->stream_index == (isVideo ? inputCtx->videoIndex : inputCtx->audioIndex)) {
+                TRACE_SCOPE("avcodec_send_packet");
+                avcodec_send_packet(codecCtx, packet);
+            } else {
+                continue;
+            }
+
+            while (avcodec_receive_frame(codecCtx, decodedFrame) == 0) {
+                TRACE_SCOPE(isVideo ? "video frame" : "audio frame");
+                if (isVideo) {
+                    metricObserve(rings->metrics.decode, stageStatsAdd(&rings->decodeStats, stageStart));
+                }
+                if (inputCtx->hasRange && !trimToRange(inputCtx, decodedFrame, codecCtx->time_base, isVideo,
+                                                       isVideo ? &videoPastEnd : &audioPastEnd)) {
+                    av_frame_unref(decodedFrame);
+                    continue;
+                }
+
+                AVFrame* frame = framePoolAcquireFrame(outputCtx->framePool);
+                inputClockMapFrame(&rings->clock, decodedFrame, codecCtx->time_base, isVideo, captureTime);
+                if (isVideo) {
+                    latencyStampFrame(decodedFrame, captureTime);
+                }
+
+                if (isVideo && rings->videoConverter != nullptr) {
+                    TRACE_SCOPE("convert");
+                    stageStart = latencyClockNow();
+                    if (convertVideoFrame(decodedFrame, frame, rings->videoConverter, outputCtx->framePool) < 0) {
+                        // The input changed format or size under its converter
+                        rings->convertFailures++;
+                        framePoolReleaseFrame(outputCtx->framePool, &frame);
+                        stageStart = latencyClockNow();
+                        continue;
+                    }
+                    metricObserve(rings->metrics.convert, stageStatsAdd(&rings->convertStats, stageStart));
+                } else {
+                    av_frame_move_ref(frame, decodedFrame);
+                }
+
+                TRACE_SCOPE("ring push");
+                if (!(isVideo ? rings->videoRing : rings->audioRing)->push(frame)) {
+                    framePoolReleaseFrame(outputCtx->framePool, &frame);
+                }
+                rings->filterDoorbell->ring();
+                stageStart = latencyClockNow();
+            }
+        }
+
+        av_packet_unref(packet);
+    }
+
+    rings->videoRing->close();
+    rings->audioRing->close();
+    rings->filterDoorbell->ring();
+
+    av_frame_free(&decodedFrame);
+    av_packet_free(&packet);
+}
+
+// Frames that lost their capture stamp in the graph (the stack filters build new frames)
+// get captureTime, the oldest of the newest frames fed from each input. Returns the
+// number of frames taken.
+static int drainBufferSink(AVFilterContext* bufferSinkCtx, BoundedQueue<AVFrame*>* encodeQueue, FramePool* framePool, int64_t captureTime) {
+    int frames = 0;
+    if (bufferSinkCtx == nullptr) {
+        return frames;
+    }
+
+    while (true) {
+        AVFrame* filteredFrame = framePoolAcquireFrame(framePool);
+        if (av_buffersink_get_frame(bufferSinkCtx, filteredFrame) < 0) {
+            framePoolReleaseFrame(framePool, &filteredFrame);
+            break;
+        }
+
+        if (filteredFrame->opaque == nullptr && captureTime > 0) {
+            latencyStampFrame(filteredFrame, captureTime);
+        }
+
+        if (!encodeQueue->push(filteredFrame)) {
+            framePoolReleaseFrame(framePool, &filteredFrame);
+        }
+        frames++;
+    }
+    return frames;
+}
+
+#ifdef ENABLE_TRACE
+#define traceCounterIntervalUs 10000
+
+// Ring and queue depths, frames taken in and ring overruns (drops of live inputs, blocked
+// pushes of files), at most every traceCounterIntervalUs. Filter thread only.
+static void traceCounters(const std::vector<InputRings*>& inputRings, const std::vector<VideoBranch*>& videoBranches,
+                          BoundedQueue<AVFrame*>* audioEncodeQueue) {
+    static int64_t lastTime = 0;
+    const int64_t now = traceClockNow();
+    if (now - lastTime < traceCounterIntervalUs) {
+        return;
+    }
+    lastTime = now;
+
+    for (size_t i = 0; i < inputRings.size(); i++) {
+        TRACE_COUNTER_ID("video ring", i + 1, inputRings[i]->videoRing->size());
+        TRACE_COUNTER_ID("audio ring", i + 1, inputRings[i]->audioRing->size());
+        TRACE_COUNTER_ID("video frames in", i + 1, inputRings[i]->videoRing->pushedCount());
+        TRACE_COUNTER_ID("video ring overruns", i + 1, inputRings[i]->videoRing->overrunCount());
+    }
+    for (VideoBranch* branch : videoBranches) {
+        TRACE_COUNTER_ID("video encode queue", branch->index + 1, branch->encodeQueue->size());
+    }
+    TRACE_COUNTER("audio encode queue", audioEncodeQueue->size());
+}
+#endif
+
+// Registers the series of every input, branch and writer when the output has metrics.
+// Without, every Metric* stays nullptr and updating it does nothing.
+static void addPipelineMetrics(PipelineMetrics* pipelineMetrics, MediaContext* outputCtx,
+                               const std::vector<InputRings*>& inputRings, const std::vector<VideoBranch*>& videoBranches) {
+    Metrics* metrics = outputCtx->metrics;
+    pipelineMetrics->metrics = metrics;
+    pipelineMetrics->lastPublish = latencyClockNow();
+    if (metrics == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < inputRings.size(); i++) {
+        InputMetrics* input = &inputRings[i]->metrics;
+        const std::string labels = metricLabel("input", std::to_string(i + 1));
+        const std::string video = labels + "," + metricLabel("stream", "video");
+        const std::string audio = labels + "," + metricLabel("stream", "audio");
+        input->videoFrames = metricsAdd(metrics, METRIC_COUNTER, "capture_frames_total", video.c_str(), "Frames decoded and queued for the filter thread", 1);
+        input->audioFrames = metricsAdd(metrics, METRIC_COUNTER, "capture_frames_total", audio.c_str(), "", 1);
+        input->videoOverruns = metricsAdd(metrics, METRIC_COUNTER, "capture_ring_overruns_total", video.c_str(),
+            "Frames a live input dropped, or pushes of a file input that waited, on a full ring", 1);
+        input->convertFailures = metricsAdd(metrics, METRIC_COUNTER, "capture_convert_failures_total", labels.c_str(),
+            "Video frames dropped because their format or size didn't match the input's converter", 1);
+        input->filterRejects = metricsAdd(metrics, METRIC_COUNTER, "capture_filter_rejects_total", labels.c_str(),
+            "Frames the filter graph refused and were dropped", 1);
+        input->fps = metricsAdd(metrics, METRIC_GAUGE, "capture_input_fps", labels.c_str(), "Video frames decoded per second", 1000);
+        input->decode = metricsAdd(metrics, METRIC_SUMMARY, "capture_decode_seconds", labels.c_str(), "Time to decode a video frame", 1000000);
+        input->convert = metricsAdd(metrics, METRIC_SUMMARY, "capture_convert_seconds", labels.c_str(), "Time to convert a video frame", 1000000);
+        input->videoRing = metricsAdd(metrics, METRIC_GAUGE, "capture_ring_frames", video.c_str(), "Frames waiting for the filter thread", 1);
+        input->audioRing = metricsAdd(metrics, METRIC_GAUGE, "capture_ring_frames", audio.c_str(), "", 1);
+    }
+
+    for (VideoBranch* branch : videoBranches) {
+        BranchMetrics* output = &branch->metrics;
+        const std::string labels = metricLabel("output", branch->outputCtx->filename);
+        output->encode = metricsAdd(metrics, METRIC_SUMMARY, "capture_encode_seconds", labels.c_str(),
+            "Time to encode a video frame, its duplicates included", 1000000);
+        output->frames = metricsAdd(metrics, METRIC_COUNTER, "capture_output_frames_total", labels.c_str(), "Video frames encoded", 1);
+        output->duplicated = metricsAdd(metrics, METRIC_COUNTER, "capture_output_frames_duplicated_total", labels.c_str(),
+            "Video frames repeated to fill gaps of the constant frame rate", 1);
+        output->dropped = metricsAdd(metrics, METRIC_COUNTER, "capture_output_frames_dropped_total", labels.c_str(),
+            "Video frames dropped to hold the constant frame rate", 1);
+        output->encodeQueue = metricsAdd(metrics, METRIC_GAUGE, "capture_encode_queue_frames", (labels + "," + metricLabel("stream", "video")).c_str(),
+            "Frames waiting for an encoder", 1);
+        if (branch->outputCtx == outputCtx) {
+            output->position = metricsAdd(metrics, METRIC_GAUGE, "capture_output_position_seconds", metricLabel("stream", "video").c_str(),
+                "Timeline position of the next frame or sample encoded", 1000000);
+        }
+    }
+
+    if (outputCtx->audioBufferFilterCtx != nullptr) {
+        const std::string labels = metricLabel("output", outputCtx->filename) + "," + metricLabel("stream", "audio");
+        pipelineMetrics->audioEncodeQueue = metricsAdd(metrics, METRIC_GAUGE, "capture_encode_queue_frames", labels.c_str(), "", 1);
+        pipelineMetrics->audioFifo = metricsAdd(metrics, METRIC_GAUGE, "capture_audio_fifo_samples", nullptr,
+            "Samples waiting in the resampler FIFO for a whole encoder frame", 1);
+        pipelineMetrics->audioPosition = metricsAdd(metrics, METRIC_GAUGE, "capture_output_position_seconds", metricLabel("stream", "audio").c_str(), "", 1000000);
+        pipelineMetrics->audioSilence = metricsAdd(metrics, METRIC_COUNTER, "capture_audio_sync_samples_total", metricLabel("change", "silence").c_str(),
+            "Samples inserted or cut to keep audio on the timeline", 1);
+        pipelineMetrics->audioCut = metricsAdd(metrics, METRIC_COUNTER, "capture_audio_sync_samples_total", metricLabel("change", "cut").c_str(), "", 1);
+        if (!videoBranches.empty()) {
+            pipelineMetrics->avDrift = metricsAdd(metrics, METRIC_GAUGE, "capture_av_drift_seconds", nullptr,
+                "Audio minus video position at the encoders, positive when audio is ahead", 1000000);
+        }
+    }
+
+    // The main file, the renditions, then the sinks
+    std::vector<std::pair<OutputWriter*, std::string>> writers = { { outputCtx->writer, outputCtx->filename } };
+    for (int i = 0; i < outputCtx->renditionCount; i++) {
+        writers.emplace_back(outputCtx->renditions[i]->writer, outputCtx->renditions[i]->filename);
+    }
+    for (int i = 0; i < outputCtx->sinkCount; i++) {
+        writers.emplace_back(outputCtx->sinks[i]->writer, outputCtx->sinks[i]->url);
+    }
+    for (const auto& writer : writers) {
+        if (writer.first == nullptr) {
+            continue;
+        }
+        const std::string labels = metricLabel("output", writer.second);
+        WriterMetrics writerMetrics = { writer.first };
+        writerMetrics.bytes = metricsAdd(metrics, METRIC_COUNTER, "capture_output_bytes_total", labels.c_str(), "Packet bytes handed to the muxer", 1);
+        writerMetrics.dropped = metricsAdd(metrics, METRIC_COUNTER, "capture_output_packets_dropped_total", labels.c_str(),
+            "Packets a writer with the drop policy lost to a full queue", 1);
+        pipelineMetrics->writers.push_back(writerMetrics);
+    }
+}
+
+// Copies what other threads count on their own (ring counters, queue fills, writer
+// progress) into the metrics, at most every metricsPublishIntervalUs unless forced
+static void publishMetrics(PipelineMetrics* pipelineMetrics, const std::vector<InputRings*>& inputRings,
+                           const std::vector<VideoBranch*>& videoBranches, BoundedQueue<AVFrame*>* audioEncodeQueue, bool force) {
+    const int64_t now = latencyClockNow();
+    const int64_t elapsed = now - pipelineMetrics->lastPublish;
+    if (pipelineMetrics->metrics == nullptr || (!force && elapsed < metricsPublishIntervalUs)) {
+        return;
+    }
+    pipelineMetrics->lastPublish = now;
+
+    for (InputRings* rings : inputRings) {
+        InputMetrics* input = &rings->metrics;
+        const uint64_t videoFrames = rings->videoRing->pushedCount();
+        metricSet(input->videoFrames, videoFrames);
+        metricSet(input->audioFrames, rings->audioRing->pushedCount());
+        metricSet(input->videoOverruns, rings->videoRing->overrunCount());
+        metricSet(input->convertFailures, rings->convertFailures);
+        metricSet(input->filterRejects, rings->filterRejects);
+        metricSet(input->videoRing, rings->videoRing->size());
+        metricSet(input->audioRing, rings->audioRing->size());
+        if (elapsed > 0) {
+            metricSet(input->fps, (int64_t) ((videoFrames - input->lastVideoFrames) * 1000000000 / elapsed));
+        }
+        input->lastVideoFrames = videoFrames;
+    }
+
+    for (VideoBranch* branch : videoBranches) {
+        metricSet(branch->metrics.encodeQueue, branch->encodeQueue->size());
+    }
+    metricSet(pipelineMetrics->audioEncodeQueue, audioEncodeQueue->size());
+    if (!videoBranches.empty()) {
+        metricSet(pipelineMetrics->avDrift, metricGet(pipelineMetrics->audioPosition) - metricGet(videoBranches[0]->metrics.position));
+    }
+
+    for (const WriterMetrics& writer : pipelineMetrics->writers) {
+        uint64_t bytes;
+        uint64_t dropped;
+        outputWriterGetProgress(writer.writer, &bytes, &dropped);
+        metricSet(writer.bytes, bytes);
+        metricSet(writer.dropped, dropped);
+    }
+}
+
+// Feeds frame to one buffer source of the input, nullptr ends the source. A refused
+// frame is left to the caller and counted; only the first refusal of an input is
+// logged, a refused end always is.
+static void addSourceFrame(InputRings* rings, AVFilterContext* bufferSrcCtx, AVFrame* frame) {
+    const int ret = av_buffersrc_add_frame(bufferSrcCtx, frame);
+    if (ret >= 0) {
+        return;
+    }
+
+    char reason[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(ret, reason, sizeof(reason));
+    if (frame == nullptr) {
+        std::cout << rings->name << ": failed to end " << bufferSrcCtx->name << ": " << reason << "\n";
+    } else if (rings->filterRejects++ == 0) {
+        std::cout << rings->name << ": " << bufferSrcCtx->name << " refused a frame: " << reason << "\n";
+    }
+}
+
+// Owns the filter graphs. Drains the rings of every input into their buffer sources,
+// passes whatever the graphs produce on to the encoders and sleeps on the doorbell
+// once a pass finds no frame at all. Its stage time is the busy time of the passes
+// per frame of the main video sink. With inputSync, synced video goes through it and
+// on to the sources one tick at a time, and the sleep ends by the next tick's deadline.
+static void filterLoop(std::vector<InputRings*> inputRings, MediaContext* outputCtx, Doorbell* doorbell,
+                       std::vector<VideoBranch*> videoBranches, BoundedQueue<AVFrame*>* audioEncodeQueue,
+                       StageDepth* audioEncodeDepth, PipelineMetrics* pipelineMetrics, InputSync* inputSync,
+                       Timeline* timeline) {
+    StageStats filterStats;
+    stageStatsInit(&filterStats);
+    std::vector<AVFrame*> tickFrames;
+    for (InputRings* rings : inputRings) {
+        if (rings->syncIndex >= 0) {
+            tickFrames.push_back(av_frame_alloc());
+        }
+    }
+    TRACE_THREAD_NAME("filter");
+
+    while (true) {
+        bool gotFrame = false;
+        bool allDrained = true;
+
+        for (InputRings* rings : inputRings) {
+            sampleDepth(&rings->videoDepth, rings->videoRing->size());
+            sampleDepth(&rings->audioDepth, rings->audioRing->size());
+        }
+        for (VideoBranch* branch : videoBranches) {
+            sampleDepth(&branch->encodeDepth, branch->encodeQueue->size());
+        }
+        sampleDepth(audioEncodeDepth, audioEncodeQueue->size());
+        publishMetrics(pipelineMetrics, inputRings, videoBranches, audioEncodeQueue, false);
+#ifdef ENABLE_TRACE
+        traceCounters(inputRings, videoBranches, audioEncodeQueue);
+#endif
+
+        // The graph is only ever touched from this thread
+        if (outputCtx->audioMixer != nullptr) {
+            audioMixerApplyCommands(outputCtx->audioMixer);
+        }
+
+        // Take everything queued, not one frame per input per pass, so a backlog clears at once
+        TRACE_SCOPE("filter pass");
+        const int64_t passStart = latencyClockNow();
+        for (InputRings* rings : inputRings) {
+            AVFrame* frame;
+            while ((frame = rings->videoRing->pop()) != nullptr) {
+                rings->lastVideoCapture = latencyStampOf(frame->opaque);
+                if (rings->syncIndex >= 0) {
+                    // The synchronizer compares every input on the timeline in microseconds
+                    frame->pts = av_rescale_q(frame->pts, rings->inputCtx->videoCodecCtx->time_base, AV_TIME_BASE_Q);
+                    inputSyncPush(inputSync, rings->syncIndex, frame);
+                } else {
+                    addSourceFrame(rings, rings->inputCtx->videoBufferFilterCtx, frame);
+                    framePoolReleaseFrame(outputCtx->framePool, &frame);
+                }
+                gotFrame = true;
+            }
+            if (rings->syncIndex >= 0 && !rings->syncClosed && rings->videoRing->isDrained()) {
+                inputSyncClose(inputSync, rings->syncIndex);
+                rings->syncClosed = true;
+            }
+
+            while ((frame = rings->audioRing->pop()) != nullptr) {
+                addSourceFrame(rings, rings->inputCtx->audioBufferFilterCtx, frame);
+                framePoolReleaseFrame(outputCtx->framePool, &frame);
+                gotFrame = true;
+            }
+
+            allDrained = allDrained && rings->videoRing->isDrained() && rings->audioRing->isDrained();
+        }
+
+        // Every tick due by now, a tick waited out for a late input included. Once all
+        // synced inputs are closed the ticks run until their last frames are shown.
+        int64_t tickTimeout = -1;
+        if (inputSync != nullptr) {
+            const int64_t now = timelineTimeAt(timeline, latencyClockNow());
+            while (inputSyncTick(inputSync, now, tickFrames.data()) == 0) {
+                for (InputRings* rings : inputRings) {
+                    if (rings->syncIndex < 0) {
+                        continue;
+                    }
+                    AVFrame* frame = tickFrames[rings->syncIndex];
+                    frame->pts = av_rescale_q(frame->pts, AV_TIME_BASE_Q, rings->inputCtx->videoCodecCtx->time_base);
+                    addSourceFrame(rings, rings->inputCtx->videoBufferFilterCtx, frame);
+                    av_frame_unref(frame);
+                }
+                gotFrame = true;
+            }
+            tickTimeout = inputSyncTimeout(inputSync, now);
+        }
+
+        if (gotFrame) {
+            int64_t oldestCapture = 0;
+            for (InputRings* rings : inputRings) {
+                if (rings->lastVideoCapture > 0 && (oldestCapture == 0 || rings->lastVideoCapture < oldestCapture)) {
+                    oldestCapture = rings->lastVideoCapture;
+                }
+            }
+
+            int frames = 0;
+            for (VideoBranch* branch : videoBranches) {
+                const int drained = drainBufferSink(branch->outputCtx->videoBufferFilterCtx, branch->encodeQueue, branch->outputCtx->framePool, oldestCapture);
+                frames = branch->outputCtx == outputCtx ? drained : frames;
+            }
+            drainBufferSink(outputCtx->audioBufferFilterCtx, audioEncodeQueue, outputCtx->framePool, 0);
+            stageStatsAddFrames(&filterStats, passStart, frames);
+        } else if (allDrained) {
+            break;
+        } else {
+            TRACE_SCOPE("idle wait");
+            doorbell->wait(std::chrono::microseconds(tickTimeout >= 0 ? std::min<int64_t>(tickTimeout, filterIdleTimeoutUs) : filterIdleTimeoutUs));
+        }
+    }
+
+    for (AVFrame*& frame : tickFrames) {
+        av_frame_free(&frame);
+    }
+
+    // All inputs are done, signal EOF to every source and collect the tail of the graphs
+    for (InputRings* rings : inputRings) {
+        if (rings->inputCtx->videoBufferFilterCtx != nullptr) {
+            addSourceFrame(rings, rings->inputCtx->videoBufferFilterCtx, nullptr);
+        }
+        if (rings->inputCtx->audioBufferFilterCtx != nullptr) {
+            addSourceFrame(rings, rings->inputCtx->audioBufferFilterCtx, nullptr);
+        }
+    }
+
+    // The tail is flushed after capture stopped, its latency means nothing
+    for (VideoBranch* branch : videoBranches) {
+        drainBufferSink(branch->outputCtx->videoBufferFilterCtx, branch->encodeQueue, branch->outputCtx->framePool, 0);
+    }
+    drainBufferSink(outputCtx->audioBufferFilterCtx, audioEncodeQueue, outputCtx->framePool, 0);
+
+    for (VideoBranch* branch : videoBranches) {
+        branch->encodeQueue->close();
+    }
+    audioEncodeQueue->close();
+    stageStatsLog(&filterStats, "filter");
+}
+
+// Sends one frame (nullptr flushes) and writes every packet the encoder has ready.
+// The writer meters stamped packets, the ones held back until the flush are not stamped.
+static void encodeFrame(MediaContext* outputCtx, std::mutex* muxMutex, AVFrame* frame, AVPacket* packet, int streamIndex, AVCodecContext* codecCtx, AVStream* stream) {
+    {
+        TRACE_SCOPE("avcodec_send_frame");
+        avcodec_send_frame(codecCtx, frame);
+    }
+
+    while (avcodec_receive_packet(codecCtx, packet) == 0) {
+        TRACE_SCOPE("write packet");
+        if (frame == nullptr) {
+            packet->opaque = nullptr;
+        }
+        writePacket(outputCtx, muxMutex, packet, streamIndex, codecCtx, stream);
+        av_packet_unref(packet);
+    }
+}
+
+// Puts the graph's output on the constant frame rate grid: filteredVidFrame->pts is on
+// the shared timeline, the encoder gets one frame per 1/frameRate. Every rendition of a
+// ladder runs its own loop, they all see the same frames and make the same choices.
+static void videoEncodeLoop(VideoBranch* branch, std::mutex* muxMutex) {
+    MediaContext* outputCtx = branch->outputCtx;
+    BoundedQueue<AVFrame*>* encodeQueue = branch->encodeQueue;
+    AVPacket *outputVidPacket = av_packet_alloc();
+    AVFrame *filteredVidFrame = nullptr;
+    AVFrame *previousVidFrame = nullptr;
+    AVCodecContext* codecCtx = outputCtx->videoCodecCtx;
+
+    VideoSync videoSync;
+    videoSyncInit(&videoSync, av_buffersink_get_time_base(outputCtx->videoBufferFilterCtx), outputCtx->frameRate);
+
+    EncoderStats stats;
+    encoderStatsInit(&stats);
+    TRACE_THREAD_NAME("video encode");
+
+    while (encodeQueue->pop(filteredVidFrame)) {
+        const int copies = videoSyncPlace(&videoSync, filteredVidFrame->pts);
+        if (copies < 0) {
+            metricSet(branch->metrics.dropped, videoSync.dropped);
+            framePoolReleaseFrame(outputCtx->framePool, &filteredVidFrame);
+            continue;
+        }
+
+        TRACE_SCOPE("encode");
+        const auto encodeStart = std::chrono::steady_clock::now();
+
+        // Fill the gap with the previous frame, the first frame fills it with itself.
+        // Copies were not captured now, they carry no latency stamp.
+        AVFrame* fillFrame = previousVidFrame != nullptr ? previousVidFrame : filteredVidFrame;
+        void* captureStamp = fillFrame->opaque;
+        fillFrame->opaque = nullptr;
+        for (int i = 0; i < copies; i++) {
+            fillFrame->pts = videoSyncNextPts(&videoSync, codecCtx->time_base);
+            encodeFrame(outputCtx, muxMutex, fillFrame, outputVidPacket, outputCtx->videoIndex, codecCtx, outputCtx->videoStream);
+        }
+        fillFrame->opaque = captureStamp;
+
+        filteredVidFrame->pts = videoSyncNextPts(&videoSync, codecCtx->time_base);
+        encodeFrame(outputCtx, muxMutex, filteredVidFrame, outputVidPacket, outputCtx->videoIndex, codecCtx, outputCtx->videoStream);
+        const auto encodeEnd = std::chrono::steady_clock::now();
+        encoderStatsAdd(&stats, encodeStart, encodeEnd);
+        metricObserve(branch->metrics.encode, std::chrono::duration_cast<std::chrono::microseconds>(encodeEnd - encodeStart).count());
+        metricSet(branch->metrics.frames, videoSync.frames);
+        metricSet(branch->metrics.duplicated, videoSync.duplicated);
+        metricSet(branch->metrics.position, av_rescale_q(videoSync.nextFrame, av_inv_q(videoSync.frameRate), AV_TIME_BASE_Q));
+        TRACE_COUNTER_ID("video frames out", branch->index + 1, videoSync.frames);
+        TRACE_COUNTER_ID("video frames dropped", branch->index + 1, videoSync.dropped);
+
+        framePoolReleaseFrame(outputCtx->framePool, &previousVidFrame);
+        previousVidFrame = filteredVidFrame;
+    }
+    framePoolReleaseFrame(outputCtx->framePool, &previousVidFrame);
+
+    // Queue closed: flush the encoder, packets held until the end don't count as latency
+    encodeFrame(outputCtx, muxMutex, nullptr, outputVidPacket, outputCtx->videoIndex, outputCtx->videoCodecCtx, outputCtx->videoStream);
+    encoderStatsLog(&stats, branch->name.c_str());
+    videoSyncLog(&videoSync);
+
+    const StageStats encodeStats = { stats.frames, std::chrono::duration_cast<std::chrono::microseconds>(stats.busy).count() };
+    stageStatsLog(&encodeStats, (branch->name + " encode").c_str());
+
+    av_packet_free(&outputVidPacket);
+}
+
+// Sends one frame (nullptr flushes) through the resampler and encodes every complete
+// encoder frame, so the FIFO never backs up
+static void resampleAndEncode(MediaContext* outputCtx, std::mutex* muxMutex, const AVFrame* frame, AVFrame* resampledFrame, AVPacket* packet) {
+    streamResamplerSendFrame(outputCtx->resampler, frame);
+
+    while (streamResamplerReceiveFrame(outputCtx->resampler, resampledFrame) == 0) {
+        resampledFrame->pts = av_rescale_q_rnd(resampledFrame->pts,
+            (AVRational){1, outputCtx->audioCodecCtx->sample_rate},
+            outputCtx->audioCodecCtx->time_base,
+            AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+
+        encodeFrame(outputCtx, muxMutex, resampledFrame, packet, outputCtx->audioIndex, outputCtx->audioCodecCtx, outputCtx->audioStream);
+        av_frame_unref(resampledFrame);
+    }
+}
+
+// Fills a gap in the timeline with silence shaped like frame, at most frame->nb_samples at a time
+static void sendSilence(MediaContext* outputCtx, std::mutex* muxMutex, const AVFrame* frame, int64_t samples, AVFrame* resampledFrame, AVPacket* packet) {
+    AVFrame* silence = framePoolAcquireFrame(outputCtx->framePool);
+
+    while (samples > 0) {
+        silence->format = frame->format;
+        silence->sample_rate = frame->sample_rate;
+        silence->nb_samples = (int) std::min<int64_t>(samples, std::max(frame->nb_samples, 1));
+        av_channel_layout_copy(&silence->ch_layout, &frame->ch_layout);
+        if (framePoolGetAudioBuffer(outputCtx->framePool, silence) < 0) {
+            break;
+        }
+
+        av_samples_set_silence(silence->extended_data, 0, silence->nb_samples, silence->ch_layout.nb_channels, (AVSampleFormat) silence->format);
+        resampleAndEncode(outputCtx, muxMutex, silence, resampledFrame, packet);
+        samples -= silence->nb_samples;
+        av_frame_unref(silence);
+    }
+
+    framePoolReleaseFrame(outputCtx->framePool, &silence);
+}
+
+// Counts samples like the encoder does, but checks the count against the graph's pts and
+// closes any drift beyond audioSyncToleranceUs with silence or by cutting samples
+static void audioEncodeLoop(MediaContext* outputCtx, BoundedQueue<AVFrame*>* encodeQueue, std::mutex* muxMutex, const PipelineMetrics* pipelineMetrics) {
+    AVPacket *outputAudPacket = av_packet_alloc();
+    AVFrame *filteredAudFrame = nullptr;
+    AVFrame *filteredResampledFrame = av_frame_alloc();
+
+    AudioSync audioSync;
+    audioSyncInit(&audioSync, av_buffersink_get_time_base(outputCtx->audioBufferFilterCtx),
+        av_buffersink_get_sample_rate(outputCtx->audioBufferFilterCtx));
+    TRACE_THREAD_NAME("audio encode");
+
+    while (encodeQueue->pop(filteredAudFrame)) {
+        const int64_t change = audioSyncPlace(&audioSync, filteredAudFrame);
+        if (change > 0) {
+            sendSilence(outputCtx, muxMutex, filteredAudFrame, change, filteredResampledFrame, outputAudPacket);
+        } else if (change < 0) {
+            audioFrameSkipSamples(filteredAudFrame, (int) -change);
+        }
+
+        if (filteredAudFrame->nb_samples > 0) {
+            resampleAndEncode(outputCtx, muxMutex, filteredAudFrame, filteredResampledFrame, outputAudPacket);
+        }
+        framePoolReleaseFrame(outputCtx->framePool, &filteredAudFrame);
+
+        metricSet(pipelineMetrics->audioFifo, streamResamplerBuffered(outputCtx->resampler));
+        metricSet(pipelineMetrics->audioPosition, av_rescale(audioSync.nextSample, AV_TIME_BASE, audioSync.sampleRate));
+        metricSet(pipelineMetrics->audioSilence, audioSync.silenceSamples);
+        metricSet(pipelineMetrics->audioCut, audioSync.droppedSamples);
+    }
+
+    // Queue closed: flush the resampler, then the encoder
+    resampleAndEncode(outputCtx, muxMutex, nullptr, filteredResampledFrame, outputAudPacket);
+    encodeFrame(outputCtx, muxMutex, nullptr, outputAudPacket, outputCtx->audioIndex, outputCtx->audioCodecCtx, outputCtx->audioStream);
+    audioSyncLog(&audioSync);
+
+    av_frame_free(&filteredResampledFrame);
+    av_packet_free(&outputAudPacket);
+}
+
+bool runPipeline(const std::vector<PipelineInput>& inputs, MediaContext* outputCtx, VideoConvertMode convertMode, bool syncVideo) {
+    // The conversion of the decoded video is looked up here, not per frame. The graph
+    // declared the sources with the converted format, an input without a converter
+    // would feed them frames they can't take.
+    std::vector<FrameConverter*> videoConverters(inputs.size(), nullptr);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const AVCodecContext* codecCtx = inputs[i].inputCtx->videoCodecCtx;
+        if (convertMode == VIDEO_CONVERT_GRAPH || codecCtx == nullptr || outputCtx->videoCodecCtx == nullptr) {
+            continue;
+        }
+
+        videoConverters[i] = frameConverterAlloc(codecCtx->pix_fmt, outputCtx->videoCodecCtx->pix_fmt,
+            codecCtx->width, codecCtx->height, convertMode == VIDEO_CONVERT_KERNEL ? &inputs[i].crop : nullptr);
+        const std::string name = "input" + std::to_string(i + 1);
+        if (videoConverters[i] == nullptr) {
+            std::cout << "Failed to create the frame converter of " << name << "\n";
+            for (FrameConverter*& converter : videoConverters) {
+                frameConverterFree(&converter);
+            }
+            return false;
+        }
+        frameConverterLog(videoConverters[i], name.c_str());
+    }
+
+    BoundedQueue<AVFrame*> audioEncodeQueue(encodeQueueDepth);
+    std::mutex muxMutex;
+    Doorbell filterDoorbell;
+    Timeline timeline;
+    timelineInit(&timeline);
+    StageDepth audioEncodeDepth = {};
+
+    std::vector<InputRings*> inputRings;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const PipelineInput& input = inputs[i];
+        InputRings* rings = new InputRings();
+        rings->inputCtx = input.inputCtx;
+        rings->name = "input" + std::to_string(i + 1);
+        rings->videoConverter = videoConverters[i];
+        // Offline inputs wait for the pipeline, nothing is lost and nothing needs dropping
+        rings->live = isLiveInput(input.inputCtx);
+        rings->videoRing = new FrameRing(videoRingDepth, rings->live ? FRAME_RING_DROP_OLDEST : FRAME_RING_BLOCK, outputCtx->framePool);
+        rings->audioRing = new FrameRing(audioRingDepth, FRAME_RING_BLOCK, outputCtx->framePool);
+        rings->filterDoorbell = &filterDoorbell;
+        rings->syncIndex = -1;
+        inputClockInit(&rings->clock, &timeline);
+        if (input.inputCtx->hasRange) {
+            inputClockAnchor(&rings->clock, input.inputCtx->rangeStart);
+        }
+        inputRings.push_back(rings);
+    }
+
+    const bool hasVideo = outputCtx->videoBufferFilterCtx != nullptr;
+    const bool hasAudio = outputCtx->audioBufferFilterCtx != nullptr;
+
+    // Every input with video is one input of the synchronizer, ticking at the output rate
+    InputSync* inputSync = nullptr;
+    if (syncVideo && hasVideo) {
+        std::vector<int64_t> maxStalenessUs;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].inputCtx->videoBufferFilterCtx != nullptr) {
+                inputRings[i]->syncIndex = (int) maxStalenessUs.size();
+                maxStalenessUs.push_back(inputs[i].maxStalenessUs);
+            }
+        }
+        inputSync = inputSyncAlloc((int) maxStalenessUs.size(), outputCtx->frameRate, AV_TIME_BASE_Q, maxStalenessUs.data(),
+            outputCtx->framePool);
+    }
+
+    // The main output, then the renditions below it, each with an encoder thread of its own
+    std::vector<VideoBranch*> videoBranches;
+    if (hasVideo) {
+        for (int i = -1; i < outputCtx->renditionCount; i++) {
+            VideoBranch* branch = new VideoBranch();
+            branch->outputCtx = i < 0 ? outputCtx : outputCtx->renditions[i];
+            branch->encodeQueue = new BoundedQueue<AVFrame*>(encodeQueueDepth);
+            branch->name = i < 0 ? "video" : "video " + std::to_string(branch->outputCtx->videoCodecCtx->height) + "p";
+            branch->index = i + 1;
+            videoBranches.push_back(branch);
+        }
+    }
+
+    PipelineMetrics pipelineMetrics = {};
+    addPipelineMetrics(&pipelineMetrics, outputCtx, inputRings, videoBranches);
+
+    std::vector<std::thread> videoEncodeThreads;
+    std::thread audioEncodeThread;
+    for (VideoBranch* branch : videoBranches) {
+        videoEncodeThreads.emplace_back(videoEncodeLoop, branch, &muxMutex);
+    }
+    if (hasAudio) {
+        audioEncodeThread = std::thread(audioEncodeLoop, outputCtx, &audioEncodeQueue, &muxMutex, &pipelineMetrics);
+    }
+    std::thread filterThread(filterLoop, inputRings, outputCtx, &filterDoorbell, videoBranches, &audioEncodeQueue,
+        &audioEncodeDepth, &pipelineMetrics, inputSync, &timeline);
+
+    std::vector<std::thread> decodeThreads;
+    for (InputRings* rings : inputRings) {
+        decodeThreads.emplace_back(demuxDecodeLoop, rings->inputCtx, outputCtx, rings);
+    }
+
+    for (std::thread& decodeThread : decodeThreads) {
+        decodeThread.join();
+    }
+
+    filterThread.join();
+    for (std::thread& videoEncodeThread : videoEncodeThreads) {
+        videoEncodeThread.join();
+    }
+    if (hasAudio) {
+        audioEncodeThread.join();
+    }
+    publishMetrics(&pipelineMetrics, inputRings, videoBranches, &audioEncodeQueue, true);
+
+    for (size_t i = 0; i < inputRings.size(); i++) {
+        std::cout << "input" << i + 1
+            << " video frames: " << inputRings[i]->videoRing->pushedCount()
+            << (inputRings[i]->live ? ", dropped: " : ", blocked: ") << inputRings[i]->videoRing->overrunCount()
+            << ", convert failed: " << inputRings[i]->convertFailures
+            << ", filter refused: " << inputRings[i]->filterRejects
+            << " | audio frames: " << inputRings[i]->audioRing->pushedCount()
+            << ", blocked: " << inputRings[i]->audioRing->overrunCount() << "\n";
+        logDepth("video ring depth", &inputRings[i]->videoDepth, inputRings[i]->videoRing->depth());
+        logDepth("audio ring depth", &inputRings[i]->audioDepth, inputRings[i]->audioRing->depth());
+        inputClockLog(&inputRings[i]->clock, "  source");
+        stageStatsLog(&inputRings[i]->decodeStats, (inputRings[i]->name + " decode").c_str());
+        stageStatsLog(&inputRings[i]->convertStats, (inputRings[i]->name + " convert").c_str());
+
+        frameConverterFree(&inputRings[i]->videoConverter);
+        delete inputRings[i]->videoRing;
+        delete inputRings[i]->audioRing;
+        delete inputRings[i];
+    }
+
+    std::cout << "filter thread: " << filterDoorbell.waitCount() << " idle waits, "
+        << filterDoorbell.timeoutCount() << " timed out\n";
+    if (inputSync != nullptr) {
+        inputSyncLog(inputSync);
+        inputSyncFree(&inputSync);
+    }
+    for (VideoBranch* branch : videoBranches) {
+        logDepth((branch->name + " encode queue depth").c_str(), &branch->encodeDepth, encodeQueueDepth);
+    }
+    logDepth("audio encode queue depth", &audioEncodeDepth, encodeQueueDepth);
+
+    framePoolLogStats(outputCtx->framePool);
+    for (VideoBranch* branch : videoBranches) {
+        if (branch->outputCtx != outputCtx) {
+            framePoolLogStats(branch->outputCtx->framePool);
+        }
+        delete branch->encodeQueue;
+        delete branch;
+    }
+
+    return true;
+}
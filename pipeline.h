@@ -0,0 +1,50 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <vector>
+
+#include "mediacontext.h"
+#include "videoconvert.h"
+
+#define videoRingDepth 8
+#define audioRingDepth 64
+#define encodeQueueDepth 8
+
+// Set from the signal handler, every stage drains and exits once it is raised
+extern std::atomic<bool> shouldStop;
+
+typedef struct PipelineInput {
+    MediaContext* inputCtx;
+    VideoCropRect crop;     // the only part converted in VIDEO_CONVERT_KERNEL mode
+    int64_t maxStalenessUs; // how long a synced tick waits for this input's video
+} PipelineInput;
+
+// capture/decode (one thread per input) -> filter -> video/audio encode. Decoded frames
+// go through lock-free rings; live video drops the oldest frame rather than stall capture,
+// files and lavfi sources block their decode thread instead (see isLiveInput()).
+// Every stage drains its input until EAGAIN, then blocks: the encoders on their queues,
+// the filter thread on a doorbell rung by the decode threads, a decode thread facing a
+// full blocking ring on the ring's doorbell until the filter thread takes a frame. Only capture devices that
+// answer EAGAIN are retried, with a short backoff.
+// Source pts are mapped onto one timeline shared by all inputs (see timeline.h) and the
+// output is constant frame rate; duplicated and dropped frames are counted.
+// Per-stage queue depths are printed at the end. With outputCtx->metrics set, fps, stage
+// times, queue fills, A/V drift, bytes written and drops are published live (see metrics.h).
+//
+// The filter graphs must already be configured: every input's buffer sources and the
+// output's buffer sinks set. Inputs without a buffer source for a stream have that
+// stream skipped. An output without an audio encoder gets no audio thread. Renditions
+// of outputCtx (see addRendition()) get a video encoder thread each, fed from their own
+// buffer sink of the same graph; they take their audio from the main encoder. Gain/mute
+// changes queued on outputCtx->audioMixer are applied by the filter thread.
+//
+// With syncVideo the video of the inputs reaches the compositor through an InputSync
+// (see inputsync.h): one frame per input per output tick, an input late for a tick
+// waited for at most its maxStalenessUs before its last frame is repeated. Meant for
+// live inputs, one slow capture then can't hold the composite back.
+// Returns true once every input has ended or shouldStop was raised and all encoders are
+// flushed, false at once when the video of an input can't be converted for the encoder.
+bool runPipeline(const std::vector<PipelineInput>& inputs, MediaContext* outputCtx, VideoConvertMode convertMode, bool syncVideo);
+
+#endif
@@ -0,0 +1,171 @@
+#include "resampler.h"
+
+extern "C" {
+#include <libavutil/audio_fifo.h>
+#include <libavutil/mem.h>
+#include <libswresample/swresample.h>
+}
+
+struct StreamResampler {
+    SwrContext* swrCtx;
+    AVAudioFifo* fifo;
+    FramePool* framePool;
+
+    uint8_t** scratch;
+    int scratchSamples;
+
+    AVChannelLayout outChLayout;
+    AVSampleFormat outSampleFormat;
+    int outSampleRate;
+    int frameSize;
+
+    int64_t samplesOut;
+    bool flushed;
+};
+
+static int allocScratch(StreamResampler* resampler, int samples) {
+    if (resampler->scratch != nullptr) {
+        av_freep(&resampler->scratch[0]);
+        av_freep(&resampler->scratch);
+    }
+
+    resampler->scratchSamples = samples;
+    return av_samples_alloc_array_and_samples(&resampler->scratch, nullptr,
+        resampler->outChLayout.nb_channels, samples, resampler->outSampleFormat, 0);
+}
+
+StreamResampler* streamResamplerAlloc(const StreamResamplerParams* params, FramePool* framePool) {
+    StreamResampler* resampler = (StreamResampler*) av_mallocz(sizeof(StreamResampler));
+    if (resampler == nullptr) {
+        return nullptr;
+    }
+
+    resampler->framePool = framePool;
+    resampler->outSampleFormat = params->outSampleFormat;
+    resampler->outSampleRate = params->outSampleRate;
+    resampler->frameSize = params->frameSize > 0 ? params->frameSize : params->maxInputSamples;
+    av_channel_layout_copy(&resampler->outChLayout, params->outChLayout);
+
+    if (swr_alloc_set_opts2(&resampler->swrCtx,
+            params->outChLayout,
+            params->outSampleFormat,
+            params->outSampleRate,
+            params->inChLayout,
+            params->inSampleFormat,
+            params->inSampleRate,
+            0,
+            nullptr) < 0 || swr_init(resampler->swrCtx) < 0) {
+        streamResamplerFree(&resampler);
+        return nullptr;
+    }
+
+    const int scratchSamples = swr_get_out_samples(resampler->swrCtx, params->maxInputSamples);
+    if (scratchSamples < 0 || allocScratch(resampler, FFMAX(scratchSamples, 1)) < 0) {
+        streamResamplerFree(&resampler);
+        return nullptr;
+    }
+
+    // Room for one scratch load on top of an almost full frame, so writes never realloc
+    resampler->fifo = av_audio_fifo_alloc(params->outSampleFormat,
+        params->outChLayout->nb_channels,
+        resampler->scratchSamples + 2 * resampler->frameSize);
+    if (resampler->fifo == nullptr) {
+        streamResamplerFree(&resampler);
+        return nullptr;
+    }
+
+    return resampler;
+}
+
+void streamResamplerFree(StreamResampler** resampler) {
+    if (resampler == nullptr || *resampler == nullptr) {
+        return;
+    }
+
+    if ((*resampler)->scratch != nullptr) {
+        av_freep(&(*resampler)->scratch[0]);
+        av_freep(&(*resampler)->scratch);
+    }
+    if ((*resampler)->fifo != nullptr) {
+        av_audio_fifo_free((*resampler)->fifo);
+    }
+    swr_free(&(*resampler)->swrCtx);
+    av_channel_layout_uninit(&(*resampler)->outChLayout);
+
+    av_freep(resampler);
+}
+
+int streamResamplerSendFrame(StreamResampler* resampler, const AVFrame* frame) {
+    if (resampler->flushed) {
+        return AVERROR_EOF;
+    }
+
+    const uint8_t** input = nullptr;
+    int inputSamples = 0;
+    if (frame != nullptr) {
+        input = (const uint8_t**) frame->extended_data;
+        inputSamples = frame->nb_samples;
+    } else {
+        resampler->flushed = true;
+    }
+
+    // Only grows when an input frame is larger than anything seen before
+    const int needed = swr_get_out_samples(resampler->swrCtx, inputSamples);
+    if (needed > resampler->scratchSamples) {
+        int ret = allocScratch(resampler, needed);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    const int converted = swr_convert(resampler->swrCtx, resampler->scratch, resampler->scratchSamples, input, inputSamples);
+    if (converted < 0) {
+        return converted;
+    }
+
+    if (converted > 0 && av_audio_fifo_write(resampler->fifo, (void**) resampler->scratch, converted) < converted) {
+        return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+int streamResamplerReceiveFrame(StreamResampler* resampler, AVFrame* frame) {
+    const int buffered = av_audio_fifo_size(resampler->fifo);
+    int readSamples = resampler->frameSize;
+
+    if (buffered < resampler->frameSize) {
+        if (!resampler->flushed) {
+            return AVERROR(EAGAIN);
+        } else if (buffered == 0) {
+            return AVERROR_EOF;
+        }
+        readSamples = buffered;
+    }
+
+    frame->nb_samples = readSamples;
+    frame->format = resampler->outSampleFormat;
+    frame->sample_rate = resampler->outSampleRate;
+    av_channel_layout_copy(&frame->ch_layout, &resampler->outChLayout);
+
+    int ret = resampler->framePool != nullptr
+        ? framePoolGetAudioBuffer(resampler->framePool, frame)
+        : av_frame_get_buffer(frame, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (av_audio_fifo_read(resampler->fifo, (void**) frame->extended_data, readSamples) < readSamples) {
+        av_frame_unref(frame);
+        return AVERROR(EIO);
+    }
+
+    frame->pts = resampler->samplesOut;
+    resampler->samplesOut += readSamples;
+
+    return 0;
+}
+
+int streamResamplerBuffered(StreamResampler* resampler) {
+    return av_audio_fifo_size(resampler->fifo);
+}
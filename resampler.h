@@ -0,0 +1,44 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include "framepool.h"
+
+// Converts an arbitrary audio stream into encoder sized frames.
+// One scratch buffer, sized from swr_get_out_samples() for the largest input seen,
+// is reused for every swr_convert() call and the FIFO is preallocated, so nothing is
+// allocated per frame. Every full frame_size chunk is available right after
+// streamResamplerSendFrame(); sending nullptr flushes swr and the FIFO tail.
+typedef struct StreamResampler StreamResampler;
+
+typedef struct StreamResamplerParams {
+    const AVChannelLayout* inChLayout;
+    AVSampleFormat inSampleFormat;
+    int inSampleRate;
+    const AVChannelLayout* outChLayout;
+    AVSampleFormat outSampleFormat;
+    int outSampleRate;
+    int frameSize;          // samples per output frame, the encoder's frame_size
+    int maxInputSamples;    // expected nb_samples of input frames, used to size the scratch buffer
+} StreamResamplerParams;
+
+StreamResampler* streamResamplerAlloc(const StreamResamplerParams* params, FramePool* framePool);
+void streamResamplerFree(StreamResampler** resampler);
+
+// frame == nullptr marks the end of the stream
+int streamResamplerSendFrame(StreamResampler* resampler, const AVFrame* frame);
+
+// Returns 0 with a frame of frameSize samples (the last one may be shorter after a
+// flush), AVERROR(EAGAIN) when more input is needed or AVERROR_EOF once flushed and
+// drained. frame->pts counts output samples since the start of the stream.
+int streamResamplerReceiveFrame(StreamResampler* resampler, AVFrame* frame);
+
+// Samples currently waiting in the FIFO
+int streamResamplerBuffered(StreamResampler* resampler);
+
+#endif
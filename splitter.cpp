@@ -0,0 +1,424 @@
+#include "splitter.h"
+#include "batch.h"
+#include "outputformat.h"
+#include "outputwriter.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#define splitPollMs 50
+
+typedef struct SplitPart {
+    std::string output;
+    int64_t start;          // microseconds into the inputs
+    int64_t end;
+    pid_t pid;
+    std::chrono::steady_clock::time_point startTime;
+    double wallSeconds;
+    double cpuSeconds;
+    bool succeeded;
+} SplitPart;
+
+static AVFormatContext* openProbe(const JobInput* input) {
+    AVFormatContext* formatCtx = nullptr;
+    const AVInputFormat* inputFormat = input->format.empty() ? nullptr : av_find_input_format(input->format.c_str());
+    if (avformat_open_input(&formatCtx, input->url.c_str(), inputFormat, nullptr) < 0) {
+        return nullptr;
+    }
+    if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
+        avformat_close_input(&formatCtx);
+        return nullptr;
+    }
+    return formatCtx;
+}
+
+// Keyframe times of the first input with video, in microseconds from its first timestamp.
+// Reads every packet but decodes none.
+static bool scanKeyframes(const JobConfig* job, std::vector<int64_t>* keyframes, int64_t* duration) {
+    for (const JobInput& input : job->inputs) {
+        AVFormatContext* formatCtx = openProbe(&input);
+        if (formatCtx == nullptr) {
+            std::cout << "Failed to open input " << input.url << "\n";
+            return false;
+        }
+
+        const int videoIndex = av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (videoIndex < 0) {
+            avformat_close_input(&formatCtx);
+            continue;
+        }
+
+        const AVRational timeBase = formatCtx->streams[videoIndex]->time_base;
+        const int64_t firstTime = formatCtx->start_time != AV_NOPTS_VALUE ? formatCtx->start_time : 0;
+        *duration = formatCtx->duration;
+
+        AVPacket* packet = av_packet_alloc();
+        while (av_read_frame(formatCtx, packet) >= 0) {
+            if (packet->stream_index == videoIndex && (packet->flags & AV_PKT_FLAG_KEY) && packet->pts != AV_NOPTS_VALUE) {
+                keyframes->push_back(av_rescale_q(packet->pts, timeBase, AV_TIME_BASE_Q) - firstTime);
+            }
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+        avformat_close_input(&formatCtx);
+
+        std::sort(keyframes->begin(), keyframes->end());
+        return *duration > 0;
+    }
+
+    std::cout << "No input with video to split\n";
+    return false;
+}
+
+static bool jobHasAudio(const JobConfig* job) {
+    if (!job->outputAudio) {
+        return false;
+    }
+
+    bool hasAudio = false;
+    for (const JobInput& input : job->inputs) {
+        if (!input.audio || hasAudio) {
+            continue;
+        }
+        AVFormatContext* formatCtx = openProbe(&input);
+        if (formatCtx != nullptr) {
+            hasAudio = av_find_best_stream(formatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0) >= 0;
+            avformat_close_input(&formatCtx);
+        }
+    }
+    return hasAudio;
+}
+
+// The keyframe nearest to each of parts - 1 equal cuts of [start, end), a keyframe at most once
+static std::vector<int64_t> chooseCuts(const std::vector<int64_t>& keyframes, int64_t start, int64_t end, int parts) {
+    std::vector<int64_t> cuts = { start };
+    for (int i = 1; i < parts; i++) {
+        const int64_t target = start + (end - start) * i / parts;
+        int64_t best = -1;
+        for (int64_t keyframe : keyframes) {
+            if (keyframe > cuts.back() && keyframe < end && (best < 0 || llabs(keyframe - target) < llabs(best - target))) {
+                best = keyframe;
+            }
+        }
+        if (best > 0) {
+            cuts.push_back(best);
+        }
+    }
+    cuts.push_back(end);
+    return cuts;
+}
+
+// "out.mp4" -> "out.<tag>.mp4"
+static std::string partFilename(const std::string& output, const std::string& tag) {
+    const size_t slash = output.find_last_of('/');
+    const size_t dot = output.find_last_of('.');
+    const size_t split = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : output.size();
+    return output.substr(0, split) + "." + tag + output.substr(split);
+}
+
+static std::string secondsArg(int64_t us) {
+    char value[32];
+    snprintf(value, sizeof(value), "%.6f", us / (double) AV_TIME_BASE);
+    return value;
+}
+
+// Runs every part at once and waits for all of them; parts[i].succeeded tells which made it
+static void runParts(const char* program, const std::vector<std::vector<std::string>>& args, std::vector<SplitPart>* parts,
+                     const std::atomic<bool>* stop) {
+    int running = 0;
+    for (size_t i = 0; i < parts->size(); i++) {
+        SplitPart& part = (*parts)[i];
+        part.startTime = std::chrono::steady_clock::now();
+        part.pid = spawnEngine(program, args[i], part.output + ".log");
+        running += part.pid > 0 ? 1 : 0;
+    }
+
+    bool stopping = false;
+    while (running > 0) {
+        if (!stopping && stop->load()) {
+            stopping = true;
+            for (SplitPart& part : *parts) {
+                if (part.pid > 0) {
+                    kill(part.pid, SIGINT);
+                }
+            }
+        }
+
+        int status;
+        struct rusage usage;
+        const pid_t pid = wait4(-1, &status, WNOHANG, &usage);
+        if (pid <= 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(splitPollMs));
+            continue;
+        }
+
+        for (SplitPart& part : *parts) {
+            if (part.pid != pid) {
+                continue;
+            }
+            part.pid = 0;
+            part.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - part.startTime).count();
+            part.cpuSeconds = childCpuSeconds(&usage);
+            part.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            running--;
+
+            std::cout << "part " << part.output << ": " << (part.succeeded ? "ok" : "failed") << ", "
+                << secondsArg(part.start) << " - " << secondsArg(part.end) << " s, "
+                << part.wallSeconds << " s wall, " << part.cpuSeconds << " s cpu\n";
+        }
+    }
+}
+
+// The packets of one stream of one file, in order
+typedef struct PartReader {
+    AVFormatContext* formatCtx;
+    int streamIndex;
+} PartReader;
+
+static bool openPartReader(PartReader* reader, const std::string& path, AVMediaType mediaType) {
+    reader->formatCtx = nullptr;
+    if (avformat_open_input(&reader->formatCtx, path.c_str(), nullptr, nullptr) < 0) {
+        return false;
+    }
+    if (avformat_find_stream_info(reader->formatCtx, nullptr) < 0) {
+        return false;
+    }
+    reader->streamIndex = av_find_best_stream(reader->formatCtx, mediaType, -1, -1, nullptr, 0);
+    return reader->streamIndex >= 0;
+}
+
+static bool readPartPacket(PartReader* reader, AVPacket* packet) {
+    while (av_read_frame(reader->formatCtx, packet) >= 0) {
+        if (packet->stream_index == reader->streamIndex) {
+            return true;
+        }
+        av_packet_unref(packet);
+    }
+    return false;
+}
+
+static AVStream* partStream(const PartReader* reader) {
+    return reader->formatCtx->streams[reader->streamIndex];
+}
+
+// The next packet as the output takes it: in timeBase, offset and on stream outputIndex
+static bool readJoinPacket(PartReader* reader, AVPacket* packet, AVRational timeBase, int64_t offset, int outputIndex) {
+    if (!readPartPacket(reader, packet)) {
+        return false;
+    }
+    av_packet_rescale_ts(packet, partStream(reader)->time_base, timeBase);
+    packet->pts += offset;
+    packet->dts += offset;
+    packet->stream_index = outputIndex;
+    packet->pos = -1;
+    return true;
+}
+
+// Copies the video of every part, offset by its start, and the audio into job->output.
+// Packets go out in dts order; a part's first dts, held back by B-frames, may fall before
+// the previous part's last one and is moved just after it, pts are kept as encoded.
+static bool joinParts(const JobConfig* job, const std::vector<SplitPart>& parts, const std::string& audioPath) {
+    const bool hasAudio = !audioPath.empty();
+    PartReader video = {};
+    PartReader audio = {};
+    size_t videoPart = 0;
+
+    if (!openPartReader(&video, parts[0].output, AVMEDIA_TYPE_VIDEO) || (hasAudio && !openPartReader(&audio, audioPath, AVMEDIA_TYPE_AUDIO))) {
+        std::cout << "Failed to read the parts back\n";
+        avformat_close_input(&video.formatCtx);
+        avformat_close_input(&audio.formatCtx);
+        return false;
+    }
+
+    OutputOptions options = job->outputOptions;
+    AVFormatContext* formatCtx = nullptr;
+    if (outputAllocContext(&formatCtx, job->output.c_str(), &options) < 0) {
+        avformat_close_input(&video.formatCtx);
+        avformat_close_input(&audio.formatCtx);
+        return false;
+    }
+
+    const PartReader* readers[] = { &video, &audio };
+    for (int i = 0; i < (hasAudio ? 2 : 1); i++) {
+        AVStream* stream = avformat_new_stream(formatCtx, nullptr);
+        avcodec_parameters_copy(stream->codecpar, partStream(readers[i])->codecpar);
+        stream->codecpar->codec_tag = 0;
+        stream->time_base = partStream(readers[i])->time_base;
+    }
+
+    OutputWriter* writer = outputWriterOpen(formatCtx, &options);
+    if (writer == nullptr || outputWriteHeader(formatCtx, &options) < 0) {
+        outputWriterClose(&writer);
+        avformat_free_context(formatCtx);
+        avformat_close_input(&video.formatCtx);
+        avformat_close_input(&audio.formatCtx);
+        return false;
+    }
+
+    const AVRational videoTimeBase = formatCtx->streams[0]->time_base;
+    const AVRational audioTimeBase = hasAudio ? formatCtx->streams[1]->time_base : videoTimeBase;
+    AVPacket* videoPacket = av_packet_alloc();
+    AVPacket* audioPacket = av_packet_alloc();
+    bool hasVideoPacket = readJoinPacket(&video, videoPacket, videoTimeBase, 0, 0);
+    bool hasAudioPacket = hasAudio && readJoinPacket(&audio, audioPacket, audioTimeBase, 0, 1);
+    int64_t lastVideoDts = AV_NOPTS_VALUE;
+    int ret = 0;
+
+    while (ret >= 0 && (hasVideoPacket || hasAudioPacket)) {
+        // Next part once this one is out of video, its timestamps after the part's start
+        if (!hasVideoPacket && videoPart + 1 < parts.size()) {
+            avformat_close_input(&video.formatCtx);
+            if (!openPartReader(&video, parts[++videoPart].output, AVMEDIA_TYPE_VIDEO)) {
+                ret = AVERROR(EIO);
+                break;
+            }
+            const int64_t offset = av_rescale_q(parts[videoPart].start - parts[0].start, AV_TIME_BASE_Q, videoTimeBase);
+            hasVideoPacket = readJoinPacket(&video, videoPacket, videoTimeBase, offset, 0);
+            continue;
+        }
+
+        const bool videoFirst = hasVideoPacket &&
+            (!hasAudioPacket || av_compare_ts(videoPacket->dts, videoTimeBase, audioPacket->dts, audioTimeBase) <= 0);
+        if (videoFirst) {
+            if (lastVideoDts != AV_NOPTS_VALUE && videoPacket->dts <= lastVideoDts) {
+                videoPacket->dts = lastVideoDts + 1;
+            }
+            lastVideoDts = videoPacket->dts;
+            const int64_t offset = av_rescale_q(parts[videoPart].start - parts[0].start, AV_TIME_BASE_Q, videoTimeBase);
+            ret = outputWriterWrite(writer, videoPacket);
+            hasVideoPacket = readJoinPacket(&video, videoPacket, videoTimeBase, offset, 0);
+        } else {
+            ret = outputWriterWrite(writer, audioPacket);
+            hasAudioPacket = readJoinPacket(&audio, audioPacket, audioTimeBase, 0, 1);
+        }
+    }
+
+    if (outputWriterFinish(writer) < 0) {
+        ret = AVERROR(EIO);
+    }
+    outputWriterLog(writer);
+    outputWriterClose(&writer);
+    avformat_free_context(formatCtx);
+    av_packet_free(&videoPacket);
+    av_packet_free(&audioPacket);
+    avformat_close_input(&video.formatCtx);
+    avformat_close_input(&audio.formatCtx);
+
+    return ret >= 0;
+}
+
+bool runSplit(const char* program, int argc, char* argv[], const JobConfig* job, const std::atomic<bool>* stop) {
+    if (!job->sinks.empty() || !job->ladder.empty() || job->outputOptions.container != OUTPUT_SINGLE_FILE || !job->outputVideo) {
+        std::cout << "--split writes one video file: no tee, ladder, fragments or segments\n";
+        return false;
+    }
+
+    const auto splitStart = std::chrono::steady_clock::now();
+    std::vector<int64_t> keyframes;
+    int64_t duration;
+    if (!scanKeyframes(job, &keyframes, &duration)) {
+        std::cout << "--split needs file inputs with a known duration\n";
+        return false;
+    }
+
+    const int64_t start = (int64_t) llround(job->startSeconds * AV_TIME_BASE);
+    const int64_t end = job->endSeconds > 0 ? std::min((int64_t) llround(job->endSeconds * AV_TIME_BASE), duration) : duration;
+    const std::vector<int64_t> cuts = chooseCuts(keyframes, start, end, job->splitParts);
+    const double scanSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - splitStart).count();
+
+    const int cores = std::max(1, (int) std::thread::hardware_concurrency());
+    const int partCount = (int) cuts.size() - 1;
+    const int threadsPerPart = std::max(1, cores / partCount);
+    std::cout << "split: " << keyframes.size() << " keyframes scanned in " << scanSeconds << " s, "
+        << partCount << " parts, " << threadsPerPart << " encoder threads each\n";
+
+    // The job as given, then what makes it one part: later flags win
+    std::vector<std::string> baseArgs(argv + 1, argv + argc);
+    baseArgs.insert(baseArgs.end(), { "--split", "0", "--container", "file" });
+    // The parts would fight over the port and the file
+    baseArgs.insert(baseArgs.end(), { "--metrics-port", "0", "--metrics-file", "" });
+    if (job->videoEncoder.threadCount == 0) {
+        baseArgs.insert(baseArgs.end(), { "--threads", std::to_string(threadsPerPart) });
+    }
+
+    std::vector<SplitPart> parts;
+    std::vector<std::vector<std::string>> partArgs;
+    for (int i = 0; i < partCount; i++) {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "part%02d", i);
+
+        SplitPart part = {};
+        part.output = partFilename(job->output, tag);
+        part.start = cuts[i];
+        part.end = cuts[i + 1];
+        parts.push_back(part);
+
+        std::vector<std::string> args = baseArgs;
+        args.insert(args.end(), { "-o", part.output, "--start", secondsArg(part.start), "--end", secondsArg(part.end), "--video-only" });
+        partArgs.push_back(args);
+    }
+
+    // The whole range, anchored where the first part starts
+    std::string audioPath;
+    if (jobHasAudio(job)) {
+        SplitPart part = {};
+        part.output = audioPath = partFilename(job->output, "audio");
+        part.start = start;
+        part.end = end;
+        parts.push_back(part);
+
+        std::vector<std::string> args = baseArgs;
+        args.insert(args.end(), { "-o", part.output, "--start", secondsArg(start), "--end", secondsArg(end), "--audio-only" });
+        partArgs.push_back(args);
+    }
+
+    const auto encodeStart = std::chrono::steady_clock::now();
+    runParts(program, partArgs, &parts, stop);
+    const double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+
+    double cpuSeconds = 0;
+    double serialSeconds = 0;
+    bool succeeded = true;
+    for (const SplitPart& part : parts) {
+        cpuSeconds += part.cpuSeconds;
+        serialSeconds += part.wallSeconds;
+        succeeded = succeeded && part.succeeded;
+    }
+    if (!succeeded) {
+        std::cout << "split: a part failed, the parts and their logs are kept\n";
+        return false;
+    }
+
+    const auto joinStart = std::chrono::steady_clock::now();
+    std::vector<SplitPart> videoParts(parts.begin(), parts.begin() + partCount);
+    if (!joinParts(job, videoParts, audioPath)) {
+        std::cout << "split: failed to join the parts into " << job->output << ", they are kept\n";
+        return false;
+    }
+    const double joinSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - joinStart).count();
+
+    for (const SplitPart& part : parts) {
+        remove(part.output.c_str());
+        remove((part.output + ".log").c_str());
+    }
+
+    const double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - splitStart).count();
+    std::cout << "split: " << job->output << ", " << (end - start) / (double) AV_TIME_BASE << " s in " << totalSeconds << " s wall"
+        << " (scan " << scanSeconds << ", encode " << encodeSeconds << ", join " << joinSeconds << "), "
+        << cpuSeconds << " s cpu, parts took " << serialSeconds / encodeSeconds << "x their wall time together\n";
+    return true;
+}
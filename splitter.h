@@ -0,0 +1,29 @@
+#ifndef SPLITTER_H
+#define SPLITTER_H
+
+#include <atomic>
+
+#include "jobconfig.h"
+
+// Segment-parallel encoding of one long offline job.
+//
+// The first video input is scanned for keyframes (a demux pass, nothing is decoded) and
+// cut at the keyframes nearest to N equal time ranges. Every range is encoded video only
+// by an engine process of its own, "program <args> --start S --end E --video-only", each
+// with cores / N encoder threads. One more process encodes the audio of the whole job
+// with --audio-only: audio is cheap next to video, and one continuous audio stream has
+// no encoder priming or padding at the cuts.
+//
+// Every range's timeline is anchored at its start (see setInputRange()), so the parts
+// are joined by copying their packets, each offset by its start: the output has the
+// same frames, duration and A/V offset as a serial run. The parts go to
+// <output>.partNN.<ext> and <output>.audio.<ext> with their logs beside them; they are
+// removed once the join succeeded.
+//
+// Needs file inputs with a known duration and a single file output: no tee, ladder,
+// fragments or segments.
+
+// Returns false after printing what failed. Raising stop interrupts the parts.
+bool runSplit(const char* program, int argc, char* argv[], const JobConfig* job, const std::atomic<bool>* stop);
+
+#endif
@@ -0,0 +1,191 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/samplefmt.h>
+}
+
+// How far, in frames, a video frame may stray from its slot before it is dropped or
+// the gap before it is filled; the same 1.1 ffmpeg's -vsync cfr uses
+#define videoSyncDriftFrames 1.1
+
+void timelineInit(Timeline* timeline) {
+    timeline->origin.store(0);
+}
+
+int64_t timelineTimeAt(const Timeline* timeline, int64_t clockTime) {
+    const int64_t origin = timeline->origin.load();
+    return origin != 0 ? clockTime - origin : 0;
+}
+
+// Microseconds since the first frame of any input, the first caller sets the origin
+static int64_t timelineTimeOf(Timeline* timeline, int64_t arrivalTime) {
+    int64_t origin = 0;
+    if (timeline->origin.compare_exchange_strong(origin, arrivalTime)) {
+        return 0;
+    }
+    return arrivalTime - origin;
+}
+
+static void inputClockStreamInit(InputClockStream* stream) {
+    stream->lastTime = AV_NOPTS_VALUE;
+    stream->lastDuration = 0;
+    stream->lastArrival = 0;
+}
+
+void inputClockInit(InputClock* clock, Timeline* timeline) {
+    clock->timeline = timeline;
+    clock->offset = AV_NOPTS_VALUE;
+    inputClockStreamInit(&clock->video);
+    inputClockStreamInit(&clock->audio);
+    clock->discontinuities = 0;
+    clock->missingPts = 0;
+}
+
+void inputClockAnchor(InputClock* clock, int64_t sourceTime) {
+    clock->offset = -sourceTime;
+}
+
+void inputClockMapFrame(InputClock* clock, AVFrame* frame, AVRational timeBase, bool isVideo, int64_t arrivalTime) {
+    InputClockStream* stream = isVideo ? &clock->video : &clock->audio;
+    const int64_t source = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+
+    int64_t time;
+    if (source == AV_NOPTS_VALUE) {
+        clock->missingPts++;
+        time = stream->lastTime != AV_NOPTS_VALUE ? stream->lastTime + stream->lastDuration : timelineTimeOf(clock->timeline, arrivalTime);
+    } else {
+        const int64_t sourceTime = av_rescale_q(source, timeBase, AV_TIME_BASE_Q);
+        if (clock->offset == AV_NOPTS_VALUE) {
+            clock->offset = timelineTimeOf(clock->timeline, arrivalTime) - sourceTime;
+        }
+        time = sourceTime + clock->offset;
+
+        // Backwards by more than a frame, or ahead of what the wall clock allows
+        if (stream->lastTime != AV_NOPTS_VALUE) {
+            const int64_t step = time - stream->lastTime;
+            const int64_t wallStep = arrivalTime - stream->lastArrival;
+            if (step < -stream->lastDuration || step - wallStep > timelineJumpThresholdUs) {
+                const int64_t continued = stream->lastTime + std::max(stream->lastDuration, wallStep);
+                clock->offset += continued - time;
+                time = continued;
+                clock->discontinuities++;
+            }
+        }
+    }
+
+    // Audio knows its duration, video only the spacing of its frames
+    if (!isVideo && frame->sample_rate > 0) {
+        stream->lastDuration = av_rescale(frame->nb_samples, AV_TIME_BASE, frame->sample_rate);
+    } else if (stream->lastTime != AV_NOPTS_VALUE && time > stream->lastTime) {
+        stream->lastDuration = time - stream->lastTime;
+    }
+    stream->lastTime = time;
+    stream->lastArrival = arrivalTime;
+
+    frame->pts = av_rescale_q(time, AV_TIME_BASE_Q, timeBase);
+}
+
+void inputClockLog(const InputClock* clock, const char* name) {
+    std::cout << name << " timestamps: " << clock->discontinuities << " discontinuities, "
+        << clock->missingPts << " frames without pts\n";
+}
+
+void videoSyncInit(VideoSync* sync, AVRational inTimeBase, AVRational frameRate) {
+    sync->inTimeBase = inTimeBase;
+    sync->frameRate = frameRate;
+    sync->nextFrame = 0;
+    sync->started = false;
+    sync->frames = 0;
+    sync->duplicated = 0;
+    sync->dropped = 0;
+}
+
+int videoSyncPlace(VideoSync* sync, int64_t pts) {
+    sync->frames++;
+    if (pts == AV_NOPTS_VALUE) {
+        sync->started = true;
+        return 0;
+    }
+
+    const double slot = pts * av_q2d(sync->inTimeBase) * av_q2d(sync->frameRate);
+    const double delta = slot - sync->nextFrame;
+
+    int copies = 0;
+    if (!sync->started) {
+        sync->started = true;
+        copies = (int) std::max(0L, lrint(delta));
+    } else if (delta < -videoSyncDriftFrames) {
+        sync->dropped++;
+        return -1;
+    } else if (delta > videoSyncDriftFrames) {
+        copies = (int) lrint(delta);
+    }
+
+    sync->duplicated += copies;
+    return copies;
+}
+
+int64_t videoSyncNextPts(VideoSync* sync, AVRational timeBase) {
+    return av_rescale_q(sync->nextFrame++, av_inv_q(sync->frameRate), timeBase);
+}
+
+void videoSyncLog(const VideoSync* sync) {
+    std::cout << "cfr: " << sync->frames << " frames in, " << sync->nextFrame << " out at "
+        << av_q2d(sync->frameRate) << " fps, " << sync->duplicated << " duplicated, "
+        << sync->dropped << " dropped\n";
+}
+
+void audioSyncInit(AudioSync* sync, AVRational inTimeBase, int sampleRate) {
+    sync->inTimeBase = inTimeBase;
+    sync->sampleRate = sampleRate;
+    sync->nextSample = 0;
+    sync->silenceSamples = 0;
+    sync->droppedSamples = 0;
+}
+
+int64_t audioSyncPlace(AudioSync* sync, const AVFrame* frame) {
+    int64_t change = 0;
+
+    if (frame->pts != AV_NOPTS_VALUE) {
+        const int64_t position = av_rescale_q(frame->pts, sync->inTimeBase, av_make_q(1, sync->sampleRate));
+        const int64_t drift = position - sync->nextSample;
+        const int64_t tolerance = av_rescale(audioSyncToleranceUs, sync->sampleRate, AV_TIME_BASE);
+
+        if (drift > tolerance) {
+            change = drift;
+            sync->silenceSamples += drift;
+        } else if (drift < -tolerance) {
+            change = std::max(drift, (int64_t) -frame->nb_samples);
+            sync->droppedSamples -= change;
+        }
+    }
+
+    sync->nextSample += change + frame->nb_samples;
+    return change;
+}
+
+void audioFrameSkipSamples(AVFrame* frame, int samples) {
+    const AVSampleFormat format = (AVSampleFormat) frame->format;
+    const int channels = frame->ch_layout.nb_channels;
+    const bool planar = av_sample_fmt_is_planar(format);
+    const int step = samples * av_get_bytes_per_sample(format) * (planar ? 1 : channels);
+
+    for (int i = 0; i < (planar ? channels : 1); i++) {
+        frame->extended_data[i] += step;
+        if (i < AV_NUM_DATA_POINTERS) {
+            frame->data[i] = frame->extended_data[i];
+        }
+    }
+    frame->nb_samples -= samples;
+}
+
+void audioSyncLog(const AudioSync* sync) {
+    std::cout << "audio sync: " << sync->nextSample << " samples, "
+        << sync->silenceSamples << " of silence inserted, "
+        << sync->droppedSamples << " dropped\n";
+}
@@ -0,0 +1,117 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <atomic>
+#include <cstdint>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+// Timestamps from source PTS instead of frame counters.
+//
+// Every input maps its source PTS onto one shared timeline: microseconds since the
+// first frame of any input arrived. An input is anchored where its first frame arrives
+// on that timeline, so inputs that open late or whose clocks start at unrelated values
+// still line up. Jitter is kept as is; a discontinuity (PTS going backwards, or jumping
+// forward by more than the wall clock moved) re-anchors the input so that it continues
+// right after its last frame. A capture stall, where PTS and wall clock advance
+// together, is a real gap and is kept.
+//
+// At the output, VideoSync places frames on a constant frame rate grid by duplicating
+// or dropping them, and AudioSync keeps the sample count in step with the timeline by
+// inserting silence or cutting samples. Both count everything they change.
+
+#define timelineJumpThresholdUs 1000000
+#define audioSyncToleranceUs 40000
+
+typedef struct Timeline {
+    std::atomic<int64_t> origin;    // latencyClockNow() at the first frame, 0 before
+} Timeline;
+
+void timelineInit(Timeline* timeline);
+
+// Timeline position of a latencyClockNow() reading, 0 before the first frame
+int64_t timelineTimeAt(const Timeline* timeline, int64_t clockTime);
+
+// Per stream state of an InputClock
+typedef struct InputClockStream {
+    int64_t lastTime;       // timeline microseconds of the last frame, AV_NOPTS_VALUE before it
+    int64_t lastDuration;
+    int64_t lastArrival;
+} InputClockStream;
+
+// Maps the PTS of one input. Its streams share the offset, so audio and video keep the
+// spacing their demuxer gave them. Used by one thread only.
+typedef struct InputClock {
+    Timeline* timeline;
+    int64_t offset;         // timeline - source microseconds, AV_NOPTS_VALUE until anchored
+    InputClockStream video;
+    InputClockStream audio;
+
+    int64_t discontinuities;
+    int64_t missingPts;     // frames without any timestamp, placed right after the previous one
+} InputClock;
+
+void inputClockInit(InputClock* clock, Timeline* timeline);
+
+// Anchors the input up front instead of at its first frame: sourceTime, in microseconds,
+// is timeline 0. A range of a file (see setInputRange()) starts at 0 wherever it is cut.
+void inputClockAnchor(InputClock* clock, int64_t sourceTime);
+
+// Rewrites frame->pts, in timeBase, from the source clock to the timeline. arrivalTime
+// is latencyClockNow() when the frame's packet was read.
+void inputClockMapFrame(InputClock* clock, AVFrame* frame, AVRational timeBase, bool isVideo, int64_t arrivalTime);
+
+void inputClockLog(const InputClock* clock, const char* name);
+
+// Constant frame rate output. Frames whose PTS lands more than a frame behind the next
+// slot are dropped, gaps of more than a frame are filled with copies of the previous
+// frame; anything in between is jitter and takes the next slot.
+typedef struct VideoSync {
+    AVRational inTimeBase;
+    AVRational frameRate;
+    int64_t nextFrame;      // output frame index, in 1/frameRate
+    bool started;
+
+    int64_t frames;
+    int64_t duplicated;
+    int64_t dropped;
+} VideoSync;
+
+void videoSyncInit(VideoSync* sync, AVRational inTimeBase, AVRational frameRate);
+
+// Returns how many copies of the previous frame go before this one, or -1 to drop it.
+// The first frame fills the gap from 0 with copies of itself. Every frame or copy that
+// is output then takes videoSyncNextPts().
+int videoSyncPlace(VideoSync* sync, int64_t pts);
+
+// PTS of the next output frame in timeBase, advancing the grid
+int64_t videoSyncNextPts(VideoSync* sync, AVRational timeBase);
+
+void videoSyncLog(const VideoSync* sync);
+
+// Keeps an audio stream continuous on the timeline: output samples are counted, and
+// only when the frame PTS drifts further than audioSyncToleranceUs from the count is
+// the difference filled with silence or cut.
+typedef struct AudioSync {
+    AVRational inTimeBase;
+    int sampleRate;
+    int64_t nextSample;     // timeline position of the next sample, in 1/sampleRate
+
+    int64_t silenceSamples;
+    int64_t droppedSamples;
+} AudioSync;
+
+void audioSyncInit(AudioSync* sync, AVRational inTimeBase, int sampleRate);
+
+// Returns the samples of silence to insert before frame (> 0) or to cut from its start
+// (< 0, at most nb_samples), and advances the count past the frame.
+int64_t audioSyncPlace(AudioSync* sync, const AVFrame* frame);
+
+// Skips the first samples of frame without copying, its buffers stay referenced
+void audioFrameSkipSamples(AVFrame* frame, int samples);
+
+void audioSyncLog(const AudioSync* sync);
+
+#endif
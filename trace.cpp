@@ -0,0 +1,137 @@
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+typedef enum TraceEventType {
+    TRACE_EVENT_COMPLETE,
+    TRACE_EVENT_COUNTER,
+} TraceEventType;
+
+typedef struct TraceEvent {
+    const char* name;
+    int64_t time;
+    int64_t value;          // duration of a complete event, the counter's value
+    TraceEventType type;
+    int id;                 // counter track, 0 for none
+} TraceEvent;
+
+// One per thread, written by that thread only. count only grows; the exporter reads it
+// with acquire, so every event below it is complete.
+typedef struct TraceBuffer {
+    TraceEvent* events;
+    std::atomic<uint64_t> count;
+    const char* threadName;
+    int threadId;
+} TraceBuffer;
+
+static std::mutex registryMutex;
+static std::vector<TraceBuffer*> registry;
+static thread_local TraceBuffer* threadBuffer = nullptr;
+
+// Registered on a thread's first event and never freed, so the exporter can read the
+// events of threads that already ended
+static TraceBuffer* currentBuffer() {
+    if (threadBuffer == nullptr) {
+        TraceBuffer* buffer = new TraceBuffer();
+        buffer->events = new TraceEvent[traceBufferEvents];
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->threadName = nullptr;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffer->threadId = (int) registry.size() + 1;
+        registry.push_back(buffer);
+        threadBuffer = buffer;
+    }
+    return threadBuffer;
+}
+
+static void append(TraceEventType type, const char* name, int id, int64_t time, int64_t value) {
+    TraceBuffer* buffer = currentBuffer();
+    const uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer->events[count % traceBufferEvents];
+    event.name = name;
+    event.time = time;
+    event.value = value;
+    event.type = type;
+    event.id = id;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+int64_t traceClockNow() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+void traceComplete(const char* name, int64_t start, int64_t end) {
+    append(TRACE_EVENT_COMPLETE, name, 0, start, end - start);
+}
+
+void traceCounter(const char* name, int id, int64_t value) {
+    append(TRACE_EVENT_COUNTER, name, id, traceClockNow(), value);
+}
+
+void traceThreadName(const char* name) {
+    currentBuffer()->threadName = name;
+}
+
+void traceWrite() {
+    const char* path = getenv("TRACE_FILE") != nullptr ? getenv("TRACE_FILE") : "trace.json";
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "Failed to write trace " << path << "\n";
+        return;
+    }
+
+    const int pid = (int) getpid();
+    uint64_t written = 0;
+    uint64_t overwritten = 0;
+    bool first = true;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (TraceBuffer* buffer : registry) {
+        if (buffer->threadName != nullptr) {
+            out << (first ? "" : ",") << "\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pid
+                << ", \"tid\": " << buffer->threadId << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+            first = false;
+        }
+
+        const uint64_t count = buffer->count.load(std::memory_order_acquire);
+        const uint64_t begin = count > traceBufferEvents ? count - traceBufferEvents : 0;
+        for (uint64_t i = begin; i < count; i++) {
+            const TraceEvent& event = buffer->events[i % traceBufferEvents];
+            out << (first ? "" : ",") << "\n{\"name\": \"" << event.name << "\", \"pid\": " << pid
+                << ", \"tid\": " << buffer->threadId << ", \"ts\": " << event.time;
+            if (event.type == TRACE_EVENT_COMPLETE) {
+                out << ", \"ph\": \"X\", \"dur\": " << event.value << "}";
+            } else {
+                if (event.id != 0) {
+                    out << ", \"id\": " << event.id;
+                }
+                out << ", \"ph\": \"C\", \"args\": {\"value\": " << event.value << "}}";
+            }
+            first = false;
+        }
+        written += count - begin;
+        overwritten += begin;
+    }
+    out << "\n]}\n";
+
+    std::cout << "trace: " << written << " events from " << registry.size() << " threads to " << path;
+    if (overwritten > 0) {
+        std::cout << ", " << overwritten << " older ones overwritten";
+    }
+    std::cout << "\n";
+}
+
+#endif
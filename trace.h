@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+
+// Scoped timers and counters for the hot paths, exported as Chrome trace JSON (opens in
+// chrome://tracing and ui.perfetto.dev). Built with -DENABLE_TRACE ("make TRACE=1"),
+// otherwise every macro compiles to nothing.
+//
+//   TRACE_THREAD_NAME("decode input1");
+//   { TRACE_SCOPE("decode"); avcodec_send_packet(...); ... }
+//   TRACE_COUNTER("encode queue", queue->size());
+//   TRACE_COUNTER_ID("video ring", inputIndex + 1, ring->size());    // one track per id
+//   TRACE_WRITE();             // once every traced thread is done
+//
+// Every thread appends to a buffer of its own, no locks or shared cache lines on the hot
+// path: a scope costs two clock reads and one store. A buffer keeps the newest
+// traceBufferEvents events of its thread, older ones are overwritten. Names must be
+// string literals, only the pointer is kept. The file is $TRACE_FILE, trace.json if unset.
+
+#define traceBufferEvents (1 << 17)
+
+#ifdef ENABLE_TRACE
+
+int64_t traceClockNow();
+void traceComplete(const char* name, int64_t start, int64_t end);
+void traceCounter(const char* name, int id, int64_t value);
+void traceThreadName(const char* name);
+// Writes every thread's events; threads still tracing may lose their newest ones
+void traceWrite();
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), start(traceClockNow()) {}
+    ~TraceScope() { traceComplete(name, start, traceClockNow()); }
+
+private:
+    const char* name;
+    const int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) traceCounter(name, 0, (int64_t) (value))
+#define TRACE_COUNTER_ID(name, id, value) traceCounter(name, id, (int64_t) (value))
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#define TRACE_WRITE() traceWrite()
+
+#else
+
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_COUNTER(name, value) ((void) 0)
+#define TRACE_COUNTER_ID(name, id, value) ((void) 0)
+#define TRACE_THREAD_NAME(name) ((void) 0)
+#define TRACE_WRITE() ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+#include "uyvycrop.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+#include <libavutil/pixfmt.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define UYVY_CROP_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define UYVY_CROP_ARM 1
+#include <arm_neon.h>
+#endif
+
+// Converts one pair of source lines starting at pixel 'from'. Each implementation
+// handles as many pixels as its vector width allows and returns where it stopped,
+// the scalar code finishes the line.
+typedef int (*LinePairFunc)(const uint8_t* line0, const uint8_t* line1, uint8_t* y0, uint8_t* y1,
+                            uint8_t* u, uint8_t* v, int width);
+
+static void linePairScalar(const uint8_t* line0, const uint8_t* line1, uint8_t* y0, uint8_t* y1,
+                           uint8_t* u, uint8_t* v, int from, int width) {
+    for (int i = from; i < width; i += 2) {
+        y0[i] = line0[2 * i + 1];
+        y0[i + 1] = line0[2 * i + 3];
+        y1[i] = line1[2 * i + 1];
+        y1[i + 1] = line1[2 * i + 3];
+        u[i / 2] = (line0[2 * i] + line1[2 * i]) >> 1;
+        v[i / 2] = (line0[2 * i + 2] + line1[2 * i + 2]) >> 1;
+    }
+}
+
+static int linePairC(const uint8_t*, const uint8_t*, uint8_t*, uint8_t*, uint8_t*, uint8_t*, int) {
+    return 0;
+}
+
+#ifdef UYVY_CROP_X86
+__attribute__((target("sse2")))
+static int linePairSse2(const uint8_t* line0, const uint8_t* line1, uint8_t* y0, uint8_t* y1,
+                        uint8_t* u, uint8_t* v, int width) {
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    // 16 pixels = 32 source bytes per line
+    for (; i + 16 <= width; i += 16) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i*) (line0 + 2 * i));
+        const __m128i a1 = _mm_loadu_si128((const __m128i*) (line0 + 2 * i + 16));
+        const __m128i b0 = _mm_loadu_si128((const __m128i*) (line1 + 2 * i));
+        const __m128i b1 = _mm_loadu_si128((const __m128i*) (line1 + 2 * i + 16));
+
+        _mm_storeu_si128((__m128i*) (y0 + i), _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8)));
+        _mm_storeu_si128((__m128i*) (y1 + i), _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8)));
+
+        // u/v as 16-bit words, (a + b) >> 1 without pavgb's rounding
+        const __m128i uv0 = _mm_srli_epi16(_mm_add_epi16(_mm_and_si128(a0, lowBytes), _mm_and_si128(b0, lowBytes)), 1);
+        const __m128i uv1 = _mm_srli_epi16(_mm_add_epi16(_mm_and_si128(a1, lowBytes), _mm_and_si128(b1, lowBytes)), 1);
+        const __m128i uv = _mm_packus_epi16(uv0, uv1);
+
+        _mm_storel_epi64((__m128i*) (u + i / 2), _mm_packus_epi16(_mm_and_si128(uv, lowBytes), zero));
+        _mm_storel_epi64((__m128i*) (v + i / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int linePairAvx2(const uint8_t* line0, const uint8_t* line1, uint8_t* y0, uint8_t* y1,
+                        uint8_t* u, uint8_t* v, int width) {
+    const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+
+    // 32 pixels = 64 source bytes per line. packus works per 128-bit lane, the
+    // 0xD8 permute puts the lanes back in order.
+    for (; i + 32 <= width; i += 32) {
+        const __m256i a0 = _mm256_loadu_si256((const __m256i*) (line0 + 2 * i));
+        const __m256i a1 = _mm256_loadu_si256((const __m256i*) (line0 + 2 * i + 32));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*) (line1 + 2 * i));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i*) (line1 + 2 * i + 32));
+
+        const __m256i ya = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+        const __m256i yb = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+        _mm256_storeu_si256((__m256i*) (y0 + i), _mm256_permute4x64_epi64(ya, 0xD8));
+        _mm256_storeu_si256((__m256i*) (y1 + i), _mm256_permute4x64_epi64(yb, 0xD8));
+
+        const __m256i uv0 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_and_si256(a0, lowBytes), _mm256_and_si256(b0, lowBytes)), 1);
+        const __m256i uv1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_and_si256(a1, lowBytes), _mm256_and_si256(b1, lowBytes)), 1);
+        const __m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(uv0, uv1), 0xD8);
+
+        const __m256i uu = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(uv, lowBytes), zero), 0xD8);
+        const __m256i vv = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(uv, 8), zero), 0xD8);
+        _mm_storeu_si128((__m128i*) (u + i / 2), _mm256_castsi256_si128(uu));
+        _mm_storeu_si128((__m128i*) (v + i / 2), _mm256_castsi256_si128(vv));
+    }
+
+    return i;
+}
+#endif
+
+#ifdef UYVY_CROP_ARM
+static int linePairNeon(const uint8_t* line0, const uint8_t* line1, uint8_t* y0, uint8_t* y1,
+                        uint8_t* u, uint8_t* v, int width) {
+    int i = 0;
+
+    // vld4 splits 32 pixels into U, Y(even), V, Y(odd); vhadd is the truncating average
+    for (; i + 32 <= width; i += 32) {
+        const uint8x16x4_t a = vld4q_u8(line0 + 2 * i);
+        const uint8x16x4_t b = vld4q_u8(line1 + 2 * i);
+
+        uint8x16x2_t ya;
+        ya.val[0] = a.val[1];
+        ya.val[1] = a.val[3];
+        vst2q_u8(y0 + i, ya);
+
+        uint8x16x2_t yb;
+        yb.val[0] = b.val[1];
+        yb.val[1] = b.val[3];
+        vst2q_u8(y1 + i, yb);
+
+        vst1q_u8(u + i / 2, vhaddq_u8(a.val[0], b.val[0]));
+        vst1q_u8(v + i / 2, vhaddq_u8(a.val[2], b.val[2]));
+    }
+
+    return i;
+}
+#endif
+
+bool uyvyCropImplAvailable(UyvyCropImpl impl) {
+    const int cpuFlags = av_get_cpu_flags();
+
+    switch (impl) {
+    case UYVY_CROP_AUTO:
+    case UYVY_CROP_C:
+        return true;
+#ifdef UYVY_CROP_X86
+    case UYVY_CROP_SSE2:
+        return cpuFlags & AV_CPU_FLAG_SSE2;
+    case UYVY_CROP_AVX2:
+        return cpuFlags & AV_CPU_FLAG_AVX2;
+#endif
+#ifdef UYVY_CROP_ARM
+    case UYVY_CROP_NEON:
+        return cpuFlags & AV_CPU_FLAG_NEON;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* uyvyCropImplName(UyvyCropImpl impl) {
+    switch (impl) {
+    case UYVY_CROP_AUTO: return "auto";
+    case UYVY_CROP_C: return "c";
+    case UYVY_CROP_SSE2: return "sse2";
+    case UYVY_CROP_AVX2: return "avx2";
+    case UYVY_CROP_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+static LinePairFunc linePairFunc(UyvyCropImpl impl) {
+    switch (impl) {
+#ifdef UYVY_CROP_X86
+    case UYVY_CROP_SSE2: return linePairSse2;
+    case UYVY_CROP_AVX2: return linePairAvx2;
+#endif
+#ifdef UYVY_CROP_ARM
+    case UYVY_CROP_NEON: return linePairNeon;
+#endif
+    default: return linePairC;
+    }
+}
+
+static UyvyCropImpl bestImpl() {
+    static const UyvyCropImpl best = [] {
+        const UyvyCropImpl candidates[] = { UYVY_CROP_AVX2, UYVY_CROP_SSE2, UYVY_CROP_NEON };
+        for (UyvyCropImpl impl : candidates) {
+            if (uyvyCropImplAvailable(impl)) {
+                return impl;
+            }
+        }
+        return UYVY_CROP_C;
+    }();
+    return best;
+}
+
+bool uyvyCropToYuv420pWith(UyvyCropImpl impl, const uint8_t* src, int srcStride, int x, int y, int width, int height,
+                           uint8_t* const dst[3], const int dstStride[3]) {
+    if (impl == UYVY_CROP_AUTO) {
+        impl = bestImpl();
+    } else if (!uyvyCropImplAvailable(impl)) {
+        return false;
+    }
+
+    const LinePairFunc convertLinePair = linePairFunc(impl);
+    const uint8_t* line = src + (ptrdiff_t) y * srcStride + 2 * x;
+
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t* line0 = line + (ptrdiff_t) row * srcStride;
+        const uint8_t* line1 = line0 + srcStride;
+        uint8_t* y0 = dst[0] + (ptrdiff_t) row * dstStride[0];
+        uint8_t* y1 = y0 + dstStride[0];
+        uint8_t* u = dst[1] + (ptrdiff_t) (row / 2) * dstStride[1];
+        uint8_t* v = dst[2] + (ptrdiff_t) (row / 2) * dstStride[2];
+
+        const int done = convertLinePair(line0, line1, y0, y1, u, v, width);
+        linePairScalar(line0, line1, y0, y1, u, v, done, width);
+    }
+
+    return true;
+}
+
+void uyvyCropToYuv420p(const uint8_t* src, int srcStride, int x, int y, int width, int height,
+                       uint8_t* const dst[3], const int dstStride[3]) {
+    uyvyCropToYuv420pWith(UYVY_CROP_AUTO, src, srcStride, x, y, width, height, dst, dstStride);
+}
+
+int uyvyCropFrameToYuv420p(const AVFrame* src, AVFrame* dst, int x, int y, int width, int height) {
+    if (src->format != AV_PIX_FMT_UYVY422 || dst->format != AV_PIX_FMT_YUV420P ||
+        (x | y | width | height) & 1 || x + width > src->width || y + height > src->height ||
+        width > dst->width || height > dst->height) {
+        return AVERROR(EINVAL);
+    }
+
+    uyvyCropToYuv420p(src->data[0], src->linesize[0], x, y, width, height, dst->data, dst->linesize);
+    return 0;
+}
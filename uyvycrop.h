@@ -0,0 +1,37 @@
+#ifndef UYVYCROP_H
+#define UYVYCROP_H
+
+#include <cstdint>
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Converts only a crop rectangle of a packed uyvy422 image straight into planar yuv420p.
+// Output matches libswscale's unscaled uyvy422 -> yuv420p converter (the C path taken
+// for same-size conversions): luma is copied and the chroma of each line pair is
+// averaged with truncation, so converting then cropping gives the same pixels.
+// x, y, width and height must be even.
+
+typedef enum UyvyCropImpl {
+    UYVY_CROP_AUTO,     // best implementation for this CPU
+    UYVY_CROP_C,
+    UYVY_CROP_SSE2,
+    UYVY_CROP_AVX2,
+    UYVY_CROP_NEON,
+} UyvyCropImpl;
+
+void uyvyCropToYuv420p(const uint8_t* src, int srcStride, int x, int y, int width, int height,
+                       uint8_t* const dst[3], const int dstStride[3]);
+
+// Same with an explicit implementation, for testing and benchmarking. Returns false
+// when impl was not compiled in or the CPU lacks it.
+bool uyvyCropToYuv420pWith(UyvyCropImpl impl, const uint8_t* src, int srcStride, int x, int y, int width, int height,
+                           uint8_t* const dst[3], const int dstStride[3]);
+
+bool uyvyCropImplAvailable(UyvyCropImpl impl);
+const char* uyvyCropImplName(UyvyCropImpl impl);
+
+// Frame level helper: dst must already have yuv420p buffers of at least width x height
+int uyvyCropFrameToYuv420p(const AVFrame* src, AVFrame* dst, int x, int y, int width, int height);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef VIDEOCONVERT_H
+#define VIDEOCONVERT_H
+
+#include <cstring>
+
+// Where the capture pixel format (uyvy422) is turned into the encoder's yuv420p. sws and
+// kernel go through a FrameConverter (see frameconvert.h): specialized for the capture
+// format when it has one, swscale otherwise.
+typedef enum VideoConvertMode {
+    VIDEO_CONVERT_SWS,      // convert the whole frame, then crop in the filter graph
+    VIDEO_CONVERT_GRAPH,    // feed native frames, the graph crops first and converts only the crop
+    VIDEO_CONVERT_KERNEL,   // convert only the crop, the graph gets crop sized yuv420p
+} VideoConvertMode;
+
+typedef struct VideoCropRect {
+    int x;
+    int y;
+    int width;
+    int height;
+} VideoCropRect;
+
+// "--convert sws|graph|kernel" on the command line, defaults to VIDEO_CONVERT_SWS
+static inline VideoConvertMode parseVideoConvertMode(int argc, char* argv[]) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--convert") == 0) {
+            if (strcmp(argv[i + 1], "graph") == 0) {
+                return VIDEO_CONVERT_GRAPH;
+            }
+            if (strcmp(argv[i + 1], "kernel") == 0) {
+                return VIDEO_CONVERT_KERNEL;
+            }
+            return VIDEO_CONVERT_SWS;
+        }
+    }
+    return VIDEO_CONVERT_SWS;
+}
+
+#endif